@@ -0,0 +1,219 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Convert a binary results file ('--format binary') back to the CSV the
+ * simulation writes by default, value for value:
+ *
+ *	hb2csv [-p] IN.hbr [OUT.csv]
+ *
+ * -p	Also print the header (parameters and seed) to stderr.
+ * Without OUT.csv the CSV goes to stdout.
+ * */
+
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>	/* offsetof(...) */
+#include <unistd.h>	/* getopt(...) */
+#include <string.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_output.h"
+
+
+
+/** Records are read in blocks of this many floats. */
+#define BLOCK_FLOATS	16384
+
+/** Header size of each version, the fields of later ones left out. */
+static const size_t header_sizes[ HB_RESULT_VERSION + 1 ] = {
+	0,
+	offsetof( HBResultHeader_t, converge_window ),
+	offsetof( HBResultHeader_t, output_every ),
+	sizeof( HBResultHeader_t )
+};
+
+
+
+/** Print the header fields, one per line. */
+static void print_header( const HBResultHeader_t *const header, FILE *out )
+{
+	fprintf( out, "version                    %u\n", header->version );
+	fprintf( out, "records                    %" G_GUINT64_FORMAT "\n", header->records );
+	fprintf( out, "columns                    %u\n", header->ncols );
+	fprintf( out, "iterations                 %" G_GUINT64_FORMAT "\n", header->num_iterations );
+	fprintf( out, "bugs                       %" G_GUINT64_FORMAT "\n", header->bugs_number );
+	fprintf( out, "world                      %" G_GUINT64_FORMAT " x %" G_GUINT64_FORMAT "\n",
+					header->world_width, header->world_height );
+	fprintf( out, "seed                       %u\n", header->seed );
+	fprintf( out, "diffusion rate             %g\n", header->world_diffusion_rate );
+	fprintf( out, "evaporation rate           %g\n", header->world_evaporation_rate );
+	fprintf( out, "random move chance         %g\n", header->bugs_random_move_chance );
+	fprintf( out, "ideal temperature          %u .. %u\n",
+		header->bugs_temperature_min_ideal, header->bugs_temperature_max_ideal );
+	fprintf( out, "output heat                %u .. %u\n",
+		header->bugs_heat_min_output, header->bugs_heat_max_output );
+	fprintf( out, "engines (diffusion/agents) %d / %d\n",
+					header->diffusion, header->agents );
+	fprintf( out, "rng                        %d\n", header->rng );
+	fprintf( out, "threads                    %u\n", header->threads );
+	fprintf( out, "convergence (window/tol)   %" G_GUINT64_FORMAT " / %g\n",
+		header->converge_window, header->converge_tolerance );
+	fprintf( out, "stopped at                 %" G_GUINT64_FORMAT "\n",
+						header->stop_iteration );
+	fprintf( out, "output every               %" G_GUINT64_FORMAT "\n",
+						header->output_every );
+	fprintf( out, "aggregates                 0x%x\n", header->aggregate );
+
+	return;
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	GError *err_main = NULL;
+	FILE *in = NULL, *out = stdout;
+	float *block = NULL;
+
+	HBResultHeader_t header;
+	gboolean show_header = FALSE;
+	size_t rd, block_size;
+	int status = 0;
+	int c;
+
+
+	while ((c = getopt( argc, argv, "p" )) != -1)
+	{
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			c != 'p', HB_INVALID_PARAMETER, error_handler,
+			"Usage: %s [-p] IN.hbr [OUT.csv]", argv[ 0 ] );
+
+		show_header = TRUE;
+	}
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(optind >= argc) || (argc - optind > 2),
+		HB_INVALID_PARAMETER, error_handler,
+		"Usage: %s [-p] IN.hbr [OUT.csv]", argv[ 0 ] );
+
+
+	/* Read and check the header. */
+	in = fopen( argv[ optind ], "rb" );
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		in == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open input file." );
+
+	memset( &header, 0, sizeof( HBResultHeader_t ) );
+	rd = fread( &header, 1, sizeof( HBResultHeader_t ), in );
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(rd < header_sizes[ 1 ]) || memcmp( header.magic, HB_RESULT_MAGIC,
+						sizeof( header.magic ) ),
+		HB_INVALID_PARAMETER, error_handler,
+		"Not a heatbugs binary results file." );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		header.endian != HB_RESULT_ENDIAN,
+		HB_INVALID_PARAMETER, error_handler,
+		"Results file was written with another byte order." );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(header.version == 0) || (header.version > HB_RESULT_VERSION)
+		|| (header.ncols == 0) || (header.ncols > HB_MAX_COLUMNS)
+		|| (header.header_size < header_sizes[ header.version ]),
+		HB_INVALID_PARAMETER, error_handler,
+		"Unsupported results file version or header." );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		fseek( in, header.header_size, SEEK_SET ) != 0,
+		HB_INVALID_PARAMETER, error_handler,
+		"Results file is truncated." );
+
+	/* Fields after an older version's header are records, not its. */
+	memset( (char *) &header + header_sizes[ header.version ], 0,
+		sizeof( HBResultHeader_t ) - header_sizes[ header.version ] );
+
+	if (header.version < 3) header.output_every = 1;
+
+	if (show_header) print_header( &header, stderr );
+
+
+	/* Convert whole records, a block at a time. */
+	block_size = BLOCK_FLOATS - BLOCK_FLOATS % header.ncols;
+
+	block = (float *) malloc( block_size * sizeof( float ) );
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		block == NULL, HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for records." );
+
+	if (argc - optind == 2)
+	{
+		out = fopen( argv[ optind + 1 ], "w" );
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			out == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open output file." );
+	}
+
+	while ((rd = fread( block, sizeof( float ), block_size, in )) > 0)
+	{
+		for (size_t idx = 0; idx + header.ncols <= rd; idx += header.ncols)
+		{
+			for (guint32 col = 0; col < header.ncols; col++)
+				fprintf( out, col ? ",%.17g" : "%.17g", block[ idx + col ] );
+
+			fputc( '\n', out );
+		}
+
+		/* A partial record can only be the last, from a killed run. */
+		if (rd % header.ncols)
+			fprintf( stderr, "Warning: last record is incomplete.\n" );
+	}
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		ferror( in ) || ferror( out ),
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Error reading or writing records." );
+
+
+	goto clean_all;
+
+
+error_handler:
+
+	/* Handle error. */
+	fprintf( stderr, "Error: %s\n\n", err_main->message );
+	g_error_free( err_main );
+	status = 1;
+
+
+clean_all:
+
+	if (block) free( block );
+	if (in) fclose( in );
+	if (out && out != stdout) fclose( out );
+
+
+	return status;
+}
@@ -0,0 +1,204 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Compare the CSV results of two runs, record by record, e.g. a run with
+ * 16 bit heat cells (-DHB_HEAT_*) against the same run with float cells:
+ *
+ *	hb_accuracy [-e EPS] REFERENCE.csv OTHER.csv
+ *
+ * For every column prints the maximum absolute and relative error, the
+ * root mean square error and the first record (iteration) where the
+ * absolute error goes over EPS (default 0.01).
+ * */
+
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>	/* getopt(...) */
+#include <string.h>
+#include <math.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_output.h"
+
+
+
+/** Default absolute error for 'first over'. */
+#define ACCURACY_EPS	0.01
+
+
+
+/** Error of one column. */
+typedef struct
+{
+	double max_abs;		/* Maximum absolute error.		*/
+	double max_rel;		/* Maximum relative error.		*/
+	double sum_sq;		/* Sum of squared errors, for RMS.	*/
+	long first_over;	/* First record over EPS, -1 if none.	*/
+
+} ColumnError_t;
+
+
+
+/**
+ * Read one CSV record.
+ *
+ * @param[in]	in		- CSV file.
+ * @param[out]	values		- Up to HB_MAX_COLUMNS values.
+ * @return	Number of values read, 0 at end of file.
+ * */
+static guint32 read_record( FILE *in, double *const values )
+{
+	char line[ 64 * HB_MAX_COLUMNS ];
+	char *pos, *end;
+	guint32 ncols = 0;
+
+
+	if (fgets( line, sizeof( line ), in ) == NULL) return 0;
+
+	for (pos = line; ncols < HB_MAX_COLUMNS; pos = end + 1)
+	{
+		values[ ncols ] = strtod( pos, &end );
+		if (end == pos) break;
+
+		ncols++;
+		if (*end != ',') break;
+	}
+
+	return ncols;
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	GError *err_main = NULL;
+	FILE *ref = NULL, *other = NULL;
+
+	ColumnError_t errors[ HB_MAX_COLUMNS ];
+	double ref_values[ HB_MAX_COLUMNS ], values[ HB_MAX_COLUMNS ];
+	double eps = ACCURACY_EPS;
+	guint32 ncols = 0, n;
+	long records = 0;
+	int status = 0;
+	int c;
+
+
+	while ((c = getopt( argc, argv, "e:" )) != -1)
+	{
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			c != 'e', HB_INVALID_PARAMETER, error_handler,
+			"Usage: %s [-e EPS] REFERENCE.csv OTHER.csv", argv[ 0 ] );
+
+		eps = atof( optarg );
+	}
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		argc - optind != 2, HB_INVALID_PARAMETER, error_handler,
+		"Usage: %s [-e EPS] REFERENCE.csv OTHER.csv", argv[ 0 ] );
+
+	ref = fopen( argv[ optind ], "r" );
+	other = fopen( argv[ optind + 1 ], "r" );
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(ref == NULL) || (other == NULL), HB_UNABLE_OPEN_FILE,
+		error_handler, "Could not open input files." );
+
+
+	/** Accumulate errors, record by record. */
+
+	while ((n = read_record( ref, ref_values )) > 0)
+	{
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			read_record( other, values ) != n, HB_INVALID_PARAMETER,
+			error_handler, "Results differ in records or columns." );
+
+		if (records == 0)
+		{
+			ncols = n;
+			for (guint32 col = 0; col < ncols; col++)
+				errors[ col ] = (ColumnError_t) { 0, 0, 0, -1 };
+		}
+
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			n != ncols, HB_INVALID_PARAMETER, error_handler,
+			"Records have different numbers of columns." );
+
+		for (guint32 col = 0; col < ncols; col++)
+		{
+			ColumnError_t *const e = &errors[ col ];
+			const double abs_err = fabs( values[ col ] - ref_values[ col ] );
+
+			if (abs_err > e->max_abs) e->max_abs = abs_err;
+
+			if ((ref_values[ col ] != 0)
+				&& (abs_err / fabs( ref_values[ col ] ) > e->max_rel))
+				e->max_rel = abs_err / fabs( ref_values[ col ] );
+
+			e->sum_sq += abs_err * abs_err;
+
+			if ((e->first_over < 0) && (abs_err > eps))
+				e->first_over = records;
+		}
+
+		records++;
+	}
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		records == 0, HB_INVALID_PARAMETER, error_handler,
+		"Reference results are empty." );
+
+
+	/** Report. */
+
+	printf( "%s vs %s: %ld records, eps %g\n",
+				argv[ optind + 1 ], argv[ optind ], records, eps );
+	printf( "column      max abs      max rel          rms   first over\n" );
+
+	for (guint32 col = 0; col < ncols; col++)
+		printf( "%6u %12.6g %12.6g %12.6g %12ld\n", col,
+			errors[ col ].max_abs, errors[ col ].max_rel,
+			sqrt( errors[ col ].sum_sq / records ),
+			errors[ col ].first_over );
+
+
+	goto clean_all;
+
+
+error_handler:
+
+	/* Handle error. */
+	fprintf( stderr, "Error: %s\n\n", err_main->message );
+	g_error_free( err_main );
+	status = 1;
+
+
+clean_all:
+
+	if (ref) fclose( ref );
+	if (other) fclose( other );
+
+
+	return status;
+}
@@ -0,0 +1,387 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Kernel micro-benchmarks. Times the hot paths of heatbugs.c one by one,
+ * over a range of world sizes and bug densities, and writes the results as
+ * JSON, to be kept and compared between releases:
+ *
+ *	hb_bench [-t MIN_MS] [-o FILE]
+ *
+ * -t	Minimum time spent on each measurement, in ms (default 200).
+ * -o	Output file (default stdout).
+ *
+ * Every measurement repeats the kernel, doubling the repetitions, until it
+ * takes at least MIN_MS. Achieved GB/s counts the bytes each kernel has to
+ * touch per cell or per bug (see the *_BYTES below), not cache traffic.
+ * */
+
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>	/* getopt(...) */
+#include <string.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+
+
+
+/** Benchmark defaults. */
+#define MIN_TIME_MS		200
+#define WARMUP_STEPS		10
+#define BENCH_SEED		"1"
+
+/** World sides and bug densities benchmarked. */
+static const size_t world_sides[] = { 64, 256, 1000, 1024, 2048 };
+static const double bug_densities[] = { 0.01, 0.05, 0.25 };
+
+#define NUM_SIDES	(sizeof( world_sides ) / sizeof( world_sides[ 0 ] ))
+#define NUM_DENSITIES	(sizeof( bug_densities ) / sizeof( bug_densities[ 0 ] ))
+
+
+/** Bytes each kernel must read or write, per cell or per bug. */
+
+/* The heat map read once and the buffer written once. */
+#define DIFFUSION_BYTES		(2 * sizeof( hb_heat_t ))
+/* Its 8 neighbours occupation: a cell each, or 3 words of the bitmap. */
+#ifdef HB_SWARM_BITMAP
+	#define OCCUPATION_BYTES	(3 * sizeof( hb_map_t ))
+#else
+	#define OCCUPATION_BYTES	(NUM_NEIGHBOURS * sizeof( hb_map_t ))
+#endif
+/* The bug, its 9 cells temperatures and its 8 neighbours occupation. */
+#define NEIGHBOUR_BYTES		(HB_BUG_SIZE + 9 * sizeof( hb_heat_t ) \
+					+ OCCUPATION_BYTES)
+/* As above, plus the shuffled id (read, written and read again), the    */
+/* unhappiness, the heat left and the two occupation updates.             */
+#define BUG_STEP_BYTES		(NEIGHBOUR_BYTES + 3 * sizeof( size_t ) \
+					+ sizeof( float ) + sizeof( hb_heat_t ) \
+					+ 2 * sizeof( hb_map_t ))
+
+
+/** The kernels timed. */
+enum {
+	KERNEL_V1 = 0,
+	KERNEL_V2,
+	KERNEL_V3,
+	KERNEL_NEIGHBOUR,
+	KERNEL_BUG_STEP,
+	KERNELS
+};
+
+/* v1 and v2 need float heat cells (see hb_heat_t). */
+#ifdef HB_HEAT_16
+	#define FIRST_DIFFUSION_KERNEL	KERNEL_V3
+#else
+	#define FIRST_DIFFUSION_KERNEL	KERNEL_V1
+#endif
+
+static const char *const kernel_names[ KERNELS ] = {
+	"comp_world_heat_v1", "comp_world_heat_v2", "comp_world_heat_v3",
+	"best_free_neighbour", "bug_step"
+};
+
+
+/** One world under test. */
+typedef struct bench {
+	Parameters_t params;
+	HBBuffers_t buff;
+	size_t iteration;	/* Iteration number given to bug_step(...). */
+} Bench_t;
+
+
+/* Keeps the compiler from dropping best_free_neighbour(...) calls. */
+static volatile size_t sink;
+
+
+
+/**
+ * Set up a world of 'side' x 'side' cells and 'bugs' bugs, with the
+ * simulation's default parameters, and let it run a few steps so the heat
+ * map is no longer empty.
+ * */
+static void bench_setup( Bench_t *const b, const size_t side, const size_t bugs,
+							GError **err )
+{
+	GError *err_setup = NULL;
+	char side_str[ 32 ], bugs_str[ 32 ];
+
+	char *argv[] = { "hb_bench", "-w", side_str, "-W", side_str,
+			"-n", bugs_str, "-s", BENCH_SEED, "-f", "/dev/null", NULL };
+
+
+	snprintf( side_str, sizeof( side_str ), "%zu", side );
+	snprintf( bugs_str, sizeof( bugs_str ), "%zu", bugs );
+
+	/* getopt(...) has already been used, start it over. */
+	optind = 1;
+
+	getSimulParameters( &b->params, sizeof( argv ) / sizeof( argv[ 0 ] ) - 1,
+							argv, &err_setup );
+	hb_if_err_propagate_goto( err, err_setup, error_handler );
+
+	setupBuffers( &b->buff, &b->params, &err_setup );
+	hb_if_err_propagate_goto( err, err_setup, error_handler );
+
+	initiate( &b->buff, &b->params );
+
+	for (b->iteration = 0; b->iteration < WARMUP_STEPS; b->iteration++)
+	{
+		comp_world_heat( &b->buff, &b->params, NULL );
+
+		shuffle_bugs( b->buff.ids, &b->params,
+			&b->buff.agent_states[ 0 ].rng, b->iteration );
+
+		bug_step( &b->buff.swarm, b->buff.swarm_map,
+			b->buff.world_heat[ MAP ], b->buff.unhappiness,
+			b->buff.ids, b->buff.agent_states, &b->params,
+			b->iteration );
+	}
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Run 'kernel' 'reps' times, return the time it took, in microseconds.
+ *
+ * Diffusion kernels always read the same heat map (the swap is undone),
+ * so repeated runs don't slowly evaporate it down to subnormal numbers.
+ * */
+static gint64 bench_run( Bench_t *const b, const int kernel, const size_t reps )
+{
+	const Parameters_t *const params = &b->params;
+	HBBuffers_t *const buff = &b->buff;
+	size_t acc = 0;
+	gint64 start;
+
+
+	start = g_get_monotonic_time();
+
+	switch (kernel)
+	{
+#ifndef HB_HEAT_16
+		case KERNEL_V1:
+			for (size_t r = 0; r < reps; r++)
+				comp_world_heat_v1( buff->world_heat[ MAP ],
+					buff->world_heat[ BUFFER ], params );
+			break;
+		case KERNEL_V2:
+			for (size_t r = 0; r < reps; r++)
+			{
+				comp_world_heat_v2( buff->world_heat, params );
+				SWAP( buff->world_heat[ BUFFER ], buff->world_heat[ MAP ] );
+			}
+			break;
+#endif
+		case KERNEL_V3:
+			for (size_t r = 0; r < reps; r++)
+			{
+				comp_world_heat_v3( buff->world_heat, params, NULL );
+				SWAP( buff->world_heat[ BUFFER ], buff->world_heat[ MAP ] );
+			}
+			break;
+		case KERNEL_NEIGHBOUR:
+			for (size_t r = 0; r < reps; r++)
+				for (size_t bug = 0; bug < params->bugs_number; bug++)
+				{
+					const Around_t at = locate(
+						buff->swarm.locus[ bug ], params );
+
+					acc += best_free_neighbour( FIND_MAX_TEMPERATURE,
+						buff->world_heat[ MAP ], buff->swarm_map,
+						params, &at, &buff->agent_states[ 0 ] );
+				}
+			break;
+		default:	/* KERNEL_BUG_STEP, with its shuffle. */
+			for (size_t r = 0; r < reps; r++, b->iteration++)
+			{
+				shuffle_bugs( buff->ids, params,
+					&buff->agent_states[ 0 ].rng, b->iteration );
+
+				bug_step( &buff->swarm, buff->swarm_map,
+					buff->world_heat[ MAP ], buff->unhappiness,
+					buff->ids, buff->agent_states, params,
+					b->iteration );
+			}
+	}
+
+	sink = acc;
+
+	return g_get_monotonic_time() - start;
+}
+
+
+
+/**
+ * Time 'kernel' on the world in 'b' and write its JSON record.
+ * */
+static void bench_kernel( Bench_t *const b, const int kernel,
+			const gint64 min_time_us, FILE *out, const gboolean first )
+{
+	const gboolean per_cell = (kernel <= KERNEL_V3);
+
+	const size_t items = per_cell ? b->params.world_size : b->params.bugs_number;
+	const size_t bytes = (kernel == KERNEL_NEIGHBOUR) ? NEIGHBOUR_BYTES
+				: (kernel == KERNEL_BUG_STEP) ? BUG_STEP_BYTES
+				: DIFFUSION_BYTES;
+
+	size_t reps = 1;
+	gint64 elapsed;
+	double ns_item;
+
+
+	/* Double the repetitions until the run is long enough to trust. */
+	while ((elapsed = bench_run( b, kernel, reps )) < min_time_us)
+		reps *= 2;
+
+	ns_item = elapsed * 1000.0 / ((double) reps * items);
+
+	fprintf( out, "%s\n\t\t{ \"kernel\": \"%s\", \"width\": %zu, \"height\": %zu, "
+		"\"bugs\": %zu, \"reps\": %zu, \"seconds\": %.6f, ",
+		first ? "" : ",", kernel_names[ kernel ],
+		b->params.world_width, b->params.world_height,
+		b->params.bugs_number, reps, elapsed / 1e6 );
+
+	if (per_cell)
+		fprintf( out, "\"ns_per_cell\": %.4f, \"ns_per_bug\": null, ", ns_item );
+	else
+		fprintf( out, "\"ns_per_cell\": null, \"ns_per_bug\": %.4f, ", ns_item );
+
+	fprintf( out, "\"bytes_per_item\": %zu, \"gb_per_s\": %.4f }",
+		bytes, bytes / ns_item );
+
+	fflush( out );
+
+	return;
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	GError *err_main = NULL;
+	FILE *out = stdout;
+	Bench_t bench;
+
+	gint64 min_time_us = MIN_TIME_MS * 1000;
+	gboolean first = TRUE;
+	int status = 0;
+	int c;
+
+
+	memset( &bench, 0, sizeof( bench ) );
+
+	while ((c = getopt( argc, argv, "t:o:" )) != -1)
+	{
+		switch (c)
+		{
+			case 't':
+				min_time_us = (gint64) atoi( optarg ) * 1000;
+				break;
+			case 'o':
+				if (out != stdout) fclose( out );
+				out = fopen( optarg, "w" );
+				hb_if_err_create_goto( err_main, HB_ERROR,
+					out == NULL, HB_UNABLE_OPEN_FILE,
+					error_handler,
+					"Could not open output file." );
+				break;
+			default:
+				hb_if_err_create_goto( err_main, HB_ERROR,
+					TRUE, HB_INVALID_PARAMETER,
+					error_handler,
+					"Usage: %s [-t MIN_MS] [-o FILE]", argv[ 0 ] );
+		}
+	}
+
+
+	fprintf( out, "{\n\t\"version\": \"%s\",\n", version );
+#if defined( __AVX__ )
+	fprintf( out, "\t\"simd\": \"avx\",\n" );
+#elif defined( __SSE2__ )
+	fprintf( out, "\t\"simd\": \"sse2\",\n" );
+#else
+	fprintf( out, "\t\"simd\": \"none\",\n" );
+#endif
+	fprintf( out, "\t\"min_time_ms\": %d,\n\t\"results\": [",
+						(int) (min_time_us / 1000) );
+
+
+	for (size_t s = 0; s < NUM_SIDES; s++)
+	{
+		for (size_t d = 0; d < NUM_DENSITIES; d++)
+		{
+			const size_t cells = world_sides[ s ] * world_sides[ s ];
+			const size_t bugs = MAX( (size_t) (cells * bug_densities[ d ]), 1 );
+
+
+			bench_setup( &bench, world_sides[ s ], bugs, &err_main );
+			hb_if_err_goto( err_main, error_handler );
+
+			/* Diffusion doesn't depend on bugs, once per world size. */
+			if (d == 0)
+			{
+				for (int k = FIRST_DIFFUSION_KERNEL; k <= KERNEL_V3; k++)
+				{
+					bench_kernel( &bench, k, min_time_us, out, first );
+					first = FALSE;
+				}
+			}
+
+			bench_kernel( &bench, KERNEL_NEIGHBOUR, min_time_us, out, first );
+			bench_kernel( &bench, KERNEL_BUG_STEP, min_time_us, out, first );
+
+			freeBuffers( &bench.buff );
+			memset( &bench.buff, 0, sizeof( bench.buff ) );
+		}
+	}
+
+	fprintf( out, "\n\t]\n}\n" );
+
+
+	goto clean_all;
+
+
+error_handler:
+
+	/* Handle error. */
+	fprintf( stderr, "Error: %s\n\n", err_main->message );
+	g_error_free( err_main );
+	status = 1;
+
+
+clean_all:
+
+	freeBuffers( &bench.buff );
+
+	if (out && out != stdout) fclose( out );
+
+
+	return status;
+}
@@ -0,0 +1,316 @@
+#!/bin/sh
+#
+# This file is part of heatbugs_CPU.
+#
+# heatbugs_CPU is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# heatbugs_CPU is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+#
+# Regression checks, run by 'make check':
+#
+#	hb_check.sh BUILDDIR
+#
+# Each check runs the simulation in BUILDDIR two ways that must give the
+# same results, bit for bit (or, where said, within float rounding), and
+# compares the results files. Exits 1 if any check fails. The MPI check
+# runs when BUILDDIR has heatbugs_mpi, launched with $MPIRUN (default
+# "mpirun -np 4").
+#
+
+
+BIN=${1:-../bin}
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/hb_check.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+FAILED=0
+
+
+# Run the simulation with the options given, results to file $1. The
+# program doesn't tell errors by its exit status: the file must be there.
+run()
+{
+	out=$1
+	shift
+	rm -f "$out"
+	"$BIN/heatbugs" "$@" -f "$out" > "$WORK/stdout" 2>&1
+	[ -s "$out" ] || { sed 's/^/	/' "$WORK/stdout"; return 1; }
+}
+
+pass()
+{
+	echo "PASS  $1"
+}
+
+fail()
+{
+	echo "FAIL  $1"
+	FAILED=$((FAILED + 1))
+}
+
+# Check $1: files $2 and $3 are the same, and not empty.
+same()
+{
+	if [ -s "$2" ] && cmp -s "$2" "$3"; then pass "$1"; else fail "$1"; fi
+}
+
+# Check $1: files $2 and $3 have as many lines, and their values differ
+# by at most $4 relative to $2's.
+close()
+{
+	if [ -s "$2" ] && [ "$(wc -l < "$2")" -eq "$(wc -l < "$3")" ] \
+		&& paste -d ' ' "$2" "$3" | awk -v tol="$4" '
+			{ d = $1 - $2; if (d < 0) d = -d;
+			  r = ($1 < 0) ? -$1 : $1;
+			  if (d > tol * r) bad = 1 }
+			END { exit bad }'; then
+		pass "$1"
+	else
+		fail "$1"
+	fi
+}
+
+
+# A small odd-sized world, so kernels go through their edges and tails.
+WORLD="-s 11 -w 97 -W 61 -n 800 -i 200"
+
+
+# Diffusion engines: the fused kernel and the row bands give v2's results.
+run "$WORK/v2.csv" $WORLD --diffusion v2
+
+for opts in "--diffusion fused" "--diffusion fused --threads 4" \
+		"--diffusion v2 --threads 4"; do
+	run "$WORK/engine.csv" $WORLD $opts
+	same "$opts is v2" "$WORK/v2.csv" "$WORK/engine.csv"
+done
+
+# Box-sum adds in another order: within float rounding of v2, and the
+# same on any number of threads.
+run "$WORK/boxsum.csv" $WORLD --diffusion boxsum
+close "--diffusion boxsum is close to v2" "$WORK/v2.csv" "$WORK/boxsum.csv" 1e-5
+
+run "$WORK/engine.csv" $WORLD --diffusion boxsum --threads 4
+same "--diffusion boxsum --threads 4 is boxsum" "$WORK/boxsum.csv" \
+							"$WORK/engine.csv"
+
+
+# Checkerboard agents: tiles, not threads, set the results.
+run "$WORK/board.csv" $WORLD --agents checkerboard
+
+# The tile size only binds the checkerboard engine: a world of fewer
+# cells than a tile still runs on the others.
+if run "$WORK/tiny.csv" -s 11 -w 3 -W 4 -n 5 -i 10; then
+	pass "a world smaller than a tile runs"
+else
+	fail "a world smaller than a tile runs"
+fi
+
+for threads in 2 4; do
+	run "$WORK/engine.csv" $WORLD --agents checkerboard --threads $threads
+	same "--agents checkerboard --threads $threads is 1 thread" \
+				"$WORK/board.csv" "$WORK/engine.csv"
+done
+
+
+# Kernel micro-benchmarks: a quick pass (1 ms a measurement) times every
+# kernel and writes whole JSON, with no NaN or infinite figures.
+if "$BIN/hb_bench" -t 1 -o "$WORK/bench.json" > "$WORK/stdout" 2>&1 \
+	&& [ "$(tail -n 1 "$WORK/bench.json")" = "}" ] \
+	&& ! grep -qi 'nan\|inf' "$WORK/bench.json"; then
+	for kernel in comp_world_heat_v1 comp_world_heat_v2 comp_world_heat_v3 \
+			best_free_neighbour bug_step; do
+		if grep -q "\"kernel\": \"$kernel\"" "$WORK/bench.json"; then
+			pass "hb_bench times $kernel"
+		else
+			fail "hb_bench times $kernel"
+		fi
+	done
+else
+	fail "hb_bench runs"
+fi
+
+
+# Binary results: hb2csv gives back the CSV, value for value, with every
+# statistic and with aggregates.
+for opts in "" "--columns unhappiness,min,max,variance,heat,histogram" \
+		"--output-every 10 --aggregate mean,min,max"; do
+	run "$WORK/text.csv" $WORLD $opts
+	run "$WORK/binary.hbr" $WORLD $opts --format binary
+	rm -f "$WORK/binary.csv"
+	"$BIN/hb2csv" "$WORK/binary.hbr" "$WORK/binary.csv" > "$WORK/stdout" 2>&1
+	same "hb2csv of --format binary${opts:+ $opts} is the CSV" "$WORK/text.csv" \
+							"$WORK/binary.csv"
+done
+
+
+# Asynchronous output: the writer thread gives the same file, CSV or
+# binary, also once its ring of 4096 records has wrapped around.
+for world in "$WORLD" "-s 11 -w 40 -W 30 -n 100 -i 9000"; do
+	for format in csv binary; do
+		run "$WORK/sync.out" $world --format $format
+		run "$WORK/async.out" $world --format $format --async-output
+		same "--async-output --format $format is the same ($world)" \
+					"$WORK/sync.out" "$WORK/async.out"
+	done
+done
+
+
+# Checkpoints: a run stopped at 300 iterations and restarted to 400 gives
+# the uninterrupted run's results, even on another number of threads.
+restart()
+{
+	name=$1
+	threads=$2
+	shift 2
+	run "$WORK/full.csv" $WORLD -i 400 --rng philox "$@"
+	run "$WORK/ckpt.csv" $WORLD -i 300 --rng philox "$@" \
+		--checkpoint-every 100 --checkpoint-file "$WORK/ckpt.hbc"
+	"$BIN/heatbugs" --restart "$WORK/ckpt.hbc" -i 400 --threads $threads \
+		--checkpoint-file "$WORK/restart.hbc" > "$WORK/stdout" 2>&1
+	same "$name" "$WORK/full.csv" "$WORK/ckpt.csv"
+}
+
+restart "restart of a serial run, morton order" 1 --order morton
+restart "restart of a checkerboard run, on 2 threads of 4" 2 \
+					--agents checkerboard --threads 4
+
+
+# Snapshots: hbs2csv decodes the frames of every 25 iterations up to 400
+# with all the bugs, and the world heat the results have for their
+# iteration (within float rounding), in a run and in one continued by a
+# restart. The world of one frame, found through the index, sums to the
+# same heat.
+frames()
+{
+	rm -f "$WORK/frames.csv"
+	"$BIN/hbs2csv" "$2" "$WORK/frames.csv" > "$WORK/stdout" 2>&1
+	if awk -F, -v bugs=800 -v want=17 '
+			NR == FNR { if ($2 != bugs) bad = 1;
+				    heat[ $1 + 1 ] = $3; frames++; next }
+			FNR in heat { d = $2 - heat[ FNR ]; if (d < 0) d = -d;
+				      if (d > 1e-5 * $2) bad = 1; found++ }
+			END { exit bad || (frames != want) || (found != frames) }' \
+			"$WORK/frames.csv" "$3"; then
+		pass "$1"
+	else
+		fail "$1"
+	fi
+}
+
+SNAPS="--columns unhappiness,heat --snapshot-every 25"
+
+rm -f "$WORK/frames.hbs"
+run "$WORK/snap.csv" $WORLD -i 400 $SNAPS --snapshot-file "$WORK/frames.hbs"
+frames "hbs2csv frames are the results" "$WORK/frames.hbs" "$WORK/snap.csv"
+
+rm -f "$WORK/ckpt.hbs"
+run "$WORK/ckpt.csv" $WORLD -i 300 --rng philox $SNAPS \
+	--snapshot-file "$WORK/ckpt.hbs" --checkpoint-every 100 \
+	--checkpoint-file "$WORK/ckpt.hbc"
+"$BIN/heatbugs" --restart "$WORK/ckpt.hbc" -i 400 $SNAPS \
+	--snapshot-file "$WORK/ckpt.hbs" --checkpoint-file "$WORK/restart.hbc" \
+						> "$WORK/stdout" 2>&1
+frames "hbs2csv frames of a restart are the results" "$WORK/ckpt.hbs" \
+							"$WORK/ckpt.csv"
+
+"$BIN/hbs2csv" -w 375 "$WORK/ckpt.hbs" 2> "$WORK/stdout" \
+	| awk -F, '{ heat += $3 } END { printf "%.5g\n", heat }' > "$WORK/world"
+awk -F, 'NR == 376 { printf "%.5g\n", $2 }' "$WORK/ckpt.csv" > "$WORK/record"
+same "hbs2csv -w of a restart's frame is the results" "$WORK/record" \
+							"$WORK/world"
+
+
+# Ensembles: each member, run on the pool with the others, gives the
+# results of a simulation of its own with its seed.
+SMALL="-w 97 -W 61 -n 800 -i 100"
+"$BIN/heatbugs" $SMALL --seeds 5,9,2 --threads 2 -f "$WORK/member.csv" \
+						> "$WORK/stdout" 2>&1
+
+for seed in 5 9 2; do
+	run "$WORK/single.csv" $SMALL -s $seed
+	same "ensemble member of seed $seed is its own run" \
+				"$WORK/single.csv" "$WORK/member-$seed.csv"
+done
+
+
+# Sparse diffusion: '--sparse 0' skips only tiles all zero, so it gives
+# the fused kernel's results, world heat included, in a busy world and
+# in a mostly cold one.
+COLD="-s 11 -w 300 -W 200 -n 20 -i 200"
+
+for world in "$WORLD" "$COLD"; do
+	run "$WORK/dense.csv" $world --columns unhappiness,heat
+	for threads in 1 3; do
+		run "$WORK/sparse.csv" $world --columns unhappiness,heat \
+					--sparse 0 --threads $threads
+		same "--sparse 0 --threads $threads is dense ($world)" \
+				"$WORK/dense.csv" "$WORK/sparse.csv"
+	done
+done
+
+
+# Convergence stop: a run restarted from a checkpoint past its first
+# full windows stops where the uninterrupted run does.
+CONVERGE="-s 9 -n 200 --rng philox --converge 100 --converge-tol 0.02"
+
+run "$WORK/full.csv" $CONVERGE -i 3000
+run "$WORK/ckpt.csv" $CONVERGE -i 500 --checkpoint-every 250 \
+				--checkpoint-file "$WORK/ckpt.hbc"
+"$BIN/heatbugs" --restart "$WORK/ckpt.hbc" -i 3000 \
+	--checkpoint-file "$WORK/restart.hbc" > "$WORK/stdout" 2>&1
+
+if [ "$(wc -l < "$WORK/full.csv")" -lt 3001 ]; then
+	same "restart stops where the run converges" "$WORK/full.csv" \
+							"$WORK/ckpt.csv"
+else
+	fail "run converges before its last iteration"
+fi
+
+
+# Sweeps: run again, a sweep with no seeds, and no -s, finds its jobs
+# done (they keep the seed drawn the first time).
+printf 'w = 40, 50\ni = 20\n' > "$WORK/sweep"
+
+for again in 1 2; do
+	"$BIN/heatbugs" --sweep "$WORK/sweep" -f "$WORK/job.csv" \
+						> "$WORK/stdout" 2>&1
+done
+
+if grep -q "0 to run" "$WORK/stdout"; then
+	pass "sweep run again has no jobs to run"
+else
+	fail "sweep run again has no jobs to run"
+fi
+
+
+# MPI ('make mpi' first, else skipped): 4 ranks, 2 x 2 tiles each, move
+# bugs as the checkerboard engine on the same 4 x 4 tiles.
+if [ -x "$BIN/heatbugs_mpi" ]; then
+	run "$WORK/board.csv" -s 7 -i 300 --agents checkerboard --tile-size 25
+	rm -f "$WORK/mpi.csv"
+	${MPIRUN:-mpirun -np 4} "$BIN/heatbugs_mpi" -s 7 -i 300 \
+				-f "$WORK/mpi.csv" > "$WORK/stdout" 2>&1
+	same "MPI on 4 ranks is the checkerboard engine" "$WORK/board.csv" \
+							"$WORK/mpi.csv"
+else
+	echo "SKIP  MPI, no $BIN/heatbugs_mpi"
+fi
+
+
+if [ $FAILED -gt 0 ]; then
+	echo "$FAILED checks failed."
+	exit 1
+fi
+
+echo "All checks passed."
@@ -0,0 +1,459 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+#define _GNU_SOURCE	/* fileno(...) and fsync(...) are POSIX, not c99.     */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>	/* crc32(...)	*/
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_output.h"
+#include "hb_checkpoint.h"
+
+
+
+/** Name of the file a checkpoint is written to, before being renamed. */
+#define TMP_SUFFIX	".tmp"
+
+
+/** A buffer of the state, as saved, in file order. */
+typedef struct hb_ckpt_block {
+	void *data;
+	size_t size;
+} HBCkptBlock_t;
+
+/** Number of state buffers, at most. */
+#define STATE_BLOCKS	13
+
+
+
+/**
+ * The state buffers, in file order. Returns how many.
+ * */
+static int state_blocks( const HBBuffers_t *const buff,
+		const Parameters_t *const params, HBCkptBlock_t blocks[ STATE_BLOCKS ] )
+{
+	int n;
+
+
+	blocks[ 0 ].data = buff->swarm.locus;
+	blocks[ 0 ].size = params->bugs_number * sizeof( hb_locus_t );
+	blocks[ 1 ].data = buff->swarm.ideal_temperature;
+	blocks[ 1 ].size = params->bugs_number * sizeof( guint8 );
+	blocks[ 2 ].data = buff->swarm.output_heat;
+	blocks[ 2 ].size = params->bugs_number * sizeof( guint8 );
+	blocks[ 3 ].data = buff->swarm_map;
+	blocks[ 3 ].size = HB_MAP_BYTES( params->world_size );
+	blocks[ 4 ].data = buff->world_heat[ MAP ];
+	blocks[ 4 ].size = params->heat_size * sizeof( hb_heat_t );
+	blocks[ 5 ].data = buff->world_heat[ BUFFER ];
+	blocks[ 5 ].size = params->heat_size * sizeof( hb_heat_t );
+	blocks[ 6 ].data = buff->unhappiness;
+	blocks[ 6 ].size = params->bugs_number * sizeof( float );
+	blocks[ 7 ].data = buff->ids;
+	blocks[ 7 ].size = params->bugs_number * sizeof( size_t );
+	n = 8;
+
+	/* 'morton' order: the bugs as last sorted. */
+	if (buff->order)
+	{
+		blocks[ n ].data = buff->order->sorted;
+		blocks[ n++ ].size = params->bugs_number * sizeof( OrderKey_t );
+	}
+
+	/* Convergence stop: its running sums, and the averages they hold. */
+	if (buff->converge)
+	{
+		blocks[ n ].data = &buff->converge->count;
+		blocks[ n++ ].size = sizeof( buff->converge->count );
+		blocks[ n ].data = buff->converge->sum;
+		blocks[ n++ ].size = sizeof( buff->converge->sum );
+		blocks[ n ].data = buff->converge->sum_sq;
+		blocks[ n++ ].size = sizeof( buff->converge->sum_sq );
+		blocks[ n ].data = buff->converge->averages;
+		blocks[ n++ ].size = 2 * buff->converge->window * sizeof( double );
+	}
+
+	return n;
+}
+
+
+
+/** Read 'size' bytes and add them to the running 'crc'. */
+static gboolean read_block( FILE *file, void *const data, const size_t size,
+							uLong *const crc )
+{
+	if (fread( data, size, 1, file ) != 1) return FALSE;
+
+	*crc = crc32( *crc, (const Bytef *) data, size );
+
+	return TRUE;
+}
+
+
+
+/** Write 'size' bytes and add them to the running 'crc'. */
+static gboolean write_block( FILE *file, const void *const data,
+					const size_t size, uLong *const crc )
+{
+	if (fwrite( data, size, 1, file ) != 1) return FALSE;
+
+	*crc = crc32( *crc, (const Bytef *) data, size );
+
+	return TRUE;
+}
+
+
+
+/**
+ * Open 'filename' and read and check its header. The file is left at the
+ * saved parameters.
+ * */
+static FILE *checkpoint_open( const char *const filename,
+			HBCheckpointHeader_t *const header, GError **err )
+{
+	FILE *file = NULL;
+
+
+	file = fopen( filename, "rb" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		file == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open checkpoint file '%s'.", filename );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(fread( header, sizeof( HBCheckpointHeader_t ), 1, file ) != 1)
+		|| memcmp( header->magic, HB_CHECKPOINT_MAGIC, sizeof( header->magic ) )
+		|| (header->version != HB_CHECKPOINT_VERSION)
+		|| (header->endian != HB_RESULT_ENDIAN)
+		|| (header->params_size != sizeof( Parameters_t ))
+		|| (header->bug_size != HB_BUG_SIZE)
+		|| (header->map_format != HB_MAP_FORMAT)
+		|| (header->heat_format != HB_HEAT_FORMAT),
+		HB_CHECKPOINT_INVALID, error_handler,
+		"'%s' is not a checkpoint of this heatbugs build.", filename );
+
+	return file;
+
+
+error_handler:
+
+	if (file) fclose( file );
+
+	return NULL;
+}
+
+
+
+/**
+ * Take the simulation parameters from the checkpoint 'params->restart_filename'.
+ * Only how the simulation is run (threads, profile, asynchronous output,
+ * snapshots and checkpoints) is kept from the command line, and the
+ * iterations if 'iterations_set' ('-i'): 0 (non stop) or past the
+ * checkpoint's.
+ *
+ * @param[in,out]	params		- Command line parameters, in; the
+ *					  parameters to restart with, out.
+ * @param[in]		iterations_set	- '-i' is on the command line.
+ * @param[out]		err		- GLib object for error reporting.
+ * */
+void hb_checkpoint_params( Parameters_t *const params,
+			const gboolean iterations_set, GError **err )
+{
+	GError *err_params = NULL;
+	HBCheckpointHeader_t header;
+	Parameters_t saved;
+	FILE *file;
+
+
+	file = checkpoint_open( params->restart_filename, &header, &err_params );
+	hb_if_err_propagate_goto( err, err_params, error_handler );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		fread( &saved, sizeof( Parameters_t ), 1, file ) != 1,
+		HB_CHECKPOINT_INVALID, error_handler,
+		"Checkpoint file '%s' is truncated.", params->restart_filename );
+
+	fclose( file );
+	file = NULL;
+
+	if (iterations_set)
+	{
+		hb_if_err_create_goto( *err, HB_ERROR,
+			(params->numIterations != 0)
+			&& (params->numIterations <= header.iteration),
+			HB_CHECKPOINT_INVALID, error_handler,
+			"Iterations (-i) must be 0 or more than the checkpoint's "
+			"%" G_GUINT64_FORMAT ".", header.iteration );
+
+		saved.numIterations = params->numIterations;
+	}
+
+
+	/* Pointers saved are of the process that saved them. */
+	saved.seeds = NULL;
+
+	/* Run options, from the command line. */
+	saved.threads = params->threads;
+	saved.profile = params->profile;
+	saved.async_output = params->async_output;
+	saved.snapshot_every = params->snapshot_every;
+	strcpy( saved.snapshot_filename, params->snapshot_filename );
+	saved.checkpoint_every = params->checkpoint_every;
+	strcpy( saved.checkpoint_filename, params->checkpoint_filename );
+	strcpy( saved.restart_filename, params->restart_filename );
+
+	*params = saved;
+
+
+error_handler:
+
+	if (file) fclose( file );
+
+	return;
+}
+
+
+
+/**
+ * Restore the simulation state from the checkpoint 'params->restart_filename',
+ * into buffers set up for 'params' (see hb_checkpoint_params(...)). Takes
+ * the place of initiate(...).
+ *
+ * Agent states beyond the threads saved start as initiate(...) sets them;
+ * only the serial engine carries one (the first) from step to step.
+ *
+ * @param[out]	buff		- Buffers to restore.
+ * @param[in]	params		- Parameters to restart with.
+ * @param[out]	snaps_mark	- Snapshot frames written at the checkpoint.
+ * @param[out]	err		- GLib object for error reporting.
+ * @return			- Iterations done at the checkpoint.
+ * */
+size_t hb_checkpoint_load( HBBuffers_t *const buff,
+			const Parameters_t *const params,
+			HBSnapshotMark_t *const snaps_mark, GError **err )
+{
+	GError *err_load = NULL;
+	HBCheckpointHeader_t header;
+	HBCkptBlock_t blocks[ STATE_BLOCKS ];
+	HBCheckpointAgent_t agent;
+	Parameters_t saved;
+	uLong crc = crc32( 0L, Z_NULL, 0 );
+	guint32 crc_saved;
+	guint64 data_size;
+	gboolean ok;
+	FILE *file;
+	int nblocks;
+
+
+	file = checkpoint_open( params->restart_filename, &header, &err_load );
+	hb_if_err_propagate_goto( err, err_load, error_handler );
+
+	for (unsigned int t = 0; t < params->threads; t++)
+	{
+		hb_rng_init( &buff->agent_states[ t ].rng, params->rng,
+						params->seed, buff->grand );
+
+		for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+			buff->agent_states[ t ].neighbour_idx[ n ] = n;
+	}
+
+
+	nblocks = state_blocks( buff, params, blocks );
+
+	data_size = sizeof( Parameters_t )
+			+ header.threads * sizeof( HBCheckpointAgent_t );
+
+	for (int b = 0; b < nblocks; b++)
+		data_size += blocks[ b ].size;
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		header.data_size != data_size,
+		HB_CHECKPOINT_INVALID, error_handler,
+		"Checkpoint file '%s' doesn't match its parameters.",
+		params->restart_filename );
+
+	ok = read_block( file, &saved, sizeof( Parameters_t ), &crc );
+
+	for (int b = 0; ok && (b < nblocks); b++)
+		ok = read_block( file, blocks[ b ].data, blocks[ b ].size, &crc );
+
+	for (guint32 t = 0; ok && (t < header.threads); t++)
+	{
+		ok = read_block( file, &agent, sizeof( HBCheckpointAgent_t ), &crc );
+
+		if (!ok || (t >= params->threads)) continue;
+
+		buff->agent_states[ t ].rng.kind = agent.kind;
+		memcpy( buff->agent_states[ t ].rng.key, agent.key, sizeof( agent.key ) );
+		memcpy( buff->agent_states[ t ].rng.ctr, agent.ctr, sizeof( agent.ctr ) );
+		memcpy( buff->agent_states[ t ].rng.out, agent.out, sizeof( agent.out ) );
+		buff->agent_states[ t ].rng.used = agent.used;
+
+		for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+			buff->agent_states[ t ].neighbour_idx[ n ] = agent.neighbour_idx[ n ];
+	}
+
+	if (ok) ok = (fread( &crc_saved, sizeof( guint32 ), 1, file ) == 1);
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!ok || (crc_saved != (guint32) crc),
+		HB_CHECKPOINT_INVALID, error_handler,
+		"Checkpoint file '%s' is truncated or corrupt.",
+		params->restart_filename );
+
+	if (buff->order) spatial_order_blocks( buff->order, params );
+
+	snaps_mark->frames = header.snapshot_frames;
+	snaps_mark->offset = header.snapshot_offset;
+
+
+	fclose( file );
+
+	return header.iteration;
+
+
+error_handler:
+
+	if (file) fclose( file );
+
+	return 0;
+}
+
+
+
+/**
+ * Save the simulation state, after 'iteration' iterations, to
+ * 'params->checkpoint_filename'. The file is replaced only once the new
+ * checkpoint is complete and on disk.
+ *
+ * @param[in]	buff		- Buffers to save.
+ * @param[in]	params		- Simulation parameters.
+ * @param[in]	iteration	- Iterations done.
+ * @param[in]	snaps_mark	- Snapshot frames written, on disk (see
+ *				  hb_snapshots_sync(...)), NULL if none.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+void hb_checkpoint_save( const HBBuffers_t *const buff,
+			const Parameters_t *const params, const size_t iteration,
+			const HBSnapshotMark_t *const snaps_mark, GError **err )
+{
+	char tmp_filename[ sizeof( params->checkpoint_filename ) + sizeof( TMP_SUFFIX ) ];
+	HBCheckpointHeader_t header;
+	HBCkptBlock_t blocks[ STATE_BLOCKS ];
+	HBCheckpointAgent_t agent;
+	Parameters_t saved;
+	uLong crc = crc32( 0L, Z_NULL, 0 );
+	guint32 crc_saved;
+	gboolean ok;
+	FILE *file = NULL;
+	int nblocks;
+
+
+	/* Parameters as saved: no pointer, it would be of this process. */
+	memcpy( &saved, params, sizeof( Parameters_t ) );
+	saved.seeds = NULL;
+
+	strcpy( tmp_filename, params->checkpoint_filename );
+	strcat( tmp_filename, TMP_SUFFIX );
+
+	nblocks = state_blocks( buff, params, blocks );
+
+	memset( &header, 0, sizeof( HBCheckpointHeader_t ) );
+	memcpy( header.magic, HB_CHECKPOINT_MAGIC, sizeof( header.magic ) );
+	header.version = HB_CHECKPOINT_VERSION;
+	header.endian = HB_RESULT_ENDIAN;
+	header.params_size = sizeof( Parameters_t );
+	header.bug_size = HB_BUG_SIZE;
+	header.map_format = HB_MAP_FORMAT;
+	header.heat_format = HB_HEAT_FORMAT;
+	header.threads = params->threads;
+	header.iteration = iteration;
+
+	if (snaps_mark)
+	{
+		header.snapshot_frames = snaps_mark->frames;
+		header.snapshot_offset = snaps_mark->offset;
+	}
+
+	header.data_size = sizeof( Parameters_t )
+				+ params->threads * sizeof( HBCheckpointAgent_t );
+
+	for (int b = 0; b < nblocks; b++)
+		header.data_size += blocks[ b ].size;
+
+
+	file = fopen( tmp_filename, "wb" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		file == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open checkpoint file '%s'.", tmp_filename );
+
+	ok = (fwrite( &header, sizeof( HBCheckpointHeader_t ), 1, file ) == 1);
+
+	if (ok) ok = write_block( file, &saved, sizeof( Parameters_t ), &crc );
+
+	for (int b = 0; ok && (b < nblocks); b++)
+		ok = write_block( file, blocks[ b ].data, blocks[ b ].size, &crc );
+
+	for (unsigned int t = 0; ok && (t < params->threads); t++)
+	{
+		const AgentState_t *const state = &buff->agent_states[ t ];
+
+		memset( &agent, 0, sizeof( HBCheckpointAgent_t ) );
+		agent.kind = state->rng.kind;
+		memcpy( agent.key, state->rng.key, sizeof( agent.key ) );
+		memcpy( agent.ctr, state->rng.ctr, sizeof( agent.ctr ) );
+		memcpy( agent.out, state->rng.out, sizeof( agent.out ) );
+		agent.used = state->rng.used;
+
+		for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+			agent.neighbour_idx[ n ] = state->neighbour_idx[ n ];
+
+		ok = write_block( file, &agent, sizeof( HBCheckpointAgent_t ), &crc );
+	}
+
+	crc_saved = (guint32) crc;
+	if (ok) ok = (fwrite( &crc_saved, sizeof( guint32 ), 1, file ) == 1);
+
+	/* On disk before it takes the place of the previous checkpoint. */
+	if (ok) ok = (fflush( file ) == 0) && (fsync( fileno( file ) ) == 0);
+	ok = (fclose( file ) == 0) && ok;
+	file = NULL;
+
+	if (ok) ok = (rename( tmp_filename, params->checkpoint_filename ) == 0);
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!ok,
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write checkpoint file '%s'.", params->checkpoint_filename );
+
+	return;
+
+
+error_handler:
+
+	if (file) fclose( file );
+	remove( tmp_filename );
+
+	return;
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_CHECKPOINT_H_
+#define __HEATBUGS_CPU_CHECKPOINT_H_
+
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_snapshot.h"
+
+
+/**
+ * Checkpoint and restart ('--checkpoint-every K', '--restart FILE').
+ *
+ * Every K iterations the whole simulation state is saved: the parameters,
+ * swarm, swarm_map, both world_heat buffers, unhappiness, the bugs order
+ * (ids, and the bugs as last sorted by the 'morton' order), the averages
+ * of the convergence stop, the iteration count and every thread's
+ * generator and neighbour order. It goes to
+ * 'checkpoint_filename' plus ".tmp", is synced to disk and then renamed
+ * over 'checkpoint_filename', so there always is one complete checkpoint,
+ * the previous or the new one.
+ *
+ * A restart continues bit for bit as if never stopped. Its simulation is
+ * the checkpoint's: all parameters come from it, except those on how it is
+ * run (threads, profile, asynchronous output, snapshots and checkpoints),
+ * taken from the command line. So is '-i', if given, to run more (or
+ * fewer, but past the checkpoint) iterations than the checkpointed run.
+ * The results file is cut back to the checkpoint's iteration and
+ * continued, and so is the snapshot file, from the frames the checkpoint
+ * notes (see hb_snapshot.h).
+ *
+ * GLib's generator state can't be read back, so checkpoints require the
+ * Philox generator (see hb_rng.h), whose state is only its counters.
+ *
+ * Checkpoint file layout, all in the host byte order:
+ *
+ *	HBCheckpointHeader_t
+ *	Parameters_t
+ *	swarm (locus, ideal_temperature, output_heat), swarm_map,
+ *	world_heat[ MAP ], world_heat[ BUFFER ] (ghost border included),
+ *	unhappiness, ids,
+ *	'morton' order only: its sorted bugs
+ *	'--converge' only: averages seen, their sums and sums of squares,
+ *	the last averages (ring)
+ *	'threads' x HBCheckpointAgent_t
+ *	CRC-32 of all the above, but the header.
+ * */
+
+
+#define HB_CHECKPOINT_MAGIC	"HBCHECKP"
+#define HB_CHECKPOINT_VERSION	6
+
+
+typedef struct hb_checkpoint_header {
+	char magic[ 8 ];		/* HB_CHECKPOINT_MAGIC, not '\0' ended.	*/
+	guint32 version;		/* HB_CHECKPOINT_VERSION.		*/
+	guint32 endian;			/* HB_RESULT_ENDIAN, as written.	*/
+	guint32 params_size;		/* sizeof( Parameters_t ).		*/
+	guint32 bug_size;		/* HB_BUG_SIZE.				*/
+	guint32 threads;		/* Agent states saved.			*/
+	guint32 map_format;		/* HB_MAP_FORMAT.			*/
+	guint32 heat_format;		/* HB_HEAT_FORMAT.			*/
+	guint32 reserved;
+	guint64 iteration;		/* Iterations done.			*/
+	guint64 data_size;		/* Bytes after the header, but CRC.	*/
+	guint64 snapshot_frames;	/* Frames written, 0 = none.		*/
+	guint64 snapshot_offset;	/* Of the next frame.			*/
+} HBCheckpointHeader_t;
+
+
+/** One thread's agent state, as saved (no pointers). */
+typedef struct hb_checkpoint_agent {
+	gint32 kind;
+	guint32 key[ 2 ];
+	guint32 ctr[ 4 ];
+	guint32 out[ 4 ];
+	guint32 used;
+	guint32 neighbour_idx[ NUM_NEIGHBOURS ];
+} HBCheckpointAgent_t;
+
+
+void hb_checkpoint_params( Parameters_t *const params,
+			const gboolean iterations_set, GError **err );
+
+size_t hb_checkpoint_load( HBBuffers_t *const buff,
+			const Parameters_t *const params,
+			HBSnapshotMark_t *const snaps_mark, GError **err );
+
+void hb_checkpoint_save( const HBBuffers_t *const buff,
+			const Parameters_t *const params, const size_t iteration,
+			const HBSnapshotMark_t *const snaps_mark, GError **err );
+
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_pool.h"
+#include "hb_output.h"
+#include "hb_snapshot.h"
+#include "hb_ensemble.h"
+
+
+
+/** Where a member file name takes its seed. */
+#define SEED_MARK	"%u"
+
+
+/** An ensemble run, the context of its pool tasks. */
+typedef struct hb_ensemble {
+	const Parameters_t *members;	/* SIZE: MEMBERS - Each one's parameters. */
+	const size_t *order;	/* SIZE: COUNT	- Member of each run, or NULL. */
+	HBOutput_t *shared;	/* '--interleave' only: every member's output. */
+	GError **errors;	/* SIZE: MEMBERS	- Each member's error.	     */
+	hb_member_done_fn done;	/* Called as each member completes...	     */
+	void *done_ctx;
+	GMutex lock;		/* ...one at a time.			     */
+} HBEnsemble_t;
+
+
+
+/**
+ * Parse a comma separated list of seeds, into 'seeds' unless NULL.
+ *
+ * @param[in]	list		- The list, as given to '--seeds'.
+ * @param[out]	seeds		- Where to put them, or NULL to only count.
+ * @return			- Number of seeds, 0 if the list is invalid.
+ * */
+size_t hb_ensemble_seeds( const char *const list, guint32 *const seeds )
+{
+	const char *cursor = list;
+	char *end;
+	size_t count = 0;
+	unsigned long seed;
+
+
+	for (;;)
+	{
+		if (!isdigit( (unsigned char) *cursor )) return 0;
+
+		seed = strtoul( cursor, &end, 10 );
+		if (seed > G_MAXUINT32) return 0;
+
+		if (seeds) seeds[ count ] = (guint32) seed;
+		count++;
+
+		if (*end == '\0') break;
+		if (*end != ',') return 0;
+
+		cursor = end + 1;
+	}
+
+	return count;
+}
+
+
+
+/**
+ * Member file name: 'name' with 'id' (a seed, a job number) in place of
+ * SEED_MARK or, without one, before the extension. FALSE if it doesn't fit
+ * in 'size' chars.
+ * */
+gboolean hb_ensemble_filename( char *const dst, const size_t size,
+				const char *const name, const guint32 id )
+{
+	const char *mark = strstr( name, SEED_MARK );
+	const char *slash = strrchr( name, '/' );
+	const char *dot = strrchr( name, '.' );
+	int len;
+
+
+	if (mark)
+		len = snprintf( dst, size, "%.*s%u%s", (int) (mark - name), name,
+					id, mark + strlen( SEED_MARK ) );
+	else if (dot && (!slash || dot > slash + 1))
+		len = snprintf( dst, size, "%.*s-%u%s", (int) (dot - name), name,
+								id, dot );
+	else
+		len = snprintf( dst, size, "%s-%u", name, id );
+
+	return (len >= 0) && ((size_t) len < size);
+}
+
+
+
+/** Keep the first error in 'err', drop 'other'. */
+static void keep_first( GError **err, GError *other )
+{
+	if (!other) return;
+
+	if (*err)
+		g_error_free( other );
+	else
+		g_propagate_error( err, other );
+
+	return;
+}
+
+
+
+/**
+ * Pool task: run the simulation of one member, start to end.
+ * */
+static void member_run( void *ctx, size_t member, unsigned int thread )
+{
+	HBEnsemble_t *const ens = (HBEnsemble_t *) ctx;
+	GError **const err = &ens->errors[ member ];
+
+	const Parameters_t *const params =
+		&ens->members[ ens->order ? ens->order[ member ] : member ];
+
+	GError *err_member = NULL;
+	HBBuffers_t buff;
+	HBOutput_t *output = NULL;
+	HBSnapshots_t *snaps = NULL;
+
+	(void) thread;
+
+
+	memset( &buff, 0, sizeof( HBBuffers_t ) );
+
+	setupBuffers( &buff, params, &err_member );
+	hb_if_err_propagate_goto( err, err_member, error_handler );
+
+	if (ens->shared)
+		output = hb_output_member( ens->shared, member, &err_member );
+	else
+		output = hb_output_open( params, 0, &err_member );
+	hb_if_err_propagate_goto( err, err_member, error_handler );
+
+	if (params->snapshot_every > 0)
+	{
+		snaps = hb_snapshots_open( params, NULL, &err_member );
+		hb_if_err_propagate_goto( err, err_member, error_handler );
+	}
+
+
+	initiate( &buff, params );
+
+	simulate( &buff, params, NULL, NULL, output, snaps, 0, &err_member );
+	hb_if_err_propagate_goto( err, err_member, error_handler );
+
+
+error_handler:
+
+	/* Results simulated so far are kept, even after an error. */
+	hb_output_close( output, &err_member );
+	keep_first( err, err_member );
+	err_member = NULL;
+
+	hb_snapshots_close( snaps, &err_member );
+	keep_first( err, err_member );
+
+	freeBuffers( &buff );
+
+	if (*err)
+		g_prefix_error( err, "Seed %u: ", params->seed );
+	else if (ens->done)
+	{
+		g_mutex_lock( &ens->lock );
+		ens->done( ens->done_ctx, member );
+		g_mutex_unlock( &ens->lock );
+	}
+
+	return;
+}
+
+
+
+/**
+ * Run the simulations 'members', each with its parameters complete (seed,
+ * files, one thread), spread over the 'pool' threads (or one after the
+ * other, without a pool). Every member runs to the end, even if others
+ * fail; the first error is reported.
+ *
+ * @param[in]	members		- Parameters of each simulation.
+ * @param[in]	order		- Member run by each simulation, or NULL
+ *				  for 'members' in order.
+ * @param[in]	count		- Number of simulations.
+ * @param[in]	shared		- Output shared by all (with 'interleave'),
+ *				  or NULL for each its own file.
+ * @param[in]	pool		- Worker threads, or NULL.
+ * @param[in]	done		- Called, one at a time, as each simulation
+ *				  completes with no error, or NULL.
+ * @param[in]	done_ctx	- Passed to 'done'.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+void hb_ensemble_members( const Parameters_t *const members,
+		const size_t *const order, const size_t count,
+		HBOutput_t *const shared, HBPool_t *const pool,
+		hb_member_done_fn done, void *const done_ctx, GError **err )
+{
+	HBEnsemble_t ens;
+	size_t failed = 0;
+
+
+	memset( &ens, 0, sizeof( HBEnsemble_t ) );
+	ens.members = members;
+	ens.order = order;
+	ens.shared = shared;
+	ens.done = done;
+	ens.done_ctx = done_ctx;
+
+	ens.errors = (GError **) calloc( count, sizeof( GError * ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		ens.errors == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the ensemble." );
+
+	g_mutex_init( &ens.lock );
+
+	if (pool)
+		hb_pool_run( pool, member_run, &ens, count );
+	else
+		for (size_t m = 0; m < count; m++)
+			member_run( &ens, m, 0 );
+
+	g_mutex_clear( &ens.lock );
+
+
+	for (size_t m = 0; m < count; m++)
+		if (ens.errors[ m ] && (failed++ == 0))
+		{
+			g_propagate_error( err, ens.errors[ m ] );
+			ens.errors[ m ] = NULL;
+		}
+
+	if (failed > 1)
+		g_prefix_error( err, "%zu of %zu simulations failed. ",
+							failed, count );
+
+
+error_handler:
+
+	if (ens.errors)
+		for (size_t m = 0; m < count; m++)
+			if (ens.errors[ m ]) g_error_free( ens.errors[ m ] );
+
+	free( ens.errors );
+
+	return;
+}
+
+
+
+/**
+ * Run the ensemble of 'params' (see hb_ensemble.h).
+ *
+ * @param[in]	params		- Simulation parameters, with 'ensemble' > 0.
+ * @param[in]	pool		- Worker threads, or NULL.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+void hb_ensemble_run( const Parameters_t *const params, HBPool_t *const pool,
+								GError **err )
+{
+	GError *err_ensemble = NULL;
+	Parameters_t *members = NULL;
+	guint32 *seeds = NULL;
+	HBOutput_t *shared = NULL;
+
+
+	members = (Parameters_t *) malloc( params->ensemble * sizeof( Parameters_t ) );
+	seeds = (guint32 *) malloc( params->ensemble * sizeof( guint32 ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(members == NULL) || (seeds == NULL),
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the ensemble." );
+
+	if (params->seeds)
+		hb_ensemble_seeds( params->seeds, seeds );
+	else
+		for (size_t m = 0; m < params->ensemble; m++)
+			seeds[ m ] = params->seed + (guint32) m;
+
+	/* The ensemble's parameters, with the member's seed and files. */
+	for (size_t m = 0; m < params->ensemble; m++)
+	{
+		members[ m ] = *params;
+		members[ m ].seed = seeds[ m ];
+		members[ m ].threads = 1;
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			!hb_ensemble_filename( members[ m ].output_filename,
+				sizeof( members[ m ].output_filename ),
+				params->output_filename, seeds[ m ] )
+			|| !hb_ensemble_filename( members[ m ].snapshot_filename,
+				sizeof( members[ m ].snapshot_filename ),
+				params->snapshot_filename, seeds[ m ] ),
+			HB_ENSEMBLE_INVALID, error_handler,
+			"File name too long for the seed %u.", seeds[ m ] );
+	}
+
+	if (params->interleave)
+	{
+		shared = hb_output_open( params, 0, &err_ensemble );
+		hb_if_err_propagate_goto( err, err_ensemble, error_handler );
+	}
+
+
+	hb_ensemble_members( members, NULL, params->ensemble, shared, pool,
+						NULL, NULL, &err_ensemble );
+	hb_if_err_propagate_goto( err, err_ensemble, error_handler );
+
+	hb_output_close( shared, &err_ensemble );
+	shared = NULL;
+	hb_if_err_propagate_goto( err, err_ensemble, error_handler );
+
+
+error_handler:
+
+	/* Results simulated so far are kept, even after an error. */
+	if (shared)
+	{
+		hb_output_close( shared, &err_ensemble );
+		if (err_ensemble) g_error_free( err_ensemble );
+	}
+
+	free( seeds );
+	free( members );
+
+	return;
+}
@@ -0,0 +1,64 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_ENSEMBLE_H_
+#define __HEATBUGS_CPU_ENSEMBLE_H_
+
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_pool.h"
+
+
+/**
+ * Ensembles: the same simulation for many seeds, in one process.
+ *
+ * '--ensemble N' runs the seeds 'seed', 'seed' + 1, ... 'seed' + N - 1;
+ * '--seeds A,B,C' runs the seeds listed. Member i is the i-th of them.
+ *
+ * Members are the pool tasks, so '--threads' members run at a time, each
+ * one serial and with buffers and generators of its own. A member gives the
+ * same results as a single simulation with its seed.
+ *
+ * Each member writes its results to the output file name with the seed in
+ * it: in place of a "%u", if any, else before the extension (for example
+ * "heatbugsCPU-42.csv"). Snapshots, if requested, are named the same way.
+ * With '--interleave' (binary format only) all members write to the one
+ * output file instead, each record tagged with the member (see hb_output.h).
+ * */
+
+
+/** Called as ensemble 'member' completes, see hb_ensemble_members(...). */
+typedef void (*hb_member_done_fn)( void *ctx, const size_t member );
+
+
+size_t hb_ensemble_seeds( const char *const list, guint32 *const seeds );
+
+gboolean hb_ensemble_filename( char *const dst, const size_t size,
+				const char *const name, const guint32 id );
+
+void hb_ensemble_members( const Parameters_t *const members,
+		const size_t *const order, const size_t count,
+		struct hb_output *const shared, HBPool_t *const pool,
+		hb_member_done_fn done, void *const done_ctx, GError **err );
+
+void hb_ensemble_run( const Parameters_t *const params, HBPool_t *const pool,
+								GError **err );
+
+
+#endif
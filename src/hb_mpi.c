@@ -0,0 +1,911 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Distributed memory heatbugs, with MPI ('make mpi'):
+ *
+ *	mpirun -np 4 ../bin/heatbugs_mpi [options]
+ *
+ * Same options and results file as heatbugs. No process holds the whole
+ * world: the torus is split in 2D blocks, one per rank, on a periodic grid
+ * of ranks (MPI_Dims_create(...)). A rank keeps its block's heat and bugs
+ * plus a halo, a ring one cell wide with its neighbours' border cells.
+ *
+ * Each iteration:
+ *  1) halos are refreshed and every rank diffuses its block, with the
+ *     fused kernel, comp_world_heat_rows(...);
+ *  2) bugs move as with '--agents checkerboard': each block is 2 x 2 tiles,
+ *     so tiles of one colour are at least a tile apart over the whole grid,
+ *     and the four colours run one after the other. In a colour phase each
+ *     rank moves the bugs of its tile, with bug_move(...), reading the
+ *     refreshed halo. Then the halo is written back: heat left in halo
+ *     cells, and the bugs that stepped there, go to the ranks owning them.
+ *  3) the unhappiness average is reduced to rank 0, which writes it out.
+ * Edges go west/east first, then south/north with the halo corners, so
+ * corners (and bugs crossing them) reach the diagonal rank in two hops.
+ *
+ * Bugs are created as initiate(...) does, every rank drawing all of them
+ * but keeping its own. With the tiles the grid gives (4 x 4 tiles with
+ * 4 ranks), world and bugs evolve exactly as with '--agents checkerboard';
+ * only the average is summed in another order. Philox generator, fused
+ * diffusion and checkerboard agents only; ensembles, sweeps, checkpoints,
+ * snapshots, profiles, sparse diffusion and statistics other than the
+ * average ('--columns') aren't available.
+ * */
+
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpi.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_rng.h"
+#include "hb_output.h"
+
+
+
+/** Tiles per block side, and their smallest side (a bug reaches 1 cell). */
+#define BLOCK_TILES	2
+#define MIN_TILE_SIDE	3
+
+/** Edge cell states. */
+#define CELL_BUG	0x1	/* Refresh: has a bug. Write back: a bug moves in. */
+#define CELL_HEAT	0x2	/* Write back: heat changed. */
+
+/** Halo edges, also the message tags: the way an edge travels. */
+enum { EDGE_WEST = 0, EDGE_EAST, EDGE_SOUTH, EDGE_NORTH, EDGES };
+
+
+/** An edge cell, as exchanged between ranks. */
+typedef struct hb_mpi_cell {
+	guint64 id;			/* Bug id.			*/
+	float heat;
+	float unhappiness;		/* Bug unhappiness.		*/
+	guint32 state;			/* CELL_* flags.		*/
+	guint32 ideal_temperature;	/* Bug ideal temperature.	*/
+	guint32 output_heat;		/* Bug output heat.		*/
+	guint32 reserved;
+} HBMpiCell_t;
+
+
+/** A bug of the tile moving, sorted by id. */
+typedef struct hb_mpi_tile_bug {
+	size_t id;
+	size_t slot;
+} HBMpiTileBug_t;
+
+
+/** A rank's block of the world, with its halo. */
+typedef struct hb_mpi_block {
+	MPI_Comm comm;		/* Periodic 2D grid of ranks.			*/
+	int rank;
+	int dims[ 2 ];		/* Ranks along height [0] and width [1].	*/
+	int coords[ 2 ];	/* This rank's row [0] and column [1].		*/
+	int neighbour[ EDGES ];	/* Ranks west, east, south and north.		*/
+
+	size_t x0, y0;		/* First world column and row of the block.	*/
+	size_t lw, lh;		/* Block width and height, halo excluded.	*/
+	size_t tx, ty;		/* Where the second tile column and row start,	*/
+				/* 1 based (column 0 is the halo).		*/
+	Parameters_t local;	/* Simulation parameters, with the world being	*/
+				/* the block and its halo, for the kernels.	*/
+
+	hb_heat_t *heat[ 2 ];	/* SIZE: (LW + 2) * (LH + 2)	- Heat map and buffer.	*/
+	hb_map_t *map;		/* SIZE: (LW + 2) * (LH + 2)	- Bugs presence.	*/
+
+	Swarm_t swarm;		/* SIZE: CAPACITY	- Block's bugs, local locus.	*/
+	size_t *ids;		/* SIZE: CAPACITY	- And their (global) ids.	*/
+	float *unhappiness;	/* SIZE: CAPACITY				*/
+	guint8 *colour;		/* SIZE: CAPACITY	- Colour they move in, this	*/
+				/* iteration (TILE_COLOURS: they don't).	*/
+	size_t nbugs, capacity;
+
+	HBMpiTileBug_t *tile;	/* SIZE: CAPACITY	- Bugs of the moving tile.	*/
+	size_t *leaving;	/* SIZE: CAPACITY	- Bugs that left the block.	*/
+
+	HBMpiCell_t *out[ EDGES ];	/* SIZE: EDGE + 2	- Edges sent...	*/
+	HBMpiCell_t *in[ EDGES ];	/* SIZE: EDGE + 2	- ...and received.	*/
+	hb_heat_t *before[ EDGES ];		/* SIZE: EDGE + 2	- Halo heat, as refreshed. */
+
+	AgentState_t state;	/* Generator and neighbours order.		*/
+} HBMpiBlock_t;
+
+
+
+/** Local position of the cell at 'row', 'col' (halo rows/cols 0 and L + 1). */
+#define AT( blk, row, col )	((row) * ((blk)->lw + 2) + (col))
+
+/** Same cell in the heat map, which has its own ghost border (unused here). */
+#define HEAT_AT( blk, row, col )	HEAT_CELL( &(blk)->local, row, col )
+
+/** Edge length, halo corners included. */
+#define EDGE_CELLS( blk, edge )	(((edge) < EDGE_SOUTH ? (blk)->lh : (blk)->lw) + 2)
+
+
+
+/**
+ * Free a block. Safe on partly set up blocks.
+ * */
+static void block_free( HBMpiBlock_t *const blk )
+{
+	for (int e = 0; e < EDGES; e++)
+	{
+		free( blk->before[ e ] );
+		free( blk->in[ e ] );
+		free( blk->out[ e ] );
+	}
+
+	free( blk->leaving );
+	free( blk->tile );
+	free( blk->colour );
+	free( blk->unhappiness );
+	free( blk->ids );
+	freeSwarm( &blk->swarm );
+	free( blk->map );
+	free( blk->heat[ BUFFER ] );
+	free( blk->heat[ MAP ] );
+
+	if (blk->comm != MPI_COMM_NULL) MPI_Comm_free( &blk->comm );
+
+	return;
+}
+
+
+
+/**
+ * Place this rank on the grid and allocate its block. Block and tile
+ * bounds are those of the checkerboard engine with BLOCK_TILES tiles per
+ * rank along each side (see setupCheckerBoard(...)).
+ * */
+static void block_setup( HBMpiBlock_t *const blk, const Parameters_t *const params,
+								GError **err )
+{
+	const int periods[ 2 ] = { 1, 1 };
+	int ranks;
+	size_t tiles_x, tiles_y, cells;
+
+
+	memset( blk, 0, sizeof( HBMpiBlock_t ) );
+	blk->comm = MPI_COMM_NULL;
+
+	MPI_Comm_size( MPI_COMM_WORLD, &ranks );
+	MPI_Dims_create( ranks, 2, blk->dims );
+
+	tiles_x = BLOCK_TILES * (size_t) blk->dims[ 1 ];
+	tiles_y = BLOCK_TILES * (size_t) blk->dims[ 0 ];
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->world_width < MIN_TILE_SIDE * tiles_x)
+		|| (params->world_height < MIN_TILE_SIDE * tiles_y),
+		HB_MPI_INVALID, error_handler,
+		"World too small for %d x %d ranks, it needs at least %zu x %zu cells.",
+		blk->dims[ 1 ], blk->dims[ 0 ], MIN_TILE_SIDE * tiles_x,
+		MIN_TILE_SIDE * tiles_y );
+
+	MPI_Cart_create( MPI_COMM_WORLD, 2, blk->dims, periods, 1, &blk->comm );
+	MPI_Comm_rank( blk->comm, &blk->rank );
+	MPI_Cart_coords( blk->comm, blk->rank, 2, blk->coords );
+
+	MPI_Cart_shift( blk->comm, 1, 1, &blk->neighbour[ EDGE_WEST ],
+					&blk->neighbour[ EDGE_EAST ] );
+	MPI_Cart_shift( blk->comm, 0, 1, &blk->neighbour[ EDGE_SOUTH ],
+					&blk->neighbour[ EDGE_NORTH ] );
+
+
+	/* Tile 't' covers cells [t * cells / tiles .. (t + 1) * cells / tiles[. */
+	{
+		const size_t cx = BLOCK_TILES * (size_t) blk->coords[ 1 ];
+		const size_t cy = BLOCK_TILES * (size_t) blk->coords[ 0 ];
+		const size_t w = params->world_width, h = params->world_height;
+
+		blk->x0 = cx * w / tiles_x;
+		blk->y0 = cy * h / tiles_y;
+		blk->lw = (cx + 2) * w / tiles_x - blk->x0;
+		blk->lh = (cy + 2) * h / tiles_y - blk->y0;
+		blk->tx = 1 + (cx + 1) * w / tiles_x - blk->x0;
+		blk->ty = 1 + (cy + 1) * h / tiles_y - blk->y0;
+	}
+
+	blk->local = *params;
+	blk->local.world_width = blk->lw + 2;
+	blk->local.world_height = blk->lh + 2;
+	world_geometry( &blk->local );
+
+	cells = blk->local.world_size;
+	blk->capacity = MIN( params->bugs_number, cells );
+
+
+	/** HEAT MAP & Buffer, SWARM MAP. */
+	blk->heat[ MAP ] = (hb_heat_t *) calloc( blk->local.heat_size, sizeof( hb_heat_t ) );
+	blk->heat[ BUFFER ] = (hb_heat_t *) calloc( blk->local.heat_size, sizeof( hb_heat_t ) );
+	blk->map = (hb_map_t *) calloc( HB_MAP_WORDS( cells ), sizeof( hb_map_t ) );
+
+	/** SWARM, the block's bugs. */
+	setupSwarm( &blk->swarm, blk->capacity, err );
+	hb_if_err_goto( *err, error_handler );
+
+	blk->ids = (size_t *) malloc( blk->capacity * sizeof( size_t ) );
+	blk->unhappiness = (float *) malloc( blk->capacity * sizeof( float ) );
+	blk->colour = (guint8 *) malloc( blk->capacity * sizeof( guint8 ) );
+	blk->tile = (HBMpiTileBug_t *) malloc( blk->capacity * sizeof( HBMpiTileBug_t ) );
+	blk->leaving = (size_t *) malloc( blk->capacity * sizeof( size_t ) );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!blk->heat[ MAP ] || !blk->heat[ BUFFER ] || !blk->map
+		|| !blk->ids || !blk->unhappiness || !blk->colour
+		|| !blk->tile || !blk->leaving,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the rank's block." );
+
+	/** EDGES. */
+	for (int e = 0; e < EDGES; e++)
+	{
+		blk->out[ e ] = (HBMpiCell_t *) malloc( EDGE_CELLS( blk, e ) * sizeof( HBMpiCell_t ) );
+		blk->in[ e ] = (HBMpiCell_t *) malloc( EDGE_CELLS( blk, e ) * sizeof( HBMpiCell_t ) );
+		blk->before[ e ] = (hb_heat_t *) malloc( EDGE_CELLS( blk, e ) * sizeof( hb_heat_t ) );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			!blk->out[ e ] || !blk->in[ e ] || !blk->before[ e ],
+			HB_MALLOC_FAILURE, error_handler,
+			"Unable to allocate memory for the block's edges." );
+	}
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * A bug enters the block at 'pos', with the data in 'cell'. It has moved
+ * already, if this iteration.
+ * */
+static void bug_enter( HBMpiBlock_t *const blk, const size_t pos,
+					const HBMpiCell_t *const cell )
+{
+	const size_t slot = blk->nbugs++;
+
+	blk->swarm.locus[ slot ] = (hb_locus_t) pos;
+	blk->swarm.ideal_temperature[ slot ] = cell->ideal_temperature;
+	blk->swarm.output_heat[ slot ] = cell->output_heat;
+	blk->ids[ slot ] = (size_t) cell->id;
+	blk->unhappiness[ slot ] = cell->unhappiness;
+	blk->colour[ slot ] = TILE_COLOURS;
+
+	MAP_SET_BUG( blk->map, pos );
+
+	return;
+}
+
+
+
+/**
+ * Create the bugs, the same ones initiate(...) does. Every rank draws the
+ * position of all of them, in bug id order (set 'placed' tells the taken
+ * ones), and keeps those standing in its block.
+ * */
+static void block_initiate( HBMpiBlock_t *const blk,
+			const Parameters_t *const params, GError **err )
+{
+	HBRng_t *const rng = &blk->state.rng;
+	GHashTable *placed = NULL;
+	gint64 *loci = NULL;
+	HBMpiCell_t cell;
+	size_t row, col;
+
+
+	hb_rng_init( rng, HB_RNG_PHILOX, params->seed, NULL );
+
+	for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+		blk->state.neighbour_idx[ n ] = n;
+
+	loci = (gint64 *) malloc( params->bugs_number * sizeof( gint64 ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		loci == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the bugs positions." );
+
+	placed = g_hash_table_new( g_int64_hash, g_int64_equal );
+
+	memset( &cell, 0, sizeof( HBMpiCell_t ) );
+
+	for (size_t bug_id = 0; bug_id < params->bugs_number; bug_id++)
+	{
+		hb_rng_stream( rng, HB_STREAM_INIT, 0, bug_id );
+
+		/* Find a new free position. */
+		do {
+			loci[ bug_id ] = (gint64) hb_rng_uint64_range( rng, 0,
+							params->world_size );
+		} while (g_hash_table_contains( placed, &loci[ bug_id ] ));
+
+		g_hash_table_add( placed, &loci[ bug_id ] );
+
+		row = (size_t) loci[ bug_id ] / params->world_width;
+		col = (size_t) loci[ bug_id ] % params->world_width;
+
+		if ((row < blk->y0) || (row >= blk->y0 + blk->lh)
+			|| (col < blk->x0) || (col >= blk->x0 + blk->lw))
+			continue;	/* Another rank's. */
+
+		cell.id = bug_id;
+		cell.ideal_temperature = hb_rng_int_range( rng,
+					params->bugs_temperature_min_ideal,
+					params->bugs_temperature_max_ideal );
+		cell.output_heat = hb_rng_int_range( rng,
+					params->bugs_heat_min_output,
+					params->bugs_heat_max_output );
+		cell.unhappiness = (float) cell.ideal_temperature;
+
+		bug_enter( blk, AT( blk, row - blk->y0 + 1, col - blk->x0 + 1 ), &cell );
+	}
+
+
+error_handler:
+
+	if (placed) g_hash_table_destroy( placed );
+	free( loci );
+
+	return;
+}
+
+
+
+/**
+ * Send edge 'edge' (out) to the neighbour it names, and receive the one
+ * the opposite neighbour sends the same way (in).
+ * */
+static void edge_exchange( HBMpiBlock_t *const blk, const int edge )
+{
+	const int count = (int) (EDGE_CELLS( blk, edge ) * sizeof( HBMpiCell_t ));
+
+	MPI_Sendrecv( blk->out[ edge ], count, MPI_BYTE, blk->neighbour[ edge ], edge,
+		blk->in[ edge ], count, MPI_BYTE, blk->neighbour[ edge ^ 1 ], edge,
+		blk->comm, MPI_STATUS_IGNORE );
+
+	return;
+}
+
+
+static inline void cell_get( const HBMpiBlock_t *const blk, const size_t row,
+			const size_t col, HBMpiCell_t *const cell )
+{
+	cell->heat = heat_get( blk->heat[ MAP ][ HEAT_AT( blk, row, col ) ] );
+	cell->state = MAP_HAS_BUG( blk->map, AT( blk, row, col ) ) ? CELL_BUG : 0;
+
+	return;
+}
+
+
+static inline void cell_set( HBMpiBlock_t *const blk, const size_t row,
+			const size_t col, const HBMpiCell_t *const cell )
+{
+	const size_t pos = AT( blk, row, col );
+
+	blk->heat[ MAP ][ HEAT_AT( blk, row, col ) ] = heat_put( cell->heat );
+	if (cell->state & CELL_BUG)
+		MAP_SET_BUG( blk->map, pos );
+	else
+		MAP_CLEAR( blk->map, pos );
+
+	return;
+}
+
+
+
+/**
+ * Refresh the halo with the neighbours' border cells: heat and bugs
+ * presence. Keeps the halo heat, to tell later what bugs changed.
+ * */
+static void halo_refresh( HBMpiBlock_t *const blk )
+{
+	const size_t lw = blk->lw, lh = blk->lh;
+
+
+	/* West and east borders, block rows. */
+	for (size_t row = 1; row <= lh; row++)
+	{
+		cell_get( blk, row, 1, &blk->out[ EDGE_WEST ][ row ] );
+		cell_get( blk, row, lw, &blk->out[ EDGE_EAST ][ row ] );
+	}
+
+	edge_exchange( blk, EDGE_WEST );
+	edge_exchange( blk, EDGE_EAST );
+
+	for (size_t row = 1; row <= lh; row++)
+	{
+		cell_set( blk, row, lw + 1, &blk->in[ EDGE_WEST ][ row ] );
+		cell_set( blk, row, 0, &blk->in[ EDGE_EAST ][ row ] );
+	}
+
+	/* South and north borders, with the halo corners just received. */
+	for (size_t col = 0; col <= lw + 1; col++)
+	{
+		cell_get( blk, 1, col, &blk->out[ EDGE_SOUTH ][ col ] );
+		cell_get( blk, lh, col, &blk->out[ EDGE_NORTH ][ col ] );
+	}
+
+	edge_exchange( blk, EDGE_SOUTH );
+	edge_exchange( blk, EDGE_NORTH );
+
+	for (size_t col = 0; col <= lw + 1; col++)
+	{
+		cell_set( blk, lh + 1, col, &blk->in[ EDGE_SOUTH ][ col ] );
+		cell_set( blk, 0, col, &blk->in[ EDGE_NORTH ][ col ] );
+
+		blk->before[ EDGE_SOUTH ][ col ] = blk->heat[ MAP ][ HEAT_AT( blk, 0, col ) ];
+		blk->before[ EDGE_NORTH ][ col ] = blk->heat[ MAP ][ HEAT_AT( blk, lh + 1, col ) ];
+	}
+
+	for (size_t row = 0; row <= lh + 1; row++)
+	{
+		blk->before[ EDGE_WEST ][ row ] = blk->heat[ MAP ][ HEAT_AT( blk, row, 0 ) ];
+		blk->before[ EDGE_EAST ][ row ] = blk->heat[ MAP ][ HEAT_AT( blk, row, lw + 1 ) ];
+	}
+
+	for (int e = 0; e < EDGES; e++)
+		memset( blk->out[ e ], 0, EDGE_CELLS( blk, e ) * sizeof( HBMpiCell_t ) );
+
+	return;
+}
+
+
+
+/**
+ * Halo cell at heat map 'pos' (on 'edge', at 'idx' along it) in a write
+ * back message: its heat, if changed since refreshed.
+ * */
+static inline void halo_heat( HBMpiBlock_t *const blk, const int edge,
+					const size_t idx, const size_t pos )
+{
+	if (blk->heat[ MAP ][ pos ] != blk->before[ edge ][ idx ])
+	{
+		blk->out[ edge ][ idx ].heat = heat_get( blk->heat[ MAP ][ pos ] );
+		blk->out[ edge ][ idx ].state |= CELL_HEAT;
+	}
+
+	return;
+}
+
+
+/**
+ * Border cell 'pos', written back by a neighbour as 'cell'. A bug landing
+ * on a halo column (a halo corner of the neighbour) goes on, west or east.
+ * */
+static inline void border_apply( HBMpiBlock_t *const blk, const size_t pos,
+			const size_t row, const size_t col,
+			const HBMpiCell_t *const cell )
+{
+	if (cell->state & CELL_HEAT)
+		blk->heat[ MAP ][ HEAT_AT( blk, row, col ) ] = heat_put( cell->heat );
+
+	if (!(cell->state & CELL_BUG))
+		return;
+
+	if ((col == 0) || (col == blk->lw + 1))
+	{
+		HBMpiCell_t *const next = &blk->out[ col ? EDGE_EAST : EDGE_WEST ][ row ];
+
+		*next = *cell;
+		next->state = CELL_BUG;
+	}
+	else
+		bug_enter( blk, pos, cell );
+
+	return;
+}
+
+
+
+/**
+ * Write back the halo to the ranks owning it: heat left there, and bugs
+ * that stepped there (already in the 'out' edges, see tile_step(...)).
+ * South/north first, then west/east, which forwards the corners.
+ * */
+static void halo_write_back( HBMpiBlock_t *const blk )
+{
+	const size_t lw = blk->lw, lh = blk->lh;
+
+
+	for (size_t col = 0; col <= lw + 1; col++)
+	{
+		halo_heat( blk, EDGE_SOUTH, col, HEAT_AT( blk, 0, col ) );
+		halo_heat( blk, EDGE_NORTH, col, HEAT_AT( blk, lh + 1, col ) );
+	}
+
+	edge_exchange( blk, EDGE_SOUTH );
+	edge_exchange( blk, EDGE_NORTH );
+
+	for (size_t col = 0; col <= lw + 1; col++)
+	{
+		border_apply( blk, AT( blk, lh, col ), lh, col, &blk->in[ EDGE_SOUTH ][ col ] );
+		border_apply( blk, AT( blk, 1, col ), 1, col, &blk->in[ EDGE_NORTH ][ col ] );
+	}
+
+
+	for (size_t row = 1; row <= lh; row++)
+	{
+		halo_heat( blk, EDGE_WEST, row, HEAT_AT( blk, row, 0 ) );
+		halo_heat( blk, EDGE_EAST, row, HEAT_AT( blk, row, lw + 1 ) );
+	}
+
+	edge_exchange( blk, EDGE_WEST );
+	edge_exchange( blk, EDGE_EAST );
+
+	for (size_t row = 1; row <= lh; row++)
+	{
+		border_apply( blk, AT( blk, row, lw ), row, lw, &blk->in[ EDGE_WEST ][ row ] );
+		border_apply( blk, AT( blk, row, 1 ), row, 1, &blk->in[ EDGE_EAST ][ row ] );
+	}
+
+	return;
+}
+
+
+
+static int tile_bug_compare( const void *a, const void *b )
+{
+	const HBMpiTileBug_t *const ba = (const HBMpiTileBug_t *) a;
+	const HBMpiTileBug_t *const bb = (const HBMpiTileBug_t *) b;
+
+	return (ba->id > bb->id) - (ba->id < bb->id);
+}
+
+static int slot_compare_desc( const void *a, const void *b )
+{
+	const size_t sa = *(const size_t *) a, sb = *(const size_t *) b;
+
+	return (sa < sb) - (sa > sb);
+}
+
+
+
+/**
+ * Colour of the tile each bug stands in, as the iteration starts.
+ * */
+static void tile_colours( HBMpiBlock_t *const blk )
+{
+	const size_t stride = blk->lw + 2;
+
+	for (size_t slot = 0; slot < blk->nbugs; slot++)
+	{
+		const size_t row = blk->swarm.locus[ slot ] / stride;
+		const size_t col = blk->swarm.locus[ slot ] % stride;
+
+		blk->colour[ slot ] = (col >= blk->tx) | ((row >= blk->ty) << 1);
+	}
+
+	return;
+}
+
+
+
+/**
+ * Move the bugs of the block's tile 'qx', 'qy', as bug_step_tile(...)
+ * does: in id order, shuffled by the tile's stream, each bug with its own.
+ * Bugs that step into the halo leave the block, into the 'out' edges.
+ * */
+static void tile_step( HBMpiBlock_t *const blk, const size_t qx,
+				const size_t qy, const size_t iteration )
+{
+	const size_t tile = (BLOCK_TILES * (size_t) blk->coords[ 0 ] + qy)
+				* BLOCK_TILES * (size_t) blk->dims[ 1 ]
+				+ BLOCK_TILES * (size_t) blk->coords[ 1 ] + qx;
+	const size_t stride = blk->lw + 2;
+
+	HBRng_t *const rng = &blk->state.rng;
+	size_t nbugs = 0, nleaving = 0, row, col;
+
+
+	/** The tile's bugs, in id order. */
+	for (size_t slot = 0; slot < blk->nbugs; slot++)
+	{
+		if (blk->colour[ slot ] != (qx | (qy << 1)))
+			continue;
+
+		blk->tile[ nbugs ].id = blk->ids[ slot ];
+		blk->tile[ nbugs ].slot = slot;
+		nbugs++;
+	}
+
+	qsort( blk->tile, nbugs, sizeof( HBMpiTileBug_t ), tile_bug_compare );
+
+
+	/** Move them. */
+	hb_rng_stream( rng, HB_STREAM_TILE, iteration, tile );
+
+	for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+		blk->state.neighbour_idx[ n ] = n;
+
+	for (size_t idx = 0; idx + 1 < nbugs; idx++)
+	{
+		size_t rnd_idx = idx + (size_t) hb_rng_int_range( rng, 0, nbugs - idx );
+
+		SWAP( blk->tile[ idx ], blk->tile[ rnd_idx ] );
+	}
+
+	for (size_t idx = 0; idx < nbugs; idx++)
+	{
+		bug_stream( &blk->state, iteration, blk->tile[ idx ].id );
+
+		bug_move( blk->tile[ idx ].slot, &blk->swarm, blk->map, blk->heat[ MAP ],
+				blk->unhappiness, &blk->local, &blk->state );
+	}
+
+
+	/** Bugs now in the halo leave, on the edge they stand. Corners go */
+	/** south/north, to be forwarded.                                  */
+	for (size_t idx = 0; idx < nbugs; idx++)
+	{
+		const size_t slot = blk->tile[ idx ].slot;
+		HBMpiCell_t *cell;
+
+		row = blk->swarm.locus[ slot ] / stride;
+		col = blk->swarm.locus[ slot ] % stride;
+
+		if (row == 0)
+			cell = &blk->out[ EDGE_SOUTH ][ col ];
+		else if (row == blk->lh + 1)
+			cell = &blk->out[ EDGE_NORTH ][ col ];
+		else if (col == 0)
+			cell = &blk->out[ EDGE_WEST ][ row ];
+		else if (col == blk->lw + 1)
+			cell = &blk->out[ EDGE_EAST ][ row ];
+		else
+			continue;
+
+		cell->state |= CELL_BUG;
+		cell->id = blk->ids[ slot ];
+		cell->ideal_temperature = blk->swarm.ideal_temperature[ slot ];
+		cell->output_heat = blk->swarm.output_heat[ slot ];
+		cell->unhappiness = blk->unhappiness[ slot ];
+
+		blk->leaving[ nleaving++ ] = slot;
+	}
+
+	/* Last slots first, so the last bug moved in a hole never left. */
+	qsort( blk->leaving, nleaving, sizeof( size_t ), slot_compare_desc );
+
+	for (size_t idx = 0; idx < nleaving; idx++)
+	{
+		const size_t slot = blk->leaving[ idx ], last = --blk->nbugs;
+
+		blk->swarm.locus[ slot ] = blk->swarm.locus[ last ];
+		blk->swarm.ideal_temperature[ slot ] = blk->swarm.ideal_temperature[ last ];
+		blk->swarm.output_heat[ slot ] = blk->swarm.output_heat[ last ];
+		blk->ids[ slot ] = blk->ids[ last ];
+		blk->unhappiness[ slot ] = blk->unhappiness[ last ];
+		blk->colour[ slot ] = blk->colour[ last ];
+	}
+
+	return;
+}
+
+
+
+/**
+ * One iteration: diffusion, then the bugs, colour by colour, as
+ * bug_step_checkerboard(...).
+ * */
+static void block_step( HBMpiBlock_t *const blk, const size_t iteration )
+{
+	size_t colours[ TILE_COLOURS ] = { 0, 1, 2, 3 };
+
+
+	/** Diffusion, all of the block's rows at once. */
+	halo_refresh( blk );
+
+	comp_world_heat_rows( blk->heat[ MAP ], blk->heat[ BUFFER ], &blk->local,
+						1, blk->lh + 1, NULL );
+	SWAP( blk->heat[ BUFFER ], blk->heat[ MAP ] );
+
+
+	/** Bugs by tile, once: those moving to another tile wait there. */
+	tile_colours( blk );
+
+	/** Seeded colour order, the same in every rank. */
+	hb_rng_stream( &blk->state.rng, HB_STREAM_COLOURS, iteration, 0 );
+
+	for (size_t c = 0; c + 1 < TILE_COLOURS; c++)
+	{
+		size_t rnd_c = c + (size_t) hb_rng_int_range( &blk->state.rng,
+						0, TILE_COLOURS - c );
+
+		SWAP( colours[ c ], colours[ rnd_c ] );
+	}
+
+	for (size_t c = 0; c < TILE_COLOURS; c++)
+	{
+		halo_refresh( blk );
+
+		tile_step( blk, colours[ c ] & 1, colours[ c ] >> 1, iteration );
+
+		halo_write_back( blk );
+	}
+
+	return;
+}
+
+
+
+/**
+ * Unhappiness average of all bugs, on rank 0.
+ * */
+static float block_average( const HBMpiBlock_t *const blk,
+					const Parameters_t *const params )
+{
+	double sum = 0.0, total = 0.0;
+
+	for (size_t slot = 0; slot < blk->nbugs; slot++)
+		sum += blk->unhappiness[ slot ];
+
+	MPI_Reduce( &sum, &total, 1, MPI_DOUBLE, MPI_SUM, 0, blk->comm );
+
+	return (float) (total / params->bugs_number);
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	HBOutput_t *output = NULL;	/* Results file, rank 0 only. */
+	GError *err_main = NULL;	/* Error reporting object, from Glib. */
+
+	Parameters_t params;		/* Simulation parameters. */
+
+	HBMpiBlock_t blk;		/* This rank's part of the world. */
+
+	char **args = NULL;		/* Options, after the MPI defaults. */
+	float unhapp_average;
+	int rank;
+	gboolean everywhere = TRUE;	/* Errors so far are the same in all ranks. */
+
+
+	MPI_Init( &argc, &argv );
+	MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+
+	memset( &blk, 0, sizeof( HBMpiBlock_t ) );
+	blk.comm = MPI_COMM_NULL;
+
+
+	/* Every rank reads the same options, the seed is rank 0's. The */
+	/* ranks draw from the philox generator, so it's the default    */
+	/* here: an explicit '--rng' comes after it, and is checked.    */
+	args = (char **) malloc( (argc + 3) * sizeof( char * ) );
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		args == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the options." );
+
+	args[ 0 ] = argv[ 0 ];
+	args[ 1 ] = (char *) "--rng";
+	args[ 2 ] = (char *) "philox";
+	memcpy( args + 3, argv + 1, (argc - 1) * sizeof( char * ) );
+	args[ argc + 2 ] = NULL;
+
+	getSimulParameters( &params, argc + 2, args, &err_main );
+	free( args );
+	hb_if_err_goto( err_main, error_handler );
+
+	MPI_Bcast( &params.seed, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(params.ensemble > 0) || (params.sweep_filename[ 0 ] != '\0')
+		|| (params.checkpoint_every > 0)
+		|| (params.restart_filename[ 0 ] != '\0')
+		|| (params.snapshot_every > 0) || params.profile
+		|| (params.threads > 1) || (params.order != ORDER_RANDOM)
+		|| (params.sparse_epsilon >= 0)
+		|| (params.columns != HB_STAT_MEAN)
+		|| (params.converge_window > 0)
+		|| (params.output_every != 1) || params.aggregate
+		|| (params.rng != HB_RNG_PHILOX)
+		|| (params.diffusion != DIFFUSION_FUSED)
+		|| (params.agents == AGENTS_ATOMIC),
+		HB_MPI_INVALID, error_handler,
+		"Ensembles, sweeps, checkpoints, snapshots, profiles, threads, "
+		"bugs orders, sparse diffusion, convergence stops, aggregates, "
+		"output other than the unhappiness average every iteration, "
+		"generators other than philox and engines other than the fused "
+		"diffusion and checkerboard agents aren't available with MPI." );
+
+	/* What the ranks run, as the output header tells. */
+	params.agents = AGENTS_CHECKERBOARD;
+
+
+	block_setup( &blk, &params, &err_main );
+	hb_if_err_goto( err_main, error_handler );
+
+	everywhere = FALSE;
+
+	block_initiate( &blk, &params, &err_main );
+	hb_if_err_goto( err_main, error_handler );
+
+	if (blk.rank == 0)
+	{
+		output = hb_output_open( &params, 0, &err_main );
+		hb_if_err_goto( err_main, error_handler );
+	}
+
+
+	/** Simulate, as simulate(...) does. */
+	unhapp_average = block_average( &blk, &params );
+
+	if (blk.rank == 0)
+	{
+		hb_output_record( output, &unhapp_average, &err_main );
+		hb_if_err_goto( err_main, error_handler );
+	}
+
+	for (size_t iter_counter = 0; (iter_counter < params.numIterations)
+				|| (params.numIterations == 0); iter_counter++)
+	{
+		block_step( &blk, iter_counter );
+
+		unhapp_average = block_average( &blk, &params );
+
+		if (blk.rank == 0)
+		{
+			hb_output_record( output, &unhapp_average, &err_main );
+			hb_if_err_goto( err_main, error_handler );
+		}
+	}
+
+
+	hb_output_close( output, &err_main );
+	output = NULL;
+	hb_if_err_goto( err_main, error_handler );
+
+	block_free( &blk );
+
+	MPI_Finalize();
+
+	return EXIT_SUCCESS;
+
+
+error_handler:
+
+	/* Options are the same in every rank, so are their errors: rank 0   */
+	/* tells. Any other error leaves the other ranks waiting: abort them. */
+	if (!everywhere || (rank == 0))
+		fprintf( stderr, "Error: %s\n\n", err_main->message );
+
+	g_error_free( err_main );
+	err_main = NULL;
+
+	hb_output_close( output, &err_main );
+	if (err_main) g_error_free( err_main );
+
+	block_free( &blk );
+
+	if (!everywhere) MPI_Abort( MPI_COMM_WORLD, EXIT_FAILURE );
+
+	MPI_Finalize();
+
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,865 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+#define _GNU_SOURCE	/* fileno(...), ftruncate(...) and fsync(...) are     */
+			/* POSIX, not c99.                                    */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_output.h"
+
+
+
+/** Binary records are written in blocks of this many floats (64 KiB). */
+#define BLOCK_FLOATS	16384
+
+/** Records the asynchronous writer can fall behind by. Power of two. */
+#define RING_RECORDS	4096
+
+/* Waking a sleeping side costs more than writing a record, so it's only */
+/* done once this many records (or free slots) have piled up...          */
+#define RING_WAKE	(RING_RECORDS / 4)
+/* ...but a sleeping writer still looks at the ring this often (us).      */
+#define WRITER_PERIOD	100000
+
+
+/**
+ * Single producer (simulation), single consumer (writer thread) ring of
+ * records. 'head' is only written by the producer and 'tail' only by the
+ * consumer, so neither side takes a lock while the ring is neither empty
+ * nor full. A side that finds it so sleeps on a condition, after setting
+ * its '*_waiting' flag; the other side only takes the lock to wake it when
+ * that flag is set and RING_WAKE records (or slots) are ready for it.
+ * */
+typedef struct hb_ring {
+	float *records;		/* SIZE: RING_RECORDS * ncols.		     */
+	gint head;		/* Atomic. Records pushed, modulo 2^32.	     */
+	gint tail;		/* Atomic. Records written, modulo 2^32.     */
+	gint quit;		/* Atomic. No more records will come.	     */
+	gint failed;		/* Atomic. The writer hit an error.	     */
+	gint producer_waiting;	/* Atomic. Simulation waits for room	     */
+				/* (or, in hb_output_sync, for none left).   */
+	gint consumer_waiting;	/* Atomic. Writer waits for records.	     */
+	GMutex lock;
+	GCond data;		/* Signalled when a record is pushed.	     */
+	GCond space;		/* Signalled when a record is written.	     */
+} HBRing_t;
+
+
+struct hb_output {
+	int format;		/* HB_FORMAT_*.				*/
+	FILE *file;
+	HBResultHeader_t header;	/* Binary format only.		*/
+	float *block;		/* SIZE: BLOCK_FLOATS - Binary format only.	*/
+	size_t fill;		/* Floats waiting in 'block'.		*/
+	size_t block_size;	/* Whole records per block, in floats.	*/
+
+	GThread *writer;	/* Asynchronous output only.		*/
+	HBRing_t ring;		/* Asynchronous output only.		*/
+	GError *write_err;	/* Writer thread's error, once 'failed'.	*/
+
+	HBOutput_t *shared;	/* Member view only: the output shared.	*/
+	float member;		/* Member view only: its records' tag.	*/
+	GMutex members;		/* Shared output only: one record at a time. */
+	gboolean interleave;	/* Shared output: 'members' is set up.	*/
+
+	size_t window_size;	/* Iterations up to the next record.	*/
+	size_t window_fill;	/* Iterations seen of them.		*/
+	double window[ HB_MAX_COLUMNS ];	/* Aggregates so far.	*/
+};
+
+
+
+/** Add the column of statistic 'column' (HB_COL_*), or its aggregates. */
+static void header_add( HBResultHeader_t *const header, const guint32 column,
+					const unsigned int aggregate )
+{
+	if (!aggregate)
+		header->columns[ header->ncols++ ] = column;
+
+	for (unsigned int agg = 1; agg < (1u << HB_AGGS); agg <<= 1)
+		if (aggregate & agg)
+			header->columns[ header->ncols++ ] = column
+					| (agg << HB_COL_AGG_SHIFT);
+
+	return;
+}
+
+
+
+/** Fill a binary header from the simulation parameters. */
+static void header_setup( HBResultHeader_t *const header,
+					const Parameters_t *const params )
+{
+	memset( header, 0, sizeof( HBResultHeader_t ) );
+
+	memcpy( header->magic, HB_RESULT_MAGIC, sizeof( header->magic ) );
+	header->version = HB_RESULT_VERSION;
+	header->header_size = sizeof( HBResultHeader_t );
+	header->endian = HB_RESULT_ENDIAN;
+
+	/* Member tag first, then the statistics in HB_STAT_* order, each */
+	/* with its aggregates in HB_AGG_* order.                          */
+	if (params->interleave)
+		header->columns[ header->ncols++ ] = HB_COL_MEMBER;
+
+	if (params->columns & HB_STAT_MEAN)
+		header_add( header, HB_COL_UNHAPPINESS, params->aggregate );
+	if (params->columns & HB_STAT_MIN)
+		header_add( header, HB_COL_UNHAPPINESS_MIN, params->aggregate );
+	if (params->columns & HB_STAT_MAX)
+		header_add( header, HB_COL_UNHAPPINESS_MAX, params->aggregate );
+	if (params->columns & HB_STAT_VARIANCE)
+		header_add( header, HB_COL_UNHAPPINESS_VAR, params->aggregate );
+	if (params->columns & HB_STAT_HEAT)
+		header_add( header, HB_COL_HEAT, params->aggregate );
+	if (params->columns & HB_STAT_HISTOGRAM)
+		for (guint32 bin = 0; bin < HB_HIST_BINS; bin++)
+			header_add( header, HB_COL_HISTOGRAM + bin,
+							params->aggregate );
+
+	header->num_iterations = params->numIterations;
+	header->bugs_number = params->bugs_number;
+	header->world_width = params->world_width;
+	header->world_height = params->world_height;
+	header->seed = params->seed;
+	header->world_diffusion_rate = params->world_diffusion_rate;
+	header->world_evaporation_rate = params->world_evaporation_rate;
+	header->bugs_random_move_chance = params->bugs_random_move_chance;
+	header->bugs_temperature_min_ideal = params->bugs_temperature_min_ideal;
+	header->bugs_temperature_max_ideal = params->bugs_temperature_max_ideal;
+	header->bugs_heat_min_output = params->bugs_heat_min_output;
+	header->bugs_heat_max_output = params->bugs_heat_max_output;
+	header->diffusion = params->diffusion;
+	header->agents = params->agents;
+	header->rng = params->rng;
+	header->threads = params->threads;
+	header->converge_window = params->converge_window;
+	header->converge_tolerance = params->converge_tolerance;
+	header->output_every = params->output_every;
+	header->aggregate = params->aggregate;
+
+	return;
+}
+
+
+
+/**
+ * Values per record with 'params' (member tag included), which may be
+ * more than HB_MAX_COLUMNS: check before opening an output.
+ * */
+guint32 hb_output_columns( const Parameters_t *const params )
+{
+	guint32 stats = 0, aggs = 0;
+
+
+	for (int stat = 0; stat < HB_STATS; stat++)
+		if (params->columns & (1u << stat))
+			stats += ((1u << stat) == HB_STAT_HISTOGRAM) ? HB_HIST_BINS : 1;
+
+	for (int agg = 0; agg < HB_AGGS; agg++)
+		if (params->aggregate & (1u << agg))
+			aggs++;
+
+	return (params->interleave ? 1 : 0) + stats * MAX( aggs, 1 );
+}
+
+
+
+/** Write the records waiting in the block. */
+static void block_flush( HBOutput_t *const out, GError **err )
+{
+	size_t wr;
+
+
+	wr = fwrite( out->block, sizeof( float ), out->fill, out->file );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		wr != out->fill,
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to output file." );
+
+	out->header.records += out->fill / out->header.ncols;
+	out->fill = 0;
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Write one record, 'ncols' values, from the calling thread.
+ * */
+static void output_write( HBOutput_t *const out, const float *const values,
+							GError **err )
+{
+	GError *err_record = NULL;
+	int wr = 0;
+
+
+	if (out->format == HB_FORMAT_BINARY)
+	{
+		memcpy( out->block + out->fill, values,
+				out->header.ncols * sizeof( float ) );
+		out->fill += out->header.ncols;
+
+		if (out->fill == out->block_size)
+		{
+			block_flush( out, &err_record );
+			hb_if_err_propagate_goto( err, err_record, error_handler );
+		}
+
+		return;
+	}
+
+
+	for (guint32 col = 0; (col < out->header.ncols) && (wr >= 0); col++)
+		wr = fprintf( out->file, col ? ",%.17g" : "%.17g", values[ col ] );
+
+	if (wr >= 0) wr = fputc( '\n', out->file );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		wr < 0,
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to output file." );
+
+	out->header.records++;
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/** Records in the ring. */
+static inline guint ring_fill( HBRing_t *const ring )
+{
+	return (guint) g_atomic_int_get( &ring->head )
+		- (guint) g_atomic_int_get( &ring->tail );
+}
+
+
+
+/** Wake the other side of the ring, if it's sleeping and 'ready'. */
+static inline void ring_wake( HBRing_t *const ring, gint *const waiting,
+					GCond *const cond, const gboolean ready )
+{
+	if (ready && g_atomic_int_get( waiting ))
+	{
+		g_mutex_lock( &ring->lock );
+		g_cond_signal( cond );
+		g_mutex_unlock( &ring->lock );
+	}
+
+	return;
+}
+
+
+
+/**
+ * Writer thread: write records as they're pushed, until told to quit and
+ * the ring is empty. After an error it keeps taking records (dropping
+ * them), so the simulation never waits forever for room.
+ * */
+static gpointer output_writer( gpointer data )
+{
+	HBOutput_t *const out = (HBOutput_t *) data;
+	HBRing_t *const ring = &out->ring;
+	const guint ncols = out->header.ncols;
+	guint tail = (guint) g_atomic_int_get( &ring->tail );
+
+
+	for (;;)
+	{
+		if (tail == (guint) g_atomic_int_get( &ring->head ))
+		{
+			const gint64 until = g_get_monotonic_time() + WRITER_PERIOD;
+
+
+			if (g_atomic_int_get( &ring->quit )) break;
+
+			g_mutex_lock( &ring->lock );
+			g_atomic_int_set( &ring->consumer_waiting, 1 );
+
+			while ((ring_fill( ring ) < RING_WAKE)
+				&& !g_atomic_int_get( &ring->quit )
+				&& !(g_atomic_int_get( &ring->producer_waiting )
+					&& ring_fill( ring ) > 0))
+				if (!g_cond_wait_until( &ring->data, &ring->lock, until ))
+					break;
+
+			g_atomic_int_set( &ring->consumer_waiting, 0 );
+			g_mutex_unlock( &ring->lock );
+
+			continue;
+		}
+
+		if (!g_atomic_int_get( &ring->failed ))
+		{
+			output_write( out,
+				ring->records + (tail % RING_RECORDS) * ncols,
+				&out->write_err );
+
+			if (out->write_err)
+				g_atomic_int_set( &ring->failed, 1 );
+		}
+
+		tail++;
+		g_atomic_int_set( &ring->tail, (gint) tail );
+
+		ring_wake( ring, &ring->producer_waiting, &ring->space,
+				(ring_fill( ring ) <= RING_RECORDS - RING_WAKE)
+				|| (ring_fill( ring ) == 0) );
+	}
+
+	return NULL;
+}
+
+
+
+/**
+ * Output one record, 'ncols' values. With the asynchronous writer the
+ * record is only copied to the ring, this waits only if the ring is full.
+ * A write error of the writer thread is reported by the next call.
+ * */
+void hb_output_record( HBOutput_t *const out, const float *const values,
+							GError **err )
+{
+	HBRing_t *const ring = &out->ring;
+	guint head;
+
+
+	/* A member's record: tagged, then into the shared output. */
+	if (out->shared)
+	{
+		float tagged[ HB_MAX_COLUMNS ];
+
+		tagged[ 0 ] = out->member;
+		memcpy( tagged + 1, values, (out->shared->header.ncols - 1)
+							* sizeof( float ) );
+
+		g_mutex_lock( &out->shared->members );
+		hb_output_record( out->shared, tagged, err );
+		g_mutex_unlock( &out->shared->members );
+
+		return;
+	}
+
+	if (!out->writer)
+	{
+		output_write( out, values, err );
+		return;
+	}
+
+	if (g_atomic_int_get( &ring->failed ))
+	{
+		hb_if_err_propagate_goto( err, out->write_err, error_handler );
+	}
+
+	head = (guint) g_atomic_int_get( &ring->head );
+
+	/* Full, wait for the writer. */
+	if (head - (guint) g_atomic_int_get( &ring->tail ) == RING_RECORDS)
+	{
+		g_mutex_lock( &ring->lock );
+		g_atomic_int_set( &ring->producer_waiting, 1 );
+
+		while (head - (guint) g_atomic_int_get( &ring->tail )
+					> RING_RECORDS - RING_WAKE)
+			g_cond_wait( &ring->space, &ring->lock );
+
+		g_atomic_int_set( &ring->producer_waiting, 0 );
+		g_mutex_unlock( &ring->lock );
+	}
+
+	memcpy( ring->records + (head % RING_RECORDS) * out->header.ncols,
+			values, out->header.ncols * sizeof( float ) );
+
+	g_atomic_int_set( &ring->head, (gint) (head + 1) );
+
+	ring_wake( ring, &ring->consumer_waiting, &ring->data,
+				head + 1 - (guint) g_atomic_int_get( &ring->tail )
+							>= RING_WAKE );
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Output the statistics 's' of an iteration, as a record of the columns
+ * in the header (a member view's tag is added by hb_output_record(...)).
+ * Sums are compensated (see HBSum_t), then rounded to float; the variance
+ * is the population's, and histogram bins are shares of the bugs.
+ *
+ * Only every 'output_every'-th iteration makes a record. Without
+ * aggregates the others are skipped right away, with them each is added
+ * to the aggregates of the record to come (in double, rounded on output).
+ * */
+void hb_output_stats( HBOutput_t *const out, const HBStats_t *const s,
+							GError **err )
+{
+	const HBResultHeader_t *const header =
+			out->shared ? &out->shared->header : &out->header;
+	const double bugs = (double) s->bugs;
+	const double mean = stats_mean( s );
+	const gboolean record = (++out->window_fill == out->window_size);
+	const gboolean first = (out->window_fill == 1);
+
+	float values[ HB_MAX_COLUMNS ];
+	guint32 nvalues = 0;
+
+
+	if (!record && !header->aggregate) return;
+
+	for (guint32 col = 0; col < header->ncols; col++)
+	{
+		const guint32 column = header->columns[ col ];
+		const guint32 stat = column & HB_COL_STAT_MASK;
+		double *const window = &out->window[ nvalues ];
+		double value, variance;
+
+		switch (stat)
+		{
+			case HB_COL_MEMBER:
+				continue;
+			case HB_COL_UNHAPPINESS:
+				value = mean;
+				break;
+			case HB_COL_UNHAPPINESS_MIN:
+				value = s->min;
+				break;
+			case HB_COL_UNHAPPINESS_MAX:
+				value = s->max;
+				break;
+			case HB_COL_UNHAPPINESS_VAR:
+				variance = sum_get( &s->unhappiness_sq ) / bugs
+								- mean * mean;
+				value = MAX( variance, 0.0 );
+				break;
+			case HB_COL_HEAT:
+				value = sum_get( &s->heat );
+				break;
+			default:	/* HB_COL_HISTOGRAM + bin */
+				value = s->hist[ stat - HB_COL_HISTOGRAM ] / bugs;
+		}
+
+		switch (column >> HB_COL_AGG_SHIFT)
+		{
+			case HB_AGG_MEAN:
+				*window = first ? value : *window + value;
+				values[ nvalues++ ] = (float) (*window
+							/ out->window_fill);
+				break;
+			case HB_AGG_MIN:
+				*window = first ? value : MIN( *window, value );
+				values[ nvalues++ ] = (float) *window;
+				break;
+			case HB_AGG_MAX:
+				*window = first ? value : MAX( *window, value );
+				values[ nvalues++ ] = (float) *window;
+				break;
+			default:	/* The record's iteration. */
+				values[ nvalues++ ] = (float) value;
+		}
+	}
+
+	if (!record) return;
+
+	out->window_fill = 0;
+	out->window_size = header->output_every;
+
+	hb_output_record( out, values, err );
+
+	return;
+}
+
+
+
+/**
+ * A view of the 'shared' output (opened with 'params->interleave') for
+ * ensemble 'member'. Its records go to 'shared', member tag first. Many
+ * views can record at once. Close each view before 'shared'.
+ * */
+HBOutput_t *hb_output_member( HBOutput_t *const shared, const size_t member,
+								GError **err )
+{
+	HBOutput_t *out = NULL;
+
+
+	out = (HBOutput_t *) calloc( 1, sizeof( HBOutput_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		out == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for output." );
+
+	out->shared = shared;
+	out->member = (float) member;
+	out->window_size = 1;	/* The initial state's record. */
+
+
+error_handler:
+
+	return out;
+}
+
+
+
+/**
+ * Wait until every record output so far is written, and make sure it's on
+ * disk (e.g. before a checkpoint claims it is). The records count of the
+ * binary header is only set on close.
+ * */
+void hb_output_sync( HBOutput_t *const out, GError **err )
+{
+	GError *err_sync = NULL;
+	HBRing_t *const ring = &out->ring;
+
+
+	if (out->writer)
+	{
+		g_mutex_lock( &ring->lock );
+		g_atomic_int_set( &ring->producer_waiting, 1 );
+		g_cond_signal( &ring->data );
+
+		while (ring_fill( ring ) > 0)
+			g_cond_wait( &ring->space, &ring->lock );
+
+		g_atomic_int_set( &ring->producer_waiting, 0 );
+		g_mutex_unlock( &ring->lock );
+
+		/* The writer is idle until the next record: the file is ours. */
+		if (g_atomic_int_get( &ring->failed ))
+		{
+			hb_if_err_propagate_goto( err, out->write_err, error_handler );
+		}
+	}
+
+	if (out->format == HB_FORMAT_BINARY)
+	{
+		block_flush( out, &err_sync );
+		hb_if_err_propagate_goto( err, err_sync, error_handler );
+	}
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(fflush( out->file ) != 0) || (fsync( fileno( out->file ) ) != 0),
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to output file." );
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Note the simulation stopped after 'iteration', its unhappiness average
+ * being stationary, in the binary header (written on close). Ensemble
+ * members each stop on their own: a member view keeps nothing.
+ * */
+void hb_output_stop( HBOutput_t *const out, const size_t iteration )
+{
+	if (out->shared) return;
+
+	out->header.stop_iteration = iteration;
+
+	return;
+}
+
+
+
+/**
+ * Reopen a results file to continue it after its first 'records' records
+ * (a restart, see hb_checkpoint.h). Later records, written after the
+ * checkpoint being restarted from, are cut off.
+ * */
+static void output_resume( HBOutput_t *const out, const Parameters_t *const params,
+				const size_t records, GError **err )
+{
+	HBResultHeader_t header;
+	long offset = 0;
+	size_t lines = 0;
+	int c = 0;
+
+
+	out->file = fopen( params->output_filename,
+			(out->format == HB_FORMAT_BINARY) ? "r+b" : "r+" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		out->file == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open output file." );
+
+
+	if (out->format == HB_FORMAT_BINARY)
+	{
+		hb_if_err_create_goto( *err, HB_ERROR,
+			(fread( &header, sizeof( HBResultHeader_t ), 1, out->file ) != 1)
+			|| memcmp( header.magic, HB_RESULT_MAGIC, sizeof( header.magic ) )
+			|| (header.header_size != sizeof( HBResultHeader_t ))
+			|| (header.ncols != out->header.ncols),
+			HB_CHECKPOINT_INVALID, error_handler,
+			"Output file doesn't match the checkpoint." );
+
+		offset = (long) (sizeof( HBResultHeader_t )
+				+ records * out->header.ncols * sizeof( float ));
+
+		/* Must hold the records, whatever its header says. */
+		hb_if_err_create_goto( *err, HB_ERROR,
+			(fseek( out->file, 0, SEEK_END ) != 0)
+			|| (ftell( out->file ) < offset),
+			HB_CHECKPOINT_INVALID, error_handler,
+			"Output file has fewer records than the checkpoint." );
+	}
+	else
+	{
+		while ((lines < records) && ((c = fgetc( out->file )) != EOF))
+			if (c == '\n') lines++;
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			lines < records,
+			HB_CHECKPOINT_INVALID, error_handler,
+			"Output file has fewer records than the checkpoint." );
+
+		offset = ftell( out->file );
+	}
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(fflush( out->file ) != 0)
+		|| (ftruncate( fileno( out->file ), offset ) != 0)
+		|| (fseek( out->file, offset, SEEK_SET ) != 0),
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to output file." );
+
+	out->header.records = records;
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Open 'params->output_filename' for results, in 'params->format', and
+ * start the writer thread if 'params->async_output'. With 'resume' records
+ * the file is not created but continued after them (see output_resume(...)).
+ * */
+HBOutput_t *hb_output_open( const Parameters_t *const params,
+				const size_t resume, GError **err )
+{
+	GError *err_open = NULL;
+	HBOutput_t *out = NULL;
+	size_t wr;
+
+
+	out = (HBOutput_t *) calloc( 1, sizeof( HBOutput_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		out == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for output." );
+
+	out->format = params->format;
+
+	header_setup( &out->header, params );
+
+	/* The initial state is a record of its own, unless already output. */
+	out->window_size = resume ? params->output_every : 1;
+
+
+	if (out->format == HB_FORMAT_BINARY)
+	{
+		out->block = (float *) malloc( BLOCK_FLOATS * sizeof( float ) );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			out->block == NULL,
+			HB_MALLOC_FAILURE, error_handler,
+			"Unable to allocate memory for output." );
+
+		out->block_size = BLOCK_FLOATS
+				- BLOCK_FLOATS % out->header.ncols;
+	}
+
+
+	if (resume)
+	{
+		output_resume( out, params, resume, &err_open );
+		hb_if_err_propagate_goto( err, err_open, error_handler );
+	}
+	else
+	{
+		out->file = fopen( params->output_filename,
+			(out->format == HB_FORMAT_BINARY) ? "wb" : "w+" );	/* Open file overwrite. */
+		hb_if_err_create_goto( *err, HB_ERROR,
+			out->file == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open output file." );
+	}
+
+
+	/* Header goes first, its records count is set when closing. */
+	if ((out->format == HB_FORMAT_BINARY) && !resume)
+	{
+		wr = fwrite( &out->header, sizeof( HBResultHeader_t ), 1, out->file );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			wr != 1,
+			HB_OUTPUT_WRITE_FAILURE, error_handler,
+			"Could not write to output file." );
+	}
+
+
+	/* Ensemble members take turns to record. */
+	if (params->interleave)
+	{
+		g_mutex_init( &out->members );
+		out->interleave = TRUE;
+	}
+
+
+	/* Writer thread, last: nothing can fail after it's started. */
+	if (params->async_output)
+	{
+		out->ring.records = (float *) malloc( RING_RECORDS
+				* out->header.ncols * sizeof( float ) );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			out->ring.records == NULL,
+			HB_MALLOC_FAILURE, error_handler,
+			"Unable to allocate memory for output." );
+
+		g_mutex_init( &out->ring.lock );
+		g_cond_init( &out->ring.data );
+		g_cond_init( &out->ring.space );
+
+		out->writer = g_thread_try_new( "hb-writer", output_writer,
+								out, NULL );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			out->writer == NULL,
+			HB_THREAD_FAILURE, error_handler,
+			"Unable to start writer thread." );
+	}
+
+	return out;
+
+
+error_handler:
+	/* If error handler is reached, release whatever was created. */
+
+	if (out)
+	{
+		if (out->interleave) g_mutex_clear( &out->members );
+
+		if (out->ring.records)
+		{
+			g_cond_clear( &out->ring.space );
+			g_cond_clear( &out->ring.data );
+			g_mutex_clear( &out->ring.lock );
+			free( out->ring.records );
+		}
+
+		if (out->file) fclose( out->file );
+		if (out->block) free( out->block );
+		free( out );
+	}
+
+	return NULL;
+}
+
+
+
+/**
+ * Write whatever is pending, complete the binary header and close. Safe to
+ * call with a NULL output, or after a write error. The writer thread, if
+ * any, first writes every record left in the ring.
+ * */
+void hb_output_close( HBOutput_t *out, GError **err )
+{
+	GError *err_close = NULL;
+	size_t wr;
+
+
+	if (!out) return;
+
+	/* A member view has nothing of its own to close. */
+	if (out->shared)
+	{
+		free( out );
+		return;
+	}
+
+	if (out->interleave) g_mutex_clear( &out->members );
+
+	if (out->writer)
+	{
+		g_mutex_lock( &out->ring.lock );
+		g_atomic_int_set( &out->ring.quit, 1 );
+		g_cond_signal( &out->ring.data );
+		g_mutex_unlock( &out->ring.lock );
+
+		g_thread_join( out->writer );
+		out->writer = NULL;
+
+		g_cond_clear( &out->ring.space );
+		g_cond_clear( &out->ring.data );
+		g_mutex_clear( &out->ring.lock );
+
+		hb_if_err_propagate_goto( err, out->write_err, error_handler );
+	}
+
+	if (out->format == HB_FORMAT_BINARY)
+	{
+		block_flush( out, &err_close );
+		hb_if_err_propagate_goto( err, err_close, error_handler );
+
+		/* Not seekable (e.g. a pipe): records count stays unknown. */
+		if (fseek( out->file, 0, SEEK_SET ) == 0)
+		{
+			wr = fwrite( &out->header, sizeof( HBResultHeader_t ), 1,
+								out->file );
+			hb_if_err_create_goto( *err, HB_ERROR,
+				wr != 1,
+				HB_OUTPUT_WRITE_FAILURE, error_handler,
+				"Could not write to output file." );
+		}
+	}
+
+
+error_handler:
+
+	if (fclose( out->file ) != 0 && err && *err == NULL)
+		g_set_error( err, HB_ERROR, HB_OUTPUT_WRITE_FAILURE,
+					"Could not write to output file." );
+
+	if (out->write_err) g_error_free( out->write_err );
+	if (out->ring.records) free( out->ring.records );
+	if (out->block) free( out->block );
+	free( out );
+
+	return;
+}
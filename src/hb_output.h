@@ -0,0 +1,158 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_OUTPUT_H_
+#define __HEATBUGS_CPU_OUTPUT_H_
+
+
+#include <stdio.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+
+
+/**
+ * Result output: one record per iteration (plus the initial state), each
+ * with 'ncols' float values, written as text or binary ('--format NAME').
+ * The values are the statistics selected with '--columns LIST' (HB_STAT_*
+ * in heatbugs.h), by default the bugs average unhappiness alone.
+ *
+ * With '--output-every K' only every K-th iteration is recorded, so record
+ * 'r' is iteration r * K. With '--aggregate LIST' (HB_AGG_* in heatbugs.h)
+ * each statistic is instead output as its mean, min and/or max over the K
+ * iterations up to the record's (the initial state's record covers itself
+ * alone). Either way the statistics are gathered every iteration, but only
+ * records are formatted and written. Iterations after the last whole K
+ * aren't recorded.
+ *
+ * HB_FORMAT_CSV	: One line per record, values as "%.17g", comma
+ *			  separated. The historical format.
+ * HB_FORMAT_BINARY	: A HBResultHeader_t, then the raw float records,
+ *			  in the host byte order, written in large blocks.
+ *			  'hb2csv' turns it back into the CSV above.
+ *
+ * With '--async-output' records are handed to a writer thread through a
+ * ring, so the simulation only waits for I/O when the ring is full.
+ *
+ * With '--interleave' the simulations of an ensemble share one binary
+ * output, each through a member view (hb_output_member(...)) that tags its
+ * records with the member number, as the first value (HB_COL_MEMBER).
+ * Records of different members come in no particular order.
+ *
+ * A run stopped early, its unhappiness average being stationary (see
+ * converged(...) in heatbugs.h), has its last iteration in the binary
+ * header ('stop_iteration', hb_output_stop(...)). In CSV it's the number
+ * of records less 1, when every iteration is recorded.
+ * */
+enum {
+	HB_FORMAT_CSV = 0,
+	HB_FORMAT_BINARY,
+	HB_FORMATS
+};
+
+
+/** Record columns. */
+enum {
+	HB_COL_UNHAPPINESS = 0,		/* Average unhappiness of the bugs. */
+	HB_COL_MEMBER,			/* Ensemble member, see hb_ensemble.h. */
+	HB_COL_UNHAPPINESS_MIN,		/* Least unhappiness of a bug. */
+	HB_COL_UNHAPPINESS_MAX,		/* Most unhappiness of a bug. */
+	HB_COL_UNHAPPINESS_VAR,		/* Variance of the bugs unhappiness. */
+	HB_COL_HEAT,			/* World heat, bugs' included. */
+	HB_COL_HISTOGRAM,		/* Share of bugs in each unhappiness bin, */
+					/* HB_HIST_BINS columns from this one.    */
+	HB_COLUMNS = HB_COL_HISTOGRAM + HB_HIST_BINS
+};
+
+/* An aggregated statistic's column is its HB_COL_* with the HB_AGG_* bit */
+/* shifted by this, as HB_COL_HEAT | (HB_AGG_MAX << HB_COL_AGG_SHIFT).    */
+#define HB_COL_AGG_SHIFT	8
+#define HB_COL_STAT_MASK	((1u << HB_COL_AGG_SHIFT) - 1)
+
+#define HB_MAX_COLUMNS	16
+
+
+/** Binary results file header. */
+#define HB_RESULT_MAGIC		"HBRESULT"
+#define HB_RESULT_VERSION	3	/* 2: convergence stop, 3: aggregates. */
+#define HB_RESULT_ENDIAN	0x01020304u	/* Reads differently if swapped. */
+
+typedef struct hb_result_header {
+	char magic[ 8 ];		/* HB_RESULT_MAGIC, not '\0' ended.	*/
+	guint32 version;		/* HB_RESULT_VERSION.			*/
+	guint32 header_size;		/* Records start at this offset.	*/
+	guint32 endian;			/* HB_RESULT_ENDIAN, as written.	*/
+	guint32 ncols;			/* Floats per record.			*/
+	guint32 columns[ HB_MAX_COLUMNS ];	/* HB_COL_*, of each value.	*/
+
+	guint64 records;		/* Records written, 0 if unknown.	*/
+
+	/** Simulation parameters. */
+	guint64 num_iterations;
+	guint64 bugs_number;
+	guint64 world_width;
+	guint64 world_height;
+	guint32 seed;
+	float world_diffusion_rate;
+	float world_evaporation_rate;
+	float bugs_random_move_chance;
+	guint32 bugs_temperature_min_ideal;
+	guint32 bugs_temperature_max_ideal;
+	guint32 bugs_heat_min_output;
+	guint32 bugs_heat_max_output;
+	gint32 diffusion;		/* DIFFUSION_*	*/
+	gint32 agents;			/* AGENTS_*	*/
+	gint32 rng;			/* HB_RNG_*	*/
+	guint32 threads;
+
+	/** Convergence stop (version 2 on). */
+	guint64 converge_window;	/* 0 = off.				*/
+	double converge_tolerance;
+	guint64 stop_iteration;		/* Stationary at, 0 = ran to the end.	*/
+
+	/** Records (version 3 on). */
+	guint64 output_every;		/* Iterations between records.		*/
+	guint32 aggregate;		/* HB_AGG_* bits, 0 = none.		*/
+} HBResultHeader_t;
+
+
+typedef struct hb_output HBOutput_t;
+
+
+guint32 hb_output_columns( const Parameters_t *const params );
+
+HBOutput_t *hb_output_open( const Parameters_t *const params,
+				const size_t resume, GError **err );
+
+void hb_output_record( HBOutput_t *const out, const float *const values,
+							GError **err );
+
+void hb_output_stats( HBOutput_t *const out, const HBStats_t *const s,
+							GError **err );
+
+HBOutput_t *hb_output_member( HBOutput_t *const shared, const size_t member,
+								GError **err );
+
+void hb_output_sync( HBOutput_t *const out, GError **err );
+
+void hb_output_stop( HBOutput_t *const out, const size_t iteration );
+
+void hb_output_close( HBOutput_t *out, GError **err );
+
+
+#endif
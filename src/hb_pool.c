@@ -0,0 +1,246 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+#include <stdlib.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_pool.h"
+
+
+
+/** What each worker gets to know at start. */
+typedef struct {
+	HBPool_t *pool;
+	unsigned int thread;	/* Worker's index, 1 .. threads - 1.	     */
+} HBWorker_t;
+
+
+struct hb_pool {
+	GThread **workers;	/* SIZE: threads - 1 (caller is thread 0).   */
+	HBWorker_t *worker_ids;	/* SIZE: threads - 1.			     */
+	unsigned int threads;	/* Total threads, caller included.	     */
+
+	GMutex lock;
+	GCond start;		/* Signalled when a new run is posted.	     */
+	GCond done;		/* Signalled when the last worker finishes.  */
+
+	size_t generation;	/* Incremented on each hb_pool_run(...).     */
+	gboolean quit;
+
+	hb_pool_task_fn fn;
+	void *ctx;
+	gint ntasks;
+	gint next_task;		/* Atomic. Next task index to be taken.	     */
+	unsigned int busy;	/* Workers still running the current tasks.  */
+};
+
+
+
+/**
+ * Take task indexes until there are no more left. Called by the workers
+ * and by the thread that posted the run.
+ * */
+static void hb_pool_drain( HBPool_t *const pool, const unsigned int thread )
+{
+	gint task;
+
+	while ((task = g_atomic_int_add( &pool->next_task, 1 )) < pool->ntasks)
+		pool->fn( pool->ctx, (size_t) task, thread );
+
+	return;
+}
+
+
+
+static gpointer hb_pool_worker( gpointer data )
+{
+	HBPool_t *const pool = ((HBWorker_t *) data)->pool;
+	const unsigned int thread = ((HBWorker_t *) data)->thread;
+	size_t seen = 0;
+
+
+	for (;;)
+	{
+		g_mutex_lock( &pool->lock );
+
+		while (!pool->quit && pool->generation == seen)
+			g_cond_wait( &pool->start, &pool->lock );
+
+		if (pool->quit)
+		{
+			g_mutex_unlock( &pool->lock );
+			break;
+		}
+
+		seen = pool->generation;
+		g_mutex_unlock( &pool->lock );
+
+
+		hb_pool_drain( pool, thread );
+
+
+		g_mutex_lock( &pool->lock );
+
+		if (--pool->busy == 0)
+			g_cond_signal( &pool->done );
+
+		g_mutex_unlock( &pool->lock );
+	}
+
+	return NULL;
+}
+
+
+
+/**
+ * Create a pool with 'threads' threads in total. The calling thread counts
+ * as one of them, so only (threads - 1) workers are started.
+ *
+ * @param[in]	threads		- Total number of threads, at least 1.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+HBPool_t *hb_pool_new( const unsigned int threads, GError **err )
+{
+	HBPool_t *pool = NULL;
+
+
+	pool = (HBPool_t *) calloc( 1, sizeof( HBPool_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		pool == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for thread pool." );
+
+	pool->workers = (GThread **) calloc( threads, sizeof( GThread * ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		pool->workers == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for thread pool workers." );
+
+	pool->worker_ids = (HBWorker_t *) calloc( threads, sizeof( HBWorker_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		pool->worker_ids == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for thread pool workers." );
+
+	g_mutex_init( &pool->lock );
+	g_cond_init( &pool->start );
+	g_cond_init( &pool->done );
+
+	pool->threads = 1;
+
+	while (pool->threads < threads)
+	{
+		pool->worker_ids[ pool->threads - 1 ].pool = pool;
+		pool->worker_ids[ pool->threads - 1 ].thread = pool->threads;
+
+		pool->workers[ pool->threads - 1 ] = g_thread_try_new( "hb-worker",
+			hb_pool_worker, &pool->worker_ids[ pool->threads - 1 ], NULL );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			pool->workers[ pool->threads - 1 ] == NULL,
+			HB_THREAD_FAILURE, error_handler,
+			"Unable to start worker thread." );
+
+		pool->threads++;
+	}
+
+	return pool;
+
+
+error_handler:
+	/* If error handler is reached, release whatever was created. */
+
+	hb_pool_free( pool );
+
+	return NULL;
+}
+
+
+
+/**
+ * Run 'fn( ctx, task, thread )' for every task in [0 .. ntasks[, spread over the
+ * pool threads, and return when all tasks are done.
+ * */
+void hb_pool_run( HBPool_t *const pool, hb_pool_task_fn fn, void *ctx,
+						const size_t ntasks )
+{
+	g_mutex_lock( &pool->lock );
+
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->ntasks = (gint) ntasks;
+	g_atomic_int_set( &pool->next_task, 0 );
+	pool->busy = pool->threads - 1;
+	pool->generation++;
+
+	g_cond_broadcast( &pool->start );
+	g_mutex_unlock( &pool->lock );
+
+
+	/* The caller works too. */
+	hb_pool_drain( pool, 0 );
+
+
+	g_mutex_lock( &pool->lock );
+
+	while (pool->busy > 0)
+		g_cond_wait( &pool->done, &pool->lock );
+
+	g_mutex_unlock( &pool->lock );
+
+	return;
+}
+
+
+
+unsigned int hb_pool_threads( const HBPool_t *const pool )
+{
+	return pool ? pool->threads : 1;
+}
+
+
+
+void hb_pool_free( HBPool_t *pool )
+{
+	if (!pool) return;
+
+	if (pool->workers && pool->worker_ids)
+	{
+		g_mutex_lock( &pool->lock );
+		pool->quit = TRUE;
+		g_cond_broadcast( &pool->start );
+		g_mutex_unlock( &pool->lock );
+
+		for (unsigned int w = 0; w + 1 < pool->threads; w++)
+			g_thread_join( pool->workers[ w ] );
+
+		g_cond_clear( &pool->done );
+		g_cond_clear( &pool->start );
+		g_mutex_clear( &pool->lock );
+	}
+
+	free( pool->worker_ids );
+	free( pool->workers );
+
+	free( pool );
+
+	return;
+}
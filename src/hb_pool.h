@@ -0,0 +1,53 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_POOL_H_
+#define __HEATBUGS_CPU_POOL_H_
+
+
+#include <stddef.h>
+
+#include "glib.h"
+
+
+/**
+ * A small persistent worker pool, used to run the same task function over
+ * a range of task indexes (e.g. row bands of the heat map) and wait for all
+ * of them to finish. Threads are created once and reused every iteration,
+ * so the per-call cost is one broadcast plus one wait.
+ * */
+typedef struct hb_pool HBPool_t;
+
+/**
+ * Task function: 'task' is in [0 .. ntasks[ for the current run, and
+ * 'thread' in [0 .. threads[ tells which pool thread is running it (so
+ * tasks can use per thread scratch state). The caller is thread 0.
+ * */
+typedef void (*hb_pool_task_fn)( void *ctx, size_t task, unsigned int thread );
+
+
+HBPool_t *hb_pool_new( const unsigned int threads, GError **err );
+
+void hb_pool_run( HBPool_t *const pool, hb_pool_task_fn fn, void *ctx,
+						const size_t ntasks );
+
+unsigned int hb_pool_threads( const HBPool_t *const pool );
+
+void hb_pool_free( HBPool_t *pool );
+
+
+#endif
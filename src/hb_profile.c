@@ -0,0 +1,220 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+#define _GNU_SOURCE	/* clock_gettime(...) */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_profile.h"
+
+
+
+/** Histogram: values below 8 ns get a bucket each, then 8 per octave. */
+#define SUB_BUCKETS	8
+#define SUB_BITS	3
+#define BUCKETS		(SUB_BUCKETS * (64 - SUB_BITS + 1))
+
+
+typedef struct {
+	guint64 count;
+	guint64 total;		/* ns */
+	guint64 min;		/* ns */
+	guint64 max;		/* ns */
+	guint64 hist[ BUCKETS ];
+} HBPhase_t;
+
+
+struct hb_profile {
+	guint64 last;		/* ns, time of the last lap or mark. */
+	HBPhase_t phases[ HB_PHASES ];
+};
+
+
+static const char *const phase_names[ HB_PHASES ] = {
+	"diffusion", "shuffle", "movement", "stats", "output", "snapshot",
+	"checkpoint"
+};
+
+
+
+/** Monotonic clock, in ns. */
+static inline guint64 now_ns( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (guint64) ts.tv_sec * 1000000000u + (guint64) ts.tv_nsec;
+}
+
+
+
+/** Histogram bucket of 'ns', and back from a bucket to its lowest value. */
+
+static inline size_t bucket_of( const guint64 ns )
+{
+	guint exp;
+
+
+	if (ns < SUB_BUCKETS) return (size_t) ns;
+
+	exp = g_bit_storage( ns ) - 1;		/* floor( log2( ns ) ), >= 3 */
+
+	return SUB_BUCKETS * (exp - SUB_BITS + 1)
+		+ (size_t) ((ns >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static inline guint64 bucket_low( const size_t bucket )
+{
+	const guint exp = bucket / SUB_BUCKETS + SUB_BITS - 1;
+
+
+	if (bucket < SUB_BUCKETS) return bucket;
+
+	return (guint64) (SUB_BUCKETS + bucket % SUB_BUCKETS) << (exp - SUB_BITS);
+}
+
+
+
+/**
+ * Value under which a fraction 'q' of the samples of 'phase' fall, as the
+ * middle of its histogram bucket, kept within the exact min and max.
+ * */
+static guint64 percentile( const HBPhase_t *const phase, const double q )
+{
+	const guint64 rank = MAX( (guint64) (q * phase->count + 0.5), 1 );
+	guint64 seen = 0;
+	size_t b;
+
+
+	for (b = 0; b < BUCKETS - 1; b++)
+	{
+		seen += phase->hist[ b ];
+		if (seen >= rank) break;
+	}
+
+	return CLAMP( (bucket_low( b ) + bucket_low( b + 1 )) / 2,
+						phase->min, phase->max );
+}
+
+
+
+HBProfile_t *hb_profile_new( GError **err )
+{
+	HBProfile_t *prof = NULL;
+
+
+	prof = (HBProfile_t *) calloc( 1, sizeof( HBProfile_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		prof == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for profile." );
+
+	for (int p = 0; p < HB_PHASES; p++)
+		prof->phases[ p ].min = G_MAXUINT64;
+
+	hb_profile_mark( prof );
+
+
+error_handler:
+
+	return prof;
+}
+
+
+
+/** Start timing from now, e.g. before the simulation loop. */
+void hb_profile_mark( HBProfile_t *const prof )
+{
+	if (prof) prof->last = now_ns();
+}
+
+
+
+void hb_profile_record( HBProfile_t *const prof, const int phase )
+{
+	HBPhase_t *const ph = &prof->phases[ phase ];
+	const guint64 now = now_ns();
+	const guint64 ns = now - prof->last;
+
+
+	ph->count++;
+	ph->total += ns;
+	ph->min = MIN( ph->min, ns );
+	ph->max = MAX( ph->max, ns );
+	ph->hist[ bucket_of( ns ) ]++;
+
+	prof->last = now;
+
+	return;
+}
+
+
+
+/**
+ * Print, for each phase: total time, its share of the loop, per iteration
+ * mean, p50 and p99.
+ * */
+void hb_profile_report( const HBProfile_t *const prof, FILE *out )
+{
+	guint64 all = 0;
+
+
+	if (!prof) return;
+
+	for (int p = 0; p < HB_PHASES; p++)
+		all += prof->phases[ p ].total;
+
+	fprintf( out, "\nProfile, %" G_GUINT64_FORMAT " iterations:\n\n",
+					prof->phases[ HB_PHASE_DIFFUSION ].count );
+	fprintf( out, "%-10s %12s %7s %12s %12s %12s\n", "phase",
+			"total (s)", "share", "mean (us)", "p50 (us)", "p99 (us)" );
+
+	for (int p = 0; p < HB_PHASES; p++)
+	{
+		const HBPhase_t *const ph = &prof->phases[ p ];
+
+		if (ph->count == 0)
+		{
+			fprintf( out, "%-10s %12s\n", phase_names[ p ], "-" );
+			continue;
+		}
+
+		fprintf( out, "%-10s %12.6f %6.2f%% %12.3f %12.3f %12.3f\n",
+			phase_names[ p ], ph->total / 1e9,
+			all ? 100.0 * ph->total / all : 0.0,
+			ph->total / 1e3 / ph->count,
+			percentile( ph, 0.50 ) / 1e3, percentile( ph, 0.99 ) / 1e3 );
+	}
+
+	fprintf( out, "%-10s %12.6f\n\n", "total", all / 1e9 );
+
+	return;
+}
+
+
+
+void hb_profile_free( HBProfile_t *prof )
+{
+	if (prof) free( prof );
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_PROFILE_H_
+#define __HEATBUGS_CPU_PROFILE_H_
+
+
+#include <stdio.h>
+
+#include "glib.h"
+
+
+/**
+ * Per phase timings of the simulation loop ('--profile').
+ *
+ * The loop calls hb_profile_lap(...) at the end of each phase: the time
+ * since the previous lap is charged to that phase. Each sample goes to the
+ * phase total and to a log scale histogram (8 buckets per power of two, so
+ * percentiles are within 12.5%), which keeps memory fixed however long the
+ * simulation runs. All calls do nothing when the profile is NULL.
+ * */
+enum {
+	HB_PHASE_DIFFUSION = 0,
+	HB_PHASE_SHUFFLE,
+	HB_PHASE_MOVEMENT,
+	HB_PHASE_STATS,
+	HB_PHASE_OUTPUT,
+	HB_PHASE_SNAPSHOT,
+	HB_PHASE_CHECKPOINT,
+	HB_PHASES
+};
+
+typedef struct hb_profile HBProfile_t;
+
+
+HBProfile_t *hb_profile_new( GError **err );
+
+void hb_profile_mark( HBProfile_t *const prof );
+
+void hb_profile_record( HBProfile_t *const prof, const int phase );
+
+void hb_profile_report( const HBProfile_t *const prof, FILE *out );
+
+void hb_profile_free( HBProfile_t *prof );
+
+
+/** End of 'phase': charge it the time since the last lap (or mark). */
+static inline void hb_profile_lap( HBProfile_t *const prof, const int phase )
+{
+	if (prof) hb_profile_record( prof, phase );
+}
+
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_RNG_H_
+#define __HEATBUGS_CPU_RNG_H_
+
+
+#include "glib.h"
+
+
+/**
+ * Pluggable random number layer.
+ *
+ * HB_RNG_GLIB	 : GLib's generator (Mersenne Twister). One sequential
+ *		   stream: numbers depend on everything drawn before, so it
+ *		   is only usable by one thread, in a fixed order. With a NULL
+ *		   'grand', GLib's global generator is used, which reproduces
+ *		   the historical results for a given seed.
+ * HB_RNG_PHILOX : Philox4x32-10 counter-based generator (Salmon et al.,
+ *		   "Parallel random numbers: as easy as 1, 2, 3", SC'11). A
+ *		   number is a pure function of (key, counter), so each
+ *		   (purpose, iteration, id) names its own stream, e.g. one per
+ *		   bug per iteration. Any thread can draw a bug's numbers with
+ *		   no shared state, and results do not depend on scheduling.
+ * */
+enum {
+	HB_RNG_GLIB = 0,
+	HB_RNG_PHILOX,
+	HB_RNG_KINDS
+};
+
+
+/** What a stream is used for. Keeps streams of different uses apart. */
+enum {
+	HB_STREAM_INIT = 1,	/* id = bug:  bug creation in initiate(...).   */
+	HB_STREAM_SHUFFLE,	/* id = 0:    order bugs move in.	       */
+	HB_STREAM_BUG,		/* id = bug:  one bug's choices in one step.   */
+	HB_STREAM_TILE,		/* id = tile: checkerboard tile bugs order.    */
+	HB_STREAM_COLOURS	/* id = 0:    checkerboard colours order.      */
+};
+
+
+typedef struct hb_rng {
+	int kind;		/* HB_RNG_*.				       */
+	GRand *grand;		/* HB_RNG_GLIB: NULL = GLib's global one.      */
+	guint32 key[ 2 ];	/* HB_RNG_PHILOX: derived from the seed.       */
+	guint32 ctr[ 4 ];	/* HB_RNG_PHILOX: { block, id, iteration,      */
+				/*   purpose << 24 | iteration >> 32 }.	       */
+	guint32 out[ 4 ];	/* HB_RNG_PHILOX: last block of numbers.       */
+	unsigned int used;	/* HB_RNG_PHILOX: numbers used from 'out'.     */
+} HBRng_t;
+
+
+
+/** Philox4x32 constants. */
+#define PHILOX_M0	0xD2511F53u
+#define PHILOX_M1	0xCD9E8D57u
+#define PHILOX_W0	0x9E3779B9u
+#define PHILOX_W1	0xBB67AE85u
+#define PHILOX_ROUNDS	10
+
+
+
+/**
+ * Philox4x32-10 block function: 4 random words from a counter and a key.
+ * */
+static inline void hb_philox4x32( const guint32 ctr[ 4 ],
+				const guint32 key[ 2 ], guint32 out[ 4 ] )
+{
+	guint32 c0 = ctr[ 0 ], c1 = ctr[ 1 ], c2 = ctr[ 2 ], c3 = ctr[ 3 ];
+	guint32 k0 = key[ 0 ], k1 = key[ 1 ];
+
+
+	for (unsigned int round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		const guint64 p0 = (guint64) PHILOX_M0 * c0;
+		const guint64 p1 = (guint64) PHILOX_M1 * c2;
+
+		c0 = (guint32) (p1 >> 32) ^ c1 ^ k0;
+		c2 = (guint32) (p0 >> 32) ^ c3 ^ k1;
+		c1 = (guint32) p1;
+		c3 = (guint32) p0;
+
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	out[ 0 ] = c0;
+	out[ 1 ] = c1;
+	out[ 2 ] = c2;
+	out[ 3 ] = c3;
+
+	return;
+}
+
+
+
+/**
+ * Setup a generator of the given kind. For HB_RNG_GLIB, 'grand' is the
+ * GLib generator to draw from (NULL for the global one, already seeded
+ * with g_random_set_seed(...)).
+ * */
+static inline void hb_rng_init( HBRng_t *const rng, const int kind,
+				const guint32 seed, GRand *const grand )
+{
+	rng->kind = kind;
+	rng->grand = grand;
+
+	rng->key[ 0 ] = seed;
+	rng->key[ 1 ] = 0x48426267u;	/* "HBbg" */
+
+	rng->ctr[ 0 ] = rng->ctr[ 1 ] = rng->ctr[ 2 ] = rng->ctr[ 3 ] = 0;
+	rng->used = 4;
+
+	return;
+}
+
+
+
+/**
+ * Position the generator at the start of the stream named by (purpose,
+ * iteration, id). Cheap for HB_RNG_PHILOX. A no-op for HB_RNG_GLIB, which
+ * only has its one sequential stream.
+ * */
+static inline void hb_rng_stream( HBRng_t *const rng, const guint32 purpose,
+				const guint64 iteration, const guint32 id )
+{
+	if (rng->kind != HB_RNG_PHILOX) return;
+
+	rng->ctr[ 0 ] = 0;
+	rng->ctr[ 1 ] = id;
+	rng->ctr[ 2 ] = (guint32) iteration;
+	rng->ctr[ 3 ] = (purpose << 24) | ((guint32) (iteration >> 32) & 0x00ffffffu);
+	rng->used = 4;
+
+	return;
+}
+
+
+
+/** Next 32 random bits. */
+static inline guint32 hb_rng_uint32( HBRng_t *const rng )
+{
+	if (rng->kind != HB_RNG_PHILOX)
+		return rng->grand ? g_rand_int( rng->grand ) : g_random_int();
+
+	if (rng->used == 4)
+	{
+		hb_philox4x32( rng->ctr, rng->key, rng->out );
+		rng->ctr[ 0 ]++;
+		rng->used = 0;
+	}
+
+	return rng->out[ rng->used++ ];
+}
+
+
+
+/** Random integer in [begin .. end[, as g_random_int_range(...). */
+static inline gint32 hb_rng_int_range( HBRng_t *const rng,
+				const gint32 begin, const gint32 end )
+{
+	guint32 range, threshold;
+	guint64 m;
+
+
+	if (rng->kind != HB_RNG_PHILOX)
+		return rng->grand ? g_rand_int_range( rng->grand, begin, end )
+				: g_random_int_range( begin, end );
+
+	/* Lemire's multiply and shift, with rejection to remove the bias. */
+	range = (guint32) (end - begin);
+	m = (guint64) hb_rng_uint32( rng ) * range;
+
+	if ((guint32) m < range)
+	{
+		threshold = -range % range;
+
+		while ((guint32) m < threshold)
+			m = (guint64) hb_rng_uint32( rng ) * range;
+	}
+
+	return begin + (gint32) (m >> 32);
+}
+
+
+
+/**
+ * Random integer in [begin .. end[, for ranges past a gint32 too (world
+ * positions). Those that fit are drawn as hb_rng_int_range(...) does.
+ * */
+static inline guint64 hb_rng_uint64_range( HBRng_t *const rng,
+				const guint64 begin, const guint64 end )
+{
+	const guint64 range = end - begin;
+	guint64 mask, r;
+
+
+	if (end <= G_MAXINT32)
+		return (guint64) hb_rng_int_range( rng, (gint32) begin, (gint32) end );
+
+	/* 64 random bits, masked to the range's bits and rejected over it. */
+	mask = range - 1;
+	mask |= mask >> 1;
+	mask |= mask >> 2;
+	mask |= mask >> 4;
+	mask |= mask >> 8;
+	mask |= mask >> 16;
+	mask |= mask >> 32;
+
+	do
+	{
+		r = (guint64) hb_rng_uint32( rng ) << 32;
+		r |= hb_rng_uint32( rng );
+		r &= mask;
+	} while (r >= range);
+
+	return begin + r;
+}
+
+
+
+/** Random double in [begin .. end[, as g_random_double_range(...). */
+static inline gdouble hb_rng_double_range( HBRng_t *const rng,
+				const gdouble begin, const gdouble end )
+{
+	gdouble unit;
+
+
+	if (rng->kind != HB_RNG_PHILOX)
+		return rng->grand ? g_rand_double_range( rng->grand, begin, end )
+				: g_random_double_range( begin, end );
+
+	/* 53 random bits, as GLib does. */
+	unit = (hb_rng_uint32( rng ) >> 5) * 67108864.0;
+	unit = (unit + (hb_rng_uint32( rng ) >> 6)) * (1.0 / 9007199254740992.0);
+
+	return begin + unit * (end - begin);
+}
+
+
+#endif
@@ -0,0 +1,662 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+#define _GNU_SOURCE	/* fileno(...), fsync(...) and ftruncate(...) are POSIX. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_output.h"
+#include "hb_snapshot.h"
+
+
+
+/** Frames the simulation can be ahead of the snapshot writer. */
+#define SNAPSHOT_SLOTS	2
+
+/** Index entries allocated at a time. */
+#define INDEX_CHUNK	1024
+
+
+/** A frame waiting to be written, as copied from the world. */
+typedef struct {
+	guint32 *heat;		/* SIZE: WORLD_SIZE	- The heat map bits.	     */
+	guint32 *positions;	/* SIZE: POS_WORDS	- swarm_map as a bitmap.     */
+	guint64 iteration;
+} HBSnapSlot_t;
+
+
+struct hb_snapshots {
+	FILE *file;
+	HBFrameHeader_t header;
+	size_t heat_words;	/* world_size.				     */
+	size_t pos_words;	/* world_size / 32, rounded up.		     */
+	size_t heat_stride;	/* As the parameters', for HEAT_CELL.	     */
+	gboolean resumed;	/* Frames up to 'resumed_at' are in the file. */
+	guint64 resumed_at;
+
+	/** Shared with the writer thread, under 'lock'. */
+	HBSnapSlot_t slots[ SNAPSHOT_SLOTS ];
+	guint64 filled;		/* Slots filled by the simulation.	     */
+	guint64 taken;		/* Slots written by the writer thread.	     */
+	gboolean quit;
+	GMutex lock;
+	GCond ready;		/* Signalled when a slot is filled.	     */
+	GCond done;		/* Signalled when a slot is written.	     */
+	GThread *writer;
+	gint failed;		/* Atomic. The writer hit an error.	     */
+	GError *write_err;	/* Writer thread's error, once 'failed'.     */
+
+	/** Writer thread's own. */
+	guint32 *prev_heat;	/* SIZE: WORLD_SIZE	- Previous frame.	     */
+	guint32 *prev_positions;/* SIZE: POS_WORDS	- Previous frame.	     */
+	guint8 *planes;		/* SIZE: 4 * WORLD_SIZE	- 'delta' bytes, by plane.   */
+	Bytef *zbuf;		/* Compressed heat, then positions.	     */
+	uLong zbuf_size;
+	guint64 offset;		/* Where the next frame goes in the file.    */
+	HBFrameIndex_t *index;
+	size_t index_size;	/* Entries allocated.			     */
+	gboolean key_next;	/* Next frame is a key one (after a restart). */
+};
+
+
+
+/** Add a frame to the index, as the next one ('header.frames'). */
+static void index_add( HBSnapshots_t *const snaps, const guint64 iteration,
+				const guint64 offset, const guint32 flags, GError **err )
+{
+	if (snaps->header.frames == snaps->index_size)
+	{
+		HBFrameIndex_t *index = (HBFrameIndex_t *) realloc( snaps->index,
+			(snaps->index_size + INDEX_CHUNK) * sizeof( HBFrameIndex_t ) );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			index == NULL,
+			HB_MALLOC_FAILURE, error_handler,
+			"Unable to allocate memory for snapshot index." );
+
+		snaps->index = index;
+		snaps->index_size += INDEX_CHUNK;
+	}
+
+	snaps->index[ snaps->header.frames ].iteration = iteration;
+	snaps->index[ snaps->header.frames ].offset = offset;
+	snaps->index[ snaps->header.frames ].flags = flags;
+	snaps->index[ snaps->header.frames ].reserved = 0;
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Compress 'words' words of 'data' into 'dst', XORed with 'prev' unless
+ * 'key'. Then keep 'data' in 'prev', for the next frame.
+ *
+ * Before compression the words are split in byte planes (all the first
+ * bytes, then all the second bytes, ...): the sign, exponent and high
+ * mantissa bytes of the heat barely change and compress well, while the
+ * low mantissa bytes are noise, best kept apart.
+ * */
+static uLong encode( HBSnapshots_t *const snaps, const guint32 *const data,
+		guint32 *const prev, const size_t words, const gboolean key,
+				Bytef *const dst, const uLong dst_size, GError **err )
+{
+	guint8 *const planes = snaps->planes;
+	uLongf len = dst_size;
+	int zerr;
+
+
+	for (size_t w = 0; w < words; w++)
+	{
+		const guint32 word = key ? data[ w ] : data[ w ] ^ prev[ w ];
+
+		planes[ w ] = (guint8) word;
+		planes[ words + w ] = (guint8) (word >> 8);
+		planes[ 2 * words + w ] = (guint8) (word >> 16);
+		planes[ 3 * words + w ] = (guint8) (word >> 24);
+	}
+
+	zerr = compress2( dst, &len, planes, words * sizeof( guint32 ),
+							Z_BEST_SPEED );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		zerr != Z_OK,
+		HB_SNAPSHOT_FAILURE, error_handler,
+		"Could not compress snapshot (zlib error %d).", zerr );
+
+	memcpy( prev, data, words * sizeof( guint32 ) );
+
+	return len;
+
+
+error_handler:
+
+	return 0;
+}
+
+
+
+/** Encode and write one frame, and add it to the index. */
+static void frame_write( HBSnapshots_t *const snaps, const HBSnapSlot_t *const slot,
+							GError **err )
+{
+	GError *err_frame = NULL;
+	HBFrame_t frame;
+	size_t wr;
+
+
+	memset( &frame, 0, sizeof( HBFrame_t ) );
+
+	frame.iteration = slot->iteration;
+	frame.flags = ((snaps->header.frames % HB_FRAME_KEY_EVERY == 0)
+				|| snaps->key_next) ? HB_FRAME_KEY : 0;
+	snaps->key_next = FALSE;
+
+	frame.heat_size = encode( snaps, slot->heat, snaps->prev_heat,
+				snaps->heat_words, frame.flags & HB_FRAME_KEY,
+				snaps->zbuf, snaps->zbuf_size, &err_frame );
+	hb_if_err_propagate_goto( err, err_frame, error_handler );
+
+	frame.positions_size = encode( snaps, slot->positions,
+				snaps->prev_positions, snaps->pos_words,
+				frame.flags & HB_FRAME_KEY,
+				snaps->zbuf + frame.heat_size,
+				snaps->zbuf_size - frame.heat_size, &err_frame );
+	hb_if_err_propagate_goto( err, err_frame, error_handler );
+
+
+	/* Index entry first: a frame is only written if it can be found. */
+	index_add( snaps, frame.iteration, snaps->offset, frame.flags, &err_frame );
+	hb_if_err_propagate_goto( err, err_frame, error_handler );
+
+
+	wr = fwrite( &frame, sizeof( HBFrame_t ), 1, snaps->file );
+	if (wr == 1)
+		wr = fwrite( snaps->zbuf, frame.heat_size + frame.positions_size,
+							1, snaps->file );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		wr != 1,
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to snapshot file." );
+
+	snaps->offset += sizeof( HBFrame_t ) + frame.heat_size
+						+ frame.positions_size;
+	snaps->header.frames++;
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Writer thread: write frames as the simulation fills the slots, until
+ * told to quit and none is left. After an error it keeps emptying slots,
+ * so the simulation never waits forever.
+ * */
+static gpointer snapshot_writer( gpointer data )
+{
+	HBSnapshots_t *const snaps = (HBSnapshots_t *) data;
+	HBSnapSlot_t *slot;
+
+
+	for (;;)
+	{
+		g_mutex_lock( &snaps->lock );
+
+		while ((snaps->taken == snaps->filled) && !snaps->quit)
+			g_cond_wait( &snaps->ready, &snaps->lock );
+
+		if (snaps->taken == snaps->filled)
+		{
+			g_mutex_unlock( &snaps->lock );
+			break;
+		}
+
+		slot = &snaps->slots[ snaps->taken % SNAPSHOT_SLOTS ];
+		g_mutex_unlock( &snaps->lock );
+
+
+		if (!g_atomic_int_get( &snaps->failed ))
+		{
+			frame_write( snaps, slot, &snaps->write_err );
+
+			if (snaps->write_err)
+				g_atomic_int_set( &snaps->failed, 1 );
+		}
+
+
+		g_mutex_lock( &snaps->lock );
+		snaps->taken++;
+		g_cond_signal( &snaps->done );
+		g_mutex_unlock( &snaps->lock );
+	}
+
+	return NULL;
+}
+
+
+
+/**
+ * Release everything, the writer thread must be already stopped.
+ * */
+static void snapshots_free( HBSnapshots_t *snaps )
+{
+	for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+	{
+		if (snaps->slots[ s ].heat) free( snaps->slots[ s ].heat );
+		if (snaps->slots[ s ].positions) free( snaps->slots[ s ].positions );
+	}
+
+	if (snaps->prev_heat) free( snaps->prev_heat );
+	if (snaps->prev_positions) free( snaps->prev_positions );
+	if (snaps->planes) free( snaps->planes );
+	if (snaps->zbuf) free( snaps->zbuf );
+	if (snaps->index) free( snaps->index );
+	if (snaps->write_err) g_error_free( snaps->write_err );
+	if (snaps->file) fclose( snaps->file );
+
+	free( snaps );
+
+	return;
+}
+
+
+
+/**
+ * Reopen the frame file of a restart, continued after the checkpoint's
+ * 'mark': its frames are indexed again, later ones cut off. Until closed
+ * the header says, as for a new file, that frames and index are unknown.
+ * */
+static void snapshots_resume( HBSnapshots_t *const snaps,
+		const Parameters_t *const params,
+		const HBSnapshotMark_t *const mark, GError **err )
+{
+	GError *err_resume = NULL;
+	HBFrameHeader_t header;
+	HBFrame_t frame;
+	guint64 offset = sizeof( HBFrameHeader_t );
+	gboolean ok;
+
+
+	snaps->file = fopen( params->snapshot_filename, "r+b" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		snaps->file == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open snapshot file." );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(fread( &header, sizeof( HBFrameHeader_t ), 1, snaps->file ) != 1)
+		|| memcmp( header.magic, HB_FRAME_MAGIC, sizeof( header.magic ) )
+		|| (header.version != HB_FRAME_VERSION)
+		|| (header.endian != HB_RESULT_ENDIAN)
+		|| (header.world_width != snaps->header.world_width)
+		|| (header.world_height != snaps->header.world_height)
+		|| (header.bugs_number != snaps->header.bugs_number)
+		|| (header.every != snaps->header.every)
+		|| (header.seed != snaps->header.seed),
+		HB_CHECKPOINT_INVALID, error_handler,
+		"Snapshot file doesn't match the checkpoint." );
+
+	for (guint64 f = 0; f < mark->frames; f++)
+	{
+		ok = (fseek( snaps->file, (long) offset, SEEK_SET ) == 0)
+			&& (fread( &frame, sizeof( HBFrame_t ), 1, snaps->file ) == 1);
+		hb_if_err_create_goto( *err, HB_ERROR,
+			!ok,
+			HB_CHECKPOINT_INVALID, error_handler,
+			"Snapshot file has fewer frames than the checkpoint." );
+
+		index_add( snaps, frame.iteration, offset, frame.flags, &err_resume );
+		hb_if_err_propagate_goto( err, err_resume, error_handler );
+
+		snaps->header.frames++;
+		snaps->resumed_at = frame.iteration;
+		offset += sizeof( HBFrame_t ) + frame.heat_size + frame.positions_size;
+	}
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		offset != mark->offset,
+		HB_CHECKPOINT_INVALID, error_handler,
+		"Snapshot file doesn't match the checkpoint." );
+
+	header = snaps->header;
+	header.frames = 0;
+
+	ok = (fseek( snaps->file, 0, SEEK_SET ) == 0)
+		&& (fwrite( &header, sizeof( HBFrameHeader_t ), 1,
+							snaps->file ) == 1)
+		&& (fflush( snaps->file ) == 0)
+		&& (ftruncate( fileno( snaps->file ), (off_t) offset ) == 0)
+		&& (fseek( snaps->file, (long) offset, SEEK_SET ) == 0);
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!ok,
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to snapshot file." );
+
+	snaps->offset = offset;
+	snaps->resumed = TRUE;
+	snaps->key_next = TRUE;
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Open 'params->snapshot_filename' and start the snapshot writer thread.
+ * A restart ('resume', from its checkpoint) continues the frames written
+ * up to the checkpoint, if any. Otherwise it starts a new file, but won't
+ * overwrite one: the frames before the checkpoint would be lost.
+ * */
+HBSnapshots_t *hb_snapshots_open( const Parameters_t *const params,
+			const HBSnapshotMark_t *const resume, GError **err )
+{
+	GError *err_open = NULL;
+	HBSnapshots_t *snaps = NULL;
+	gboolean failed = FALSE;
+	size_t wr;
+
+
+	snaps = (HBSnapshots_t *) calloc( 1, sizeof( HBSnapshots_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		snaps == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for snapshots." );
+
+	snaps->heat_words = params->world_size;
+	snaps->pos_words = (params->world_size + 31) / 32;
+	snaps->heat_stride = params->heat_stride;
+
+	for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+	{
+		snaps->slots[ s ].heat = (guint32 *) malloc(
+				snaps->heat_words * sizeof( guint32 ) );
+		snaps->slots[ s ].positions = (guint32 *) malloc(
+				snaps->pos_words * sizeof( guint32 ) );
+
+		failed |= !snaps->slots[ s ].heat || !snaps->slots[ s ].positions;
+	}
+
+	snaps->prev_heat = (guint32 *) malloc( snaps->heat_words * sizeof( guint32 ) );
+	snaps->prev_positions = (guint32 *) malloc( snaps->pos_words * sizeof( guint32 ) );
+	snaps->planes = (guint8 *) malloc( snaps->heat_words * sizeof( guint32 ) );
+
+	snaps->zbuf_size = compressBound( snaps->heat_words * sizeof( guint32 ) )
+			+ compressBound( snaps->pos_words * sizeof( guint32 ) );
+	snaps->zbuf = (Bytef *) malloc( snaps->zbuf_size );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		failed || !snaps->prev_heat || !snaps->prev_positions
+		|| !snaps->planes || !snaps->zbuf,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for snapshots." );
+
+
+	/* File header, frames and index are set on close. */
+	memcpy( snaps->header.magic, HB_FRAME_MAGIC, sizeof( snaps->header.magic ) );
+	snaps->header.version = HB_FRAME_VERSION;
+	snaps->header.endian = HB_RESULT_ENDIAN;
+	snaps->header.world_width = params->world_width;
+	snaps->header.world_height = params->world_height;
+	snaps->header.bugs_number = params->bugs_number;
+	snaps->header.every = params->snapshot_every;
+	snaps->header.seed = params->seed;
+	snaps->header.key_every = HB_FRAME_KEY_EVERY;
+
+	if (resume && (resume->frames > 0))
+	{
+		snapshots_resume( snaps, params, resume, &err_open );
+		hb_if_err_propagate_goto( err, err_open, error_handler );
+	}
+	else
+	{
+		hb_if_err_create_goto( *err, HB_ERROR,
+			resume && (access( params->snapshot_filename, F_OK ) == 0),
+			HB_CHECKPOINT_INVALID, error_handler,
+			"The checkpoint has no snapshots to continue, and snapshot "
+			"file '%s' already exists.", params->snapshot_filename );
+
+		snaps->file = fopen( params->snapshot_filename, "wb" );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			snaps->file == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open snapshot file." );
+
+		wr = fwrite( &snaps->header, sizeof( HBFrameHeader_t ), 1, snaps->file );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			wr != 1,
+			HB_OUTPUT_WRITE_FAILURE, error_handler,
+			"Could not write to snapshot file." );
+
+		snaps->offset = sizeof( HBFrameHeader_t );
+	}
+
+
+	/* Writer thread, last: nothing can fail after it's started. */
+	g_mutex_init( &snaps->lock );
+	g_cond_init( &snaps->ready );
+	g_cond_init( &snaps->done );
+
+	snaps->writer = g_thread_try_new( "hb-snapshots", snapshot_writer,
+								snaps, NULL );
+	if (snaps->writer == NULL)
+	{
+		g_cond_clear( &snaps->done );
+		g_cond_clear( &snaps->ready );
+		g_mutex_clear( &snaps->lock );
+	}
+	hb_if_err_create_goto( *err, HB_ERROR,
+		snaps->writer == NULL,
+		HB_THREAD_FAILURE, error_handler,
+		"Unable to start snapshot thread." );
+
+	return snaps;
+
+
+error_handler:
+	/* If error handler is reached, release whatever was created. */
+
+	if (snaps) snapshots_free( snaps );
+
+	return NULL;
+}
+
+
+
+/**
+ * Queue a frame of the world as it is at 'iteration'. Only copies the
+ * heat map and the bugs positions, waiting if both slots are still being
+ * written. A write error of the writer thread is reported by the next call.
+ * Iterations a restarted file already has a frame of are skipped.
+ * */
+void hb_snapshots_take( HBSnapshots_t *const snaps, const hb_heat_t *const heat_map,
+		const hb_map_t *const swarm_map, const size_t iteration,
+							GError **err )
+{
+	HBSnapSlot_t *slot;
+	size_t cell = 0;
+
+
+	if (g_atomic_int_get( &snaps->failed ))
+	{
+		hb_if_err_propagate_goto( err, snaps->write_err, error_handler );
+	}
+
+	if (snaps->resumed && (iteration <= snaps->resumed_at)) return;
+
+	g_mutex_lock( &snaps->lock );
+
+	while (snaps->filled - snaps->taken == SNAPSHOT_SLOTS)
+		g_cond_wait( &snaps->done, &snaps->lock );
+
+	slot = &snaps->slots[ snaps->filled % SNAPSHOT_SLOTS ];
+
+	g_mutex_unlock( &snaps->lock );
+
+
+	/* The world's cells, row by row, without the ghost border. */
+	for (size_t row = 0; row < snaps->header.world_height; row++)
+	{
+		const hb_heat_t *const line = heat_map + HEAT_CELL( snaps, row, 0 );
+		guint32 *const out = slot->heat + row * snaps->header.world_width;
+
+#ifdef HB_HEAT_16
+		/* Frames keep float heat, whatever the cells. */
+		for (size_t c = 0; c < snaps->header.world_width; c++)
+		{
+			const float heat = heat_get( line[ c ] );
+
+			memcpy( &out[ c ], &heat, sizeof( guint32 ) );
+		}
+#else
+		memcpy( out, line, snaps->header.world_width * sizeof( guint32 ) );
+#endif
+	}
+
+#ifdef HB_SWARM_BITMAP
+	/* The swarm_map is already the positions bitmap. */
+	(void) cell;
+	memcpy( slot->positions, swarm_map, snaps->pos_words * sizeof( guint32 ) );
+#else
+	for (size_t w = 0; w < snaps->pos_words; w++)
+	{
+		guint32 word = 0;
+
+		for (guint32 bit = 0; (bit < 32) && (cell < snaps->heat_words); bit++, cell++)
+			word |= (guint32) HAS_BUG( swarm_map[ cell ] ) << bit;
+
+		slot->positions[ w ] = word;
+	}
+#endif
+
+	slot->iteration = iteration;
+
+
+	g_mutex_lock( &snaps->lock );
+	snaps->filled++;
+	g_cond_signal( &snaps->ready );
+	g_mutex_unlock( &snaps->lock );
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Wait until every frame queued is written, make sure they're on disk
+ * (e.g. before a checkpoint claims they are), and tell where they stand.
+ * */
+void hb_snapshots_sync( HBSnapshots_t *const snaps,
+			HBSnapshotMark_t *const mark, GError **err )
+{
+	g_mutex_lock( &snaps->lock );
+
+	while (snaps->taken != snaps->filled)
+		g_cond_wait( &snaps->done, &snaps->lock );
+
+	g_mutex_unlock( &snaps->lock );
+
+	/* The writer is idle until the next frame: the file is ours. */
+	if (g_atomic_int_get( &snaps->failed ))
+	{
+		hb_if_err_propagate_goto( err, snaps->write_err, error_handler );
+	}
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(fflush( snaps->file ) != 0) || (fsync( fileno( snaps->file ) ) != 0),
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to snapshot file." );
+
+	mark->frames = snaps->header.frames;
+	mark->offset = snaps->offset;
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Write the frames still queued, then the index, complete the header and
+ * close. Safe to call with NULL snapshots, or after a write error.
+ * */
+void hb_snapshots_close( HBSnapshots_t *snaps, GError **err )
+{
+	size_t wr;
+
+
+	if (!snaps) return;
+
+	g_mutex_lock( &snaps->lock );
+	snaps->quit = TRUE;
+	g_cond_signal( &snaps->ready );
+	g_mutex_unlock( &snaps->lock );
+
+	g_thread_join( snaps->writer );
+
+	g_cond_clear( &snaps->done );
+	g_cond_clear( &snaps->ready );
+	g_mutex_clear( &snaps->lock );
+
+	hb_if_err_propagate_goto( err, snaps->write_err, error_handler );
+
+
+	snaps->header.index_offset = snaps->offset;
+
+	wr = (snaps->header.frames == 0) ? 1 : fwrite( snaps->index,
+		snaps->header.frames * sizeof( HBFrameIndex_t ), 1, snaps->file );
+
+	if ((wr == 1) && (fseek( snaps->file, 0, SEEK_SET ) == 0))
+		wr = fwrite( &snaps->header, sizeof( HBFrameHeader_t ), 1, snaps->file );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		wr != 1,
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to snapshot file." );
+
+
+error_handler:
+
+	if (fclose( snaps->file ) != 0 && *err == NULL)
+		g_set_error( err, HB_ERROR, HB_OUTPUT_WRITE_FAILURE,
+					"Could not write to snapshot file." );
+	snaps->file = NULL;
+
+	snapshots_free( snaps );
+
+	return;
+}
@@ -0,0 +1,124 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_SNAPSHOT_H_
+#define __HEATBUGS_CPU_SNAPSHOT_H_
+
+
+#include "glib.h"
+
+#include "heatbugs.h"
+
+
+/**
+ * World snapshots ('--snapshot-every K'): every K iterations (and for the
+ * initial state) the heat map and the bugs positions are written, as one
+ * compressed frame, to a frame file.
+ *
+ * The simulation thread only copies the world into a free frame buffer;
+ * encoding, compression and writing happen in a thread of their own.
+ *
+ * Frame file layout, all in the host byte order:
+ *
+ *	HBFrameHeader_t
+ *	frame 0: HBFrame_t, heat data, positions data
+ *	frame 1: ...
+ *	index: 'frames' x HBFrameIndex_t, at 'index_offset'
+ *
+ * Heat is world_heat[ MAP ] as world_size floats, whatever hb_heat_t the
+ * simulation stores. Positions are the swarm_map as a bitmap, one bit per
+ * cell (bit i % 32 of 32 bit word i / 32). In a delta frame each 32 bit
+ * word of both is XORed with the previous frame's, which leaves mostly
+ * zero bits. The words are then split in 4 byte planes (byte 0 of every
+ * word, then byte 1, ...) and deflated with zlib, each of heat and
+ * positions on its own. Key frames, every HB_FRAME_KEY_EVERY frames, are
+ * not delta encoded, so a reader can seek (through the index) to the key
+ * frame before any frame it wants.
+ *
+ * A checkpoint notes where the frames stand (HBSnapshotMark_t). A restart
+ * continues the file from there: later frames are cut off, and the first
+ * frame written is a key one, the previous frame being gone. Its initial
+ * world is a frame only if not already in the file.
+ *
+ * hbs2csv (hbs2csv.c) decodes frame files back to CSV.
+ * */
+
+
+#define HB_FRAME_MAGIC		"HBFRAMES"
+#define HB_FRAME_VERSION	1
+#define HB_FRAME_KEY_EVERY	16
+
+/** Frame flags. */
+#define HB_FRAME_KEY		0x1	/* Not delta encoded. */
+
+
+typedef struct hb_frame_header {
+	char magic[ 8 ];		/* HB_FRAME_MAGIC, not '\0' ended.	*/
+	guint32 version;		/* HB_FRAME_VERSION.			*/
+	guint32 endian;			/* HB_RESULT_ENDIAN, as written.	*/
+	guint64 world_width;
+	guint64 world_height;
+	guint64 bugs_number;
+	guint64 every;			/* Iterations between frames.		*/
+	guint64 frames;			/* Set on close, 0 if unknown.		*/
+	guint64 index_offset;		/* Set on close, 0 if unknown.		*/
+	guint32 seed;
+	guint32 key_every;		/* HB_FRAME_KEY_EVERY.			*/
+} HBFrameHeader_t;
+
+
+typedef struct hb_frame {
+	guint64 iteration;
+	guint32 flags;			/* HB_FRAME_*.				*/
+	guint32 heat_size;		/* Compressed heat bytes.		*/
+	guint32 positions_size;		/* Compressed positions bytes.		*/
+	guint32 reserved;
+} HBFrame_t;
+
+
+typedef struct hb_frame_index {
+	guint64 iteration;
+	guint64 offset;			/* Of the frame's HBFrame_t.		*/
+	guint32 flags;
+	guint32 reserved;
+} HBFrameIndex_t;
+
+
+/** Frames written, as saved in a checkpoint. */
+typedef struct hb_snapshot_mark {
+	guint64 frames;			/* 0 = none, or no snapshots.		*/
+	guint64 offset;			/* Of the next frame.			*/
+} HBSnapshotMark_t;
+
+
+typedef struct hb_snapshots HBSnapshots_t;
+
+
+HBSnapshots_t *hb_snapshots_open( const Parameters_t *const params,
+			const HBSnapshotMark_t *const resume, GError **err );
+
+void hb_snapshots_sync( HBSnapshots_t *const snaps,
+			HBSnapshotMark_t *const mark, GError **err );
+
+void hb_snapshots_take( HBSnapshots_t *const snaps, const hb_heat_t *const heat_map,
+		const hb_map_t *const swarm_map, const size_t iteration,
+							GError **err );
+
+void hb_snapshots_close( HBSnapshots_t *snaps, GError **err );
+
+
+#endif
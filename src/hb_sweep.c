@@ -0,0 +1,530 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+#define _GNU_SOURCE	/* fileno(...) and fsync(...) are POSIX, not c99.     */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_pool.h"
+#include "hb_ensemble.h"
+#include "hb_sweep.h"
+
+
+
+/** Keys, in job numbering order. 's' is the seed. */
+#define SWEEP_KEYS	"tThHrndewWis"
+#define SWEEP_AXES	(sizeof( SWEEP_KEYS ) - 1)
+
+/** Limits, against runaway specifications. */
+#define MAX_VALUES	100000
+#define MAX_JOBS	100000
+
+/** Sweep specification lines, and '.done' lines. */
+#define LINE_SIZE	1024
+
+/** Appended to the specification file name for the done jobs. */
+#define DONE_SUFFIX	".done"
+
+/** Relative cost of a bug to a cell, in an iteration. */
+#define BUG_COST	8
+
+
+/** Values of one option. */
+typedef struct hb_axis {
+	double *values;
+	size_t count;		/* 0 = not swept, as in the command line. */
+} HBAxis_t;
+
+
+/** A sweep run, the context of hb_ensemble_members(...) 'done' calls. */
+typedef struct hb_sweep {
+	const Parameters_t *jobs;	/* SIZE: JOBS	- In job order.		*/
+	size_t *order;		/* SIZE: PENDING	- Job of each member.	*/
+	FILE *done;		/* The '.done' file.				*/
+	gboolean failed;	/* Writing to 'done' failed.			*/
+} HBSweep_t;
+
+
+
+/**
+ * Parse the VALUES of a specification line into 'axis'.
+ * */
+static gboolean axis_parse( HBAxis_t *const axis, const char *values )
+{
+	double first, last, step = 1.0;
+	char *end;
+
+
+	first = strtod( values, &end );
+	if (end == values) return FALSE;
+
+	while (isspace( (unsigned char) *end )) end++;
+
+
+	/* FIRST:LAST[:STEP] */
+	if (*end == ':')
+	{
+		values = end + 1;
+		last = strtod( values, &end );
+		if (end == values) return FALSE;
+
+		while (isspace( (unsigned char) *end )) end++;
+
+		if (*end == ':')
+		{
+			values = end + 1;
+			step = strtod( values, &end );
+			if (end == values) return FALSE;
+
+			while (isspace( (unsigned char) *end )) end++;
+		}
+
+		if ((*end != '\0') || !(step > 0.0) || (last < first)
+			|| ((last - first) / step >= MAX_VALUES))
+			return FALSE;
+
+		axis->count = (size_t) floor( (last - first) / step * (1.0 + 1e-12) ) + 1;
+		axis->values = (double *) malloc( axis->count * sizeof( double ) );
+		if (!axis->values) return FALSE;
+
+		for (size_t v = 0; v < axis->count; v++)
+			axis->values[ v ] = first + (double) v * step;
+
+		return TRUE;
+	}
+
+
+	/* V1, V2, ... */
+	axis->values = (double *) malloc( MAX_VALUES * sizeof( double ) );
+	if (!axis->values) return FALSE;
+
+	axis->values[ axis->count++ ] = first;
+
+	while (*end == ',')
+	{
+		values = end + 1;
+		axis->values[ axis->count ] = strtod( values, &end );
+		if ((end == values) || (axis->count + 1 == MAX_VALUES)) return FALSE;
+
+		axis->count++;
+
+		while (isspace( (unsigned char) *end )) end++;
+	}
+
+	return *end == '\0';
+}
+
+
+
+/**
+ * Read the specification 'filename' into 'axes', one per SWEEP_KEYS.
+ * */
+static void spec_read( const char *const filename, HBAxis_t axes[ SWEEP_AXES ],
+								GError **err )
+{
+	char line[ LINE_SIZE ];
+	char *key, *eq, *hash, *tail;
+	const char *slot;
+	size_t lineno = 0;
+	FILE *file;
+
+
+	file = fopen( filename, "r" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		file == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open sweep file '%s'.", filename );
+
+	while (fgets( line, sizeof( line ), file ))
+	{
+		lineno++;
+
+		/* Comments, then surrounding blanks, go. */
+		if ((hash = strchr( line, '#' ))) *hash = '\0';
+
+		tail = line + strlen( line );
+		while ((tail > line) && isspace( (unsigned char) tail[ -1 ] )) *--tail = '\0';
+
+		key = line;
+		while (isspace( (unsigned char) *key )) key++;
+
+		if (*key == '\0') continue;
+
+
+		eq = strchr( key, '=' );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			eq == NULL,
+			HB_SWEEP_INVALID, error_handler,
+			"%s:%zu: expected 'KEY = VALUES'.", filename, lineno );
+
+		for (tail = eq; (tail > key) && isspace( (unsigned char) tail[ -1 ] ); tail--);
+		*tail = '\0';
+
+		if (strcmp( key, "seeds" ) == 0) key = "s";
+
+		slot = (strlen( key ) == 1) ? strchr( SWEEP_KEYS, *key ) : NULL;
+		hb_if_err_create_goto( *err, HB_ERROR,
+			slot == NULL,
+			HB_SWEEP_INVALID, error_handler,
+			"%s:%zu: unknown key '%s'.", filename, lineno, key );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			axes[ slot - SWEEP_KEYS ].count > 0,
+			HB_SWEEP_INVALID, error_handler,
+			"%s:%zu: key '%s' given twice.", filename, lineno, key );
+
+		eq++;
+		while (isspace( (unsigned char) *eq )) eq++;
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			!axis_parse( &axes[ slot - SWEEP_KEYS ], eq ),
+			HB_SWEEP_INVALID, error_handler,
+			"%s:%zu: invalid values '%s'.", filename, lineno, eq );
+	}
+
+
+error_handler:
+
+	if (file) fclose( file );
+
+	return;
+}
+
+
+
+/**
+ * Set option 'key' of 'params' to 'value'. FALSE if the option takes whole
+ * numbers and 'value' isn't one.
+ * */
+static gboolean option_set( Parameters_t *const params, const char key,
+							const double value )
+{
+	if (!strchr( "rde", key ) && ((value < 0.0) || (value != floor( value ))
+					|| (value > (double) G_MAXUINT32)))
+		return FALSE;
+
+	switch (key)
+	{
+		case 't': params->bugs_temperature_min_ideal = (unsigned int) value; break;
+		case 'T': params->bugs_temperature_max_ideal = (unsigned int) value; break;
+		case 'h': params->bugs_heat_min_output = (unsigned int) value; break;
+		case 'H': params->bugs_heat_max_output = (unsigned int) value; break;
+		case 'r': params->bugs_random_move_chance = (float) value; break;
+		case 'n': params->bugs_number = (size_t) value; break;
+		case 'd': params->world_diffusion_rate = (float) value; break;
+		case 'e': params->world_evaporation_rate = (float) value; break;
+		case 'w': params->world_width = (size_t) value; break;
+		case 'W': params->world_height = (size_t) value; break;
+		case 'i': params->numIterations = (size_t) value; break;
+		default:  params->seed = (unsigned int) value;	/* 's' */
+	}
+
+	return TRUE;
+}
+
+
+
+/** A job's '.done' line, as "job,t,T,h,H,r,n,d,e,w,W,i,seed,file\n". */
+static void job_line( char *const line, const size_t job,
+					const Parameters_t *const params )
+{
+	snprintf( line, LINE_SIZE, "%zu,%u,%u,%u,%u,%.9g,%zu,%.9g,%.9g,%zu,%zu,%zu,%u,%s\n",
+		job, params->bugs_temperature_min_ideal,
+		params->bugs_temperature_max_ideal, params->bugs_heat_min_output,
+		params->bugs_heat_max_output, params->bugs_random_move_chance,
+		params->bugs_number, params->world_diffusion_rate,
+		params->world_evaporation_rate, params->world_width,
+		params->world_height, params->numIterations, params->seed,
+		params->output_filename );
+
+	return;
+}
+
+
+
+/** The seed of a '.done' line, FALSE if it has none. */
+static gboolean line_seed( const char *line, unsigned int *const seed )
+{
+	unsigned long value;
+	char *end;
+
+
+	/* Past "job,t,T,h,H,r,n,d,e,w,W,i,". */
+	for (int f = 0; f < 12; f++)
+	{
+		line = strchr( line, ',' );
+		if (line == NULL) return FALSE;
+		line++;
+	}
+
+	value = strtoul( line, &end, 10 );
+	if ((end == line) || (*end != ',') || (value > G_MAXUINT32)) return FALSE;
+
+	*seed = (unsigned int) value;
+
+	return TRUE;
+}
+
+
+
+/** A job done: record it, on disk before going on. */
+static void job_done( void *ctx, const size_t member )
+{
+	HBSweep_t *const sweep = (HBSweep_t *) ctx;
+	const size_t job = sweep->order[ member ];
+	char line[ LINE_SIZE ];
+
+
+	job_line( line, job, &sweep->jobs[ job ] );
+
+	if ((fputs( line, sweep->done ) == EOF) || (fflush( sweep->done ) != 0)
+		|| (fsync( fileno( sweep->done ) ) != 0))
+		sweep->failed = TRUE;
+
+	return;
+}
+
+
+
+/** Pending jobs, the most expensive first. */
+typedef struct hb_job_cost {
+	double cost;
+	size_t job;
+} HBJobCost_t;
+
+static int cost_compare( const void *a, const void *b )
+{
+	const HBJobCost_t *const ja = (const HBJobCost_t *) a;
+	const HBJobCost_t *const jb = (const HBJobCost_t *) b;
+
+	if (ja->cost != jb->cost) return (ja->cost < jb->cost) ? 1 : -1;
+
+	return (ja->job > jb->job) - (ja->job < jb->job);
+}
+
+
+
+/**
+ * Run the sweep 'params->sweep_filename' (see hb_sweep.h), skipping the jobs
+ * already done.
+ *
+ * @param[in]	params		- Command line parameters, the jobs' defaults.
+ * @param[in]	pool		- Worker threads, or NULL.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+void hb_sweep_run( const Parameters_t *const params, HBPool_t *const pool,
+								GError **err )
+{
+	GError *err_sweep = NULL;
+	HBAxis_t axes[ SWEEP_AXES ];
+	char done_filename[ sizeof( params->sweep_filename ) + sizeof( DONE_SUFFIX ) ];
+	char line[ LINE_SIZE ], expect[ LINE_SIZE ];
+	Parameters_t *jobs = NULL;
+	HBJobCost_t *costs = NULL;
+	gboolean *finished = NULL;
+	HBSweep_t sweep;
+	size_t njobs = 1, pending = 0, job;
+	gboolean seed_found = FALSE;
+	unsigned int seed;
+	char *end;
+	FILE *file;
+
+
+	memset( axes, 0, sizeof( axes ) );
+	memset( &sweep, 0, sizeof( HBSweep_t ) );
+
+	spec_read( params->sweep_filename, axes, &err_sweep );
+	hb_if_err_propagate_goto( err, err_sweep, error_handler );
+
+	for (size_t a = 0; a < SWEEP_AXES; a++)
+		if (axes[ a ].count)
+		{
+			hb_if_err_create_goto( *err, HB_ERROR,
+				njobs * axes[ a ].count > MAX_JOBS,
+				HB_SWEEP_INVALID, error_handler,
+				"Sweep has more than %d jobs.", MAX_JOBS );
+
+			njobs *= axes[ a ].count;
+		}
+
+
+	/** JOBS, each the command line parameters with its values. */
+	jobs = (Parameters_t *) malloc( njobs * sizeof( Parameters_t ) );
+	costs = (HBJobCost_t *) malloc( njobs * sizeof( HBJobCost_t ) );
+	finished = (gboolean *) calloc( njobs, sizeof( gboolean ) );
+	sweep.order = (size_t *) malloc( njobs * sizeof( size_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!jobs || !costs || !finished || !sweep.order,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the sweep." );
+
+	for (job = 0; job < njobs; job++)
+	{
+		Parameters_t *const jp = &jobs[ job ];
+		size_t digits = job;
+
+		*jp = *params;
+		jp->threads = 1;
+		jp->sweep_filename[ 0 ] = '\0';
+
+		/* Mixed radix job number, the last key the fastest digit. */
+		for (size_t a = SWEEP_AXES; a-- > 0; )
+		{
+			if (axes[ a ].count == 0) continue;
+
+			hb_if_err_create_goto( *err, HB_ERROR,
+				!option_set( jp, SWEEP_KEYS[ a ],
+					axes[ a ].values[ digits % axes[ a ].count ] ),
+				HB_SWEEP_INVALID, error_handler,
+				"Sweep values of '%c' must be whole numbers.",
+				SWEEP_KEYS[ a ] );
+
+			digits /= axes[ a ].count;
+		}
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			!hb_ensemble_filename( jp->output_filename,
+				sizeof( jp->output_filename ),
+				params->output_filename, (guint32) job )
+			|| !hb_ensemble_filename( jp->snapshot_filename,
+				sizeof( jp->snapshot_filename ),
+				params->snapshot_filename, (guint32) job ),
+			HB_SWEEP_INVALID, error_handler,
+			"File name too long for sweep job %zu.", job );
+
+		checkSimulParameters( jp, &err_sweep );
+		if (err_sweep) g_prefix_error( &err_sweep, "Sweep job %zu: ", job );
+		hb_if_err_propagate_goto( err, err_sweep, error_handler );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			jp->numIterations == 0,
+			HB_SWEEP_INVALID, error_handler,
+			"Sweep job %zu never ends, it needs iterations.", job );
+	}
+
+
+	/** DONE JOBS, from a previous run: lines that match their job. A  */
+	/** seed drawn from /dev/urandom differs each run: with no seeds   */
+	/** swept, the jobs take that of the first line otherwise matching. */
+	strcpy( done_filename, params->sweep_filename );
+	strcat( done_filename, DONE_SUFFIX );
+
+	file = fopen( done_filename, "r" );
+
+	if (file)
+	{
+		while (fgets( line, sizeof( line ), file ))
+		{
+			job = strtoul( line, &end, 10 );
+
+			if ((end == line) || (*end != ',') || (job >= njobs)) continue;
+
+			if (params->seed_drawn && !seed_found
+				&& (axes[ SWEEP_AXES - 1 ].count == 0)
+				&& line_seed( line, &seed ))
+			{
+				Parameters_t reseeded = jobs[ job ];
+
+				reseeded.seed = seed;
+				job_line( expect, job, &reseeded );
+
+				if (strcmp( line, expect ) == 0)
+				{
+					for (size_t j = 0; j < njobs; j++)
+						jobs[ j ].seed = seed;
+
+					seed_found = TRUE;
+				}
+			}
+
+			job_line( expect, job, &jobs[ job ] );
+			finished[ job ] |= (strcmp( line, expect ) == 0);
+		}
+
+		fclose( file );
+	}
+
+
+	/** PENDING JOBS, the most expensive first. */
+	for (job = 0; job < njobs; job++)
+	{
+		if (finished[ job ]) continue;
+
+		costs[ pending ].cost = (double) jobs[ job ].numIterations
+			* (double) (jobs[ job ].world_size
+				+ BUG_COST * jobs[ job ].bugs_number);
+		costs[ pending ].job = job;
+		pending++;
+	}
+
+	qsort( costs, pending, sizeof( HBJobCost_t ), cost_compare );
+
+	for (size_t m = 0; m < pending; m++)
+		sweep.order[ m ] = costs[ m ].job;
+
+	if (seed_found) printf( "Sweep: seed %u, as in '%s'.\n", seed,
+							done_filename );
+
+	printf( "Sweep: %zu jobs, %zu done, %zu to run.\n", njobs,
+						njobs - pending, pending );
+	fflush( stdout );
+
+
+	/** RUN, recording each job as it completes. */
+	sweep.jobs = jobs;
+	sweep.done = fopen( done_filename, "a" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		sweep.done == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open sweep file '%s'.", done_filename );
+
+	if (ftell( sweep.done ) == 0)
+		fputs( "job,t,T,h,H,r,n,d,e,w,W,i,seed,file\n", sweep.done );
+
+	hb_ensemble_members( jobs, sweep.order, pending, NULL, pool,
+					job_done, &sweep, &err_sweep );
+	hb_if_err_propagate_goto( err, err_sweep, error_handler );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		sweep.failed,
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Could not write to sweep file '%s'.", done_filename );
+
+
+error_handler:
+
+	if (sweep.done && (fclose( sweep.done ) != 0) && (*err == NULL))
+		g_set_error( err, HB_ERROR, HB_OUTPUT_WRITE_FAILURE,
+			"Could not write to sweep file '%s'.", done_filename );
+
+	for (size_t a = 0; a < SWEEP_AXES; a++)
+		free( axes[ a ].values );
+
+	free( sweep.order );
+	free( finished );
+	free( costs );
+	free( jobs );
+
+	return;
+}
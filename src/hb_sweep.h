@@ -0,0 +1,63 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+#ifndef __HEATBUGS_CPU_SWEEP_H_
+#define __HEATBUGS_CPU_SWEEP_H_
+
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_pool.h"
+
+
+/**
+ * Parameter sweeps ('--sweep SPEC').
+ *
+ * SPEC is a text file, one option per line, as "KEY = VALUES":
+ *
+ *	# Worlds of 3 sizes, 10 seeds each, 5000 iterations.
+ *	w = 100, 200, 400
+ *	W = 100:400:150
+ *	seeds = 1:10
+ *	i = 5000
+ *
+ * KEY is one of the options t T h H r n d e w W i, or 'seeds' (or 's').
+ * VALUES is a comma separated list, or an inclusive FIRST:LAST:STEP range
+ * (STEP 1 if left out). Options not in SPEC are as in the command line.
+ * '#' starts a comment.
+ *
+ * Every combination of values is a job: job numbers follow the KEY order
+ * above, the last KEY counting fastest, whatever the order in SPEC. Jobs
+ * run on the ensemble machinery (see hb_ensemble.h), the most expensive
+ * first (iterations x (cells + 8 x bugs)), so the long ones don't end up
+ * last. Each writes the output file named with its job number.
+ *
+ * As each job completes, a line with its parameters and output file goes
+ * to SPEC plus ".done" (CSV, synced to disk). Run again, a sweep skips the
+ * jobs found there, so a killed sweep resumes where it stopped. Changing
+ * SPEC renumbers jobs; lines that no longer match their job are rerun.
+ * Without seeds in SPEC nor -s, the jobs resume with the seed of the
+ * '.done' file, the one drawn from /dev/urandom when the sweep started.
+ * */
+
+
+void hb_sweep_run( const Parameters_t *const params, HBPool_t *const pool,
+								GError **err );
+
+
+#endif
@@ -0,0 +1,410 @@
+/*
+ * This file is part of heatbugs_CPU.
+ *
+ * heatbugs_CPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_CPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_CPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Decode a world snapshot file ('--snapshot-every K', see hb_snapshot.h)
+ * into CSV:
+ *
+ *	hbs2csv [-p] [-w ITERATION] IN.hbs [OUT.csv]
+ *
+ * One line per frame, as "iteration,bugs,heat": the bugs on the positions
+ * bitmap and the world heat, summed in double.
+ *
+ * -w	The world of the frame of ITERATION instead, one line per cell as
+ *	"row,column,heat,bug". Found through the index, decoded from the
+ *	key frame before it.
+ * -p	Also print the header to stderr.
+ * Without OUT.csv the CSV goes to stdout. A file the simulation didn't
+ * close (no index) is read frame after frame, up to its last whole one.
+ * */
+
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>	/* getopt(...) */
+#include <string.h>
+
+#include <zlib.h>
+
+#include "glib.h"
+
+#include "heatbugs.h"
+#include "hb_output.h"
+#include "hb_snapshot.h"
+
+
+
+/** A frame file being decoded, with the last frame read. */
+typedef struct {
+	FILE *in;
+	HBFrameHeader_t header;
+	size_t heat_words;	/* world_size.				*/
+	size_t pos_words;	/* world_size / 32, rounded up.		*/
+	guint32 *heat;		/* SIZE: WORLD_SIZE	- Float bits.	*/
+	guint32 *positions;	/* SIZE: POS_WORDS	- The bitmap.	*/
+	guint8 *planes;		/* SIZE: 4 * WORLD_SIZE			*/
+	Bytef *zbuf;		/* Compressed heat, then positions.	*/
+	uLong zbuf_size;
+} HBFrames_t;
+
+
+
+/** Print the header fields, one per line. */
+static void print_header( const HBFrameHeader_t *const header, FILE *out )
+{
+	fprintf( out, "version                    %u\n", header->version );
+	fprintf( out, "world                      %" G_GUINT64_FORMAT " x %" G_GUINT64_FORMAT "\n",
+					header->world_width, header->world_height );
+	fprintf( out, "bugs                       %" G_GUINT64_FORMAT "\n", header->bugs_number );
+	fprintf( out, "seed                       %u\n", header->seed );
+	fprintf( out, "every                      %" G_GUINT64_FORMAT "\n", header->every );
+	fprintf( out, "frames                     %" G_GUINT64_FORMAT "\n", header->frames );
+	fprintf( out, "key every                  %u\n", header->key_every );
+
+	return;
+}
+
+
+
+/**
+ * Inflate 'size' bytes of 'src' into 'words' words of 'data', put back
+ * together from their byte planes and XORed with what 'data' holds (the
+ * previous frame's) unless 'key'. See encode(...) in hb_snapshot.c.
+ * */
+static gboolean decode( HBFrames_t *const frames, const Bytef *const src,
+		const uLong size, guint32 *const data, const size_t words,
+							const gboolean key )
+{
+	const guint8 *const planes = frames->planes;
+	uLongf len = words * sizeof( guint32 );
+
+
+	if ((uncompress( frames->planes, &len, src, size ) != Z_OK)
+		|| (len != words * sizeof( guint32 )))
+		return FALSE;
+
+	for (size_t w = 0; w < words; w++)
+	{
+		const guint32 word = (guint32) planes[ w ]
+			| ((guint32) planes[ words + w ] << 8)
+			| ((guint32) planes[ 2 * words + w ] << 16)
+			| ((guint32) planes[ 3 * words + w ] << 24);
+
+		data[ w ] = key ? word : data[ w ] ^ word;
+	}
+
+	return TRUE;
+}
+
+
+
+/**
+ * Read the next frame into 'frames', onto the previous one. FALSE at the
+ * end of the file, with 'err' set if the frame is there but broken.
+ * */
+static gboolean frame_read( HBFrames_t *const frames, HBFrame_t *const frame,
+							GError **err )
+{
+	if (fread( frame, sizeof( HBFrame_t ), 1, frames->in ) != 1)
+		return FALSE;
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(uLong) frame->heat_size + frame->positions_size > frames->zbuf_size,
+		HB_INVALID_PARAMETER, error_handler,
+		"Frame of iteration %" G_GUINT64_FORMAT " is broken.",
+		frame->iteration );
+
+	if (fread( frames->zbuf, frame->heat_size + frame->positions_size, 1,
+							frames->in ) != 1)
+		return FALSE;
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!decode( frames, frames->zbuf, frame->heat_size, frames->heat,
+			frames->heat_words, frame->flags & HB_FRAME_KEY )
+		|| !decode( frames, frames->zbuf + frame->heat_size,
+			frame->positions_size, frames->positions,
+			frames->pos_words, frame->flags & HB_FRAME_KEY ),
+		HB_INVALID_PARAMETER, error_handler,
+		"Frame of iteration %" G_GUINT64_FORMAT " is broken.",
+		frame->iteration );
+
+	return TRUE;
+
+
+error_handler:
+
+	return FALSE;
+}
+
+
+
+/** Heat of 'cell' of the frame read. */
+static inline double cell_heat( const HBFrames_t *const frames, const size_t cell )
+{
+	float heat;
+
+	memcpy( &heat, &frames->heat[ cell ], sizeof( float ) );
+
+	return (double) heat;
+}
+
+
+
+/** TRUE if a bug is on 'cell' of the frame read. */
+static inline gboolean cell_bug( const HBFrames_t *const frames, const size_t cell )
+{
+	return (frames->positions[ cell / 32 ] >> (cell % 32)) & 1;
+}
+
+
+
+/**
+ * Seek to the key frame before the one of 'iteration', through the index.
+ * Returns the frames to read up to it, that one included, or 0 if it has
+ * no frame.
+ * */
+static guint64 index_seek( HBFrames_t *const frames, const guint64 iteration,
+							GError **err )
+{
+	HBFrameIndex_t entry;
+	guint64 key = 0, count = 0;
+	gboolean ok, hit = FALSE;
+
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(frames->header.frames == 0) || (frames->header.index_offset == 0),
+		HB_INVALID_PARAMETER, error_handler,
+		"Snapshot file has no index, it wasn't closed." );
+
+	ok = fseek( frames->in, (long) frames->header.index_offset, SEEK_SET ) == 0;
+
+	/* Frames are in iteration order. */
+	for (guint64 f = 0; ok && !hit && (f < frames->header.frames); f++)
+	{
+		ok = fread( &entry, sizeof( HBFrameIndex_t ), 1, frames->in ) == 1;
+
+		if (!ok || (entry.iteration > iteration)) break;
+
+		if (entry.flags & HB_FRAME_KEY)
+		{
+			key = entry.offset;
+			count = 0;
+		}
+
+		count++;
+		hit = (entry.iteration == iteration);
+	}
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!ok || (hit && (fseek( frames->in, (long) key, SEEK_SET ) != 0)),
+		HB_INVALID_PARAMETER, error_handler,
+		"Snapshot file index is truncated." );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!hit,
+		HB_INVALID_PARAMETER, error_handler,
+		"Snapshot file has no frame of iteration %" G_GUINT64_FORMAT ".",
+		iteration );
+
+	return count;
+
+
+error_handler:
+
+	return 0;
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	GError *err_main = NULL;
+	FILE *out = stdout;
+	HBFrames_t frames;
+	HBFrame_t frame;
+
+	gboolean show_header = FALSE, world = FALSE;
+	guint64 iteration = 0, skip = 0;
+	char *end;
+	int status = 0;
+	int c;
+
+
+	memset( &frames, 0, sizeof( HBFrames_t ) );
+
+	while ((c = getopt( argc, argv, "pw:" )) != -1)
+	{
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			(c != 'p') && (c != 'w'), HB_INVALID_PARAMETER, error_handler,
+			"Usage: %s [-p] [-w ITERATION] IN.hbs [OUT.csv]", argv[ 0 ] );
+
+		if (c == 'p') show_header = TRUE;
+
+		if (c == 'w')
+		{
+			iteration = strtoull( optarg, &end, 10 );
+			world = TRUE;
+
+			hb_if_err_create_goto( err_main, HB_ERROR,
+				(end == optarg) || (*end != '\0'),
+				HB_INVALID_PARAMETER, error_handler,
+				"Invalid iteration '%s'.", optarg );
+		}
+	}
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(optind >= argc) || (argc - optind > 2),
+		HB_INVALID_PARAMETER, error_handler,
+		"Usage: %s [-p] [-w ITERATION] IN.hbs [OUT.csv]", argv[ 0 ] );
+
+
+	/* Read and check the header. */
+	frames.in = fopen( argv[ optind ], "rb" );
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		frames.in == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open input file." );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(fread( &frames.header, sizeof( HBFrameHeader_t ), 1, frames.in ) != 1)
+		|| memcmp( frames.header.magic, HB_FRAME_MAGIC,
+					sizeof( frames.header.magic ) ),
+		HB_INVALID_PARAMETER, error_handler,
+		"Not a heatbugs snapshot file." );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		frames.header.endian != HB_RESULT_ENDIAN,
+		HB_INVALID_PARAMETER, error_handler,
+		"Snapshot file was written with another byte order." );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		(frames.header.version != HB_FRAME_VERSION)
+		|| (frames.header.world_width == 0)
+		|| (frames.header.world_height == 0)
+		|| (frames.header.world_width > G_MAXSIZE / 4 / frames.header.world_height),
+		HB_INVALID_PARAMETER, error_handler,
+		"Unsupported snapshot file version or header." );
+
+	if (show_header) print_header( &frames.header, stderr );
+
+
+	frames.heat_words = frames.header.world_width * frames.header.world_height;
+	frames.pos_words = (frames.heat_words + 31) / 32;
+
+	frames.heat = (guint32 *) calloc( frames.heat_words, sizeof( guint32 ) );
+	frames.positions = (guint32 *) calloc( frames.pos_words, sizeof( guint32 ) );
+	frames.planes = (guint8 *) malloc( frames.heat_words * sizeof( guint32 ) );
+
+	frames.zbuf_size = compressBound( frames.heat_words * sizeof( guint32 ) )
+			+ compressBound( frames.pos_words * sizeof( guint32 ) );
+	frames.zbuf = (Bytef *) malloc( frames.zbuf_size );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		!frames.heat || !frames.positions || !frames.planes || !frames.zbuf,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for frames." );
+
+	if (world)
+	{
+		skip = index_seek( &frames, iteration, &err_main );
+		if (err_main) goto error_handler;
+	}
+
+	if (argc - optind == 2)
+	{
+		out = fopen( argv[ optind + 1 ], "w" );
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			out == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open output file." );
+	}
+
+
+	/* Frames from the key one before the world's, or all of them. The */
+	/* index, if any, is past the last.                                 */
+	for (guint64 f = 0; !world || (f < skip); f++)
+	{
+		double heat = 0.0;
+		size_t bugs = 0;
+
+		if (frames.header.index_offset && (ftell( frames.in ) >= 0)
+			&& ((guint64) ftell( frames.in ) >= frames.header.index_offset))
+			break;
+
+		if (!frame_read( &frames, &frame, &err_main ))
+		{
+			if (err_main) goto error_handler;
+
+			hb_if_err_create_goto( err_main, HB_ERROR,
+				world || frames.header.index_offset,
+				HB_INVALID_PARAMETER, error_handler,
+				"Snapshot file is truncated." );
+
+			break;
+		}
+
+		if (world) continue;
+
+		for (size_t cell = 0; cell < frames.heat_words; cell++)
+		{
+			heat += cell_heat( &frames, cell );
+			bugs += cell_bug( &frames, cell );
+		}
+
+		fprintf( out, "%" G_GUINT64_FORMAT ",%zu,%.17g\n", frame.iteration,
+								bugs, heat );
+	}
+
+	if (world)
+		for (size_t cell = 0; cell < frames.heat_words; cell++)
+			fprintf( out, "%zu,%zu,%.9g,%d\n",
+				cell / frames.header.world_width,
+				cell % frames.header.world_width,
+				cell_heat( &frames, cell ), cell_bug( &frames, cell ) );
+
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		ferror( frames.in ) || ferror( out ),
+		HB_OUTPUT_WRITE_FAILURE, error_handler,
+		"Error reading or writing frames." );
+
+
+	goto clean_all;
+
+
+error_handler:
+
+	/* Handle error. */
+	fprintf( stderr, "Error: %s\n\n", err_main->message );
+	g_error_free( err_main );
+	status = 1;
+
+
+clean_all:
+
+	if (frames.zbuf) free( frames.zbuf );
+	if (frames.planes) free( frames.planes );
+	if (frames.positions) free( frames.positions );
+	if (frames.heat) free( frames.heat );
+	if (frames.in) fclose( frames.in );
+	if (out && out != stdout) fclose( out );
+
+
+	return status;
+}
@@ -24,15 +24,32 @@
 #include <stdio.h>	/* printf(...), fscanf(...), fprintf(...)             */
 #include <stdlib.h>	/* exit(...)	*/
 #include <unistd.h>
+#include <getopt.h>	/* getopt_long(...), for the long only options.	      */
 
 #include <math.h>	/* fabs(...)	*/
 #include <string.h>
 #include <ctype.h>
 
+/* Vector extensions used by the fused diffusion kernel, when available.     */
+/* Build with 'make SIMD=-mavx2' (or -mavx) to get 8 floats per vector.      */
+#if defined( __AVX__ )
+	#include <immintrin.h>
+#elif defined( __SSE2__ )
+	#include <emmintrin.h>
+#endif
+
 #include "glib.h"	/* FALSE, TRUE, random's */
 
 //#include "keyboard.h"
 #include "heatbugs.h"
+#include "hb_pool.h"
+#include "hb_rng.h"
+#include "hb_profile.h"
+#include "hb_output.h"
+#include "hb_snapshot.h"
+#include "hb_checkpoint.h"
+#include "hb_ensemble.h"
+#include "hb_sweep.h"
 
 
 
@@ -55,37 +72,147 @@
 #define BUGS_HEAT_MIN_OUTPUT	5	/* Range: 0,1,2 .. 100 */
 #define BUGS_HEAT_MAX_OUTPUT	25	/* Range: 0,1,2 .. 100 */
 
+/* Diffusion engine, see DIFFUSION_* below. */
+#define DIFFUSION_ENGINE	DIFFUSION_FUSED
+
+/* Sparse diffusion (fused engine only): tiles with no cell over this heat */
+/* around are not computed (< 0 = off), and the tiles' side.               */
+#define SPARSE_EPSILON		-1.0f
+#define SPARSE_TILE		32	/* Power of 2. */
+
+/* Agents (bug_step) engine, see AGENTS_* below. */
+#define AGENTS_ENGINE		AGENTS_SERIAL
+
+/* Random number generator, HB_RNG_* or RNG_AUTO: GLib's for the serial */
+/* agents engine (historical results), Philox for the parallel ones.    */
+#define RNG_KIND		RNG_AUTO
+#define RNG_AUTO		-1
+
+/* Minimum tile side for the checkerboard agents engine. */
+#define TILE_SIZE		16	/* Range: 3 .. */
+
+/* Order bugs move in, ORDER_* (serial and atomic agents engines), with */
+/* 'morton' order's block side and iterations between sorts.            */
+#define ORDER_KIND		ORDER_RANDOM
+#define ORDER_BLOCK		8	/* Range: 1, 2, 4 .. MAX_ORDER_BLOCK */
+#define MAX_ORDER_BLOCK		65536
+#define ORDER_SORT_EVERY	8	/* Range: 1 .. */
+
+/* Threads used by the simulation. 1 = serial processing. */
+#define NUM_THREADS		1	/* Range: 1 .. MAX_THREADS */
+#define MAX_THREADS		1024
+
 /* The file to send results. Directory must exist. */
 #define OUTPUT_FILENAME		"../results/heatbugsCPU.csv"
+#define OUTPUT_FILENAME_BIN	"../results/heatbugsCPU.hbr"	/* --format binary */
 
+/* Results file format, HB_FORMAT_* (see hb_output.h). */
+#define OUTPUT_FORMAT		HB_FORMAT_CSV
 
-/** Parameters parsing constants. */
-#define COUNT 1
+/* Statistics output each iteration, HB_STAT_* bits. */
+#define OUTPUT_COLUMNS		HB_STAT_MEAN
 
-/** Simulation constants. */
-#define NUM_NEIGHBOURS 8
+/* Iterations between records, and HB_AGG_* bits of the statistics over */
+/* them output (0 = those of the record's iteration).                  */
+#define OUTPUT_EVERY		1	/* Range: 1 .. */
+#define OUTPUT_AGGREGATE	0
 
-/** Used to drive what shall happen to the agent at each step. */
-#define FIND_ANY_FREE		0x00ffffff
-#define FIND_MAX_TEMPERATURE	0x00ffff00
-#define FIND_MIN_TEMPERATURE	0x00ff00ff
+/* Stop once the unhappiness average is stationary: iterations in each  */
+/* of the two windows compared (0 = off), and the relative tolerance.   */
+#define CONVERGE_WINDOW		0
+#define CONVERGE_TOLERANCE	0.001
 
+/* Write results from a thread of their own. */
+#define OUTPUT_ASYNC		FALSE
 
-/** Heatbugs related. */
-#define OKI_DOKI	 0
-#define NOT_DOKI	-1
+/* World snapshots: iterations between frames (0 = none), and their file. */
+#define SNAPSHOT_EVERY		0
+#define SNAPSHOT_FILENAME	"../results/heatbugsCPU.hbs"
 
-#define RESET 0
+/* Checkpoints: iterations between them (0 = none), and their file. */
+#define CHECKPOINT_EVERY	0
+#define CHECKPOINT_FILENAME	"../results/heatbugsCPU.hbc"
 
-#define A_BUG		0x00ff00dd
-#define A_EMPTY_CELL	0x00000000
 
+/** Parameters parsing constants. */
+#define COUNT 1
+
+/* Values returned by 'getopt_long' for options without a short form. */
+/* Kept above any char value so they never collide with short options. */
+enum {
+	OPT_THREADS = 256,
+	OPT_DIFFUSION,
+	OPT_SPARSE,
+	OPT_AGENTS,
+	OPT_TILE_SIZE,
+	OPT_ORDER,
+	OPT_ORDER_BLOCK,
+	OPT_ORDER_SORT_EVERY,
+	OPT_RNG,
+	OPT_PROFILE,
+	OPT_FORMAT,
+	OPT_COLUMNS,
+	OPT_OUTPUT_EVERY,
+	OPT_AGGREGATE,
+	OPT_CONVERGE,
+	OPT_CONVERGE_TOL,
+	OPT_ASYNC_OUTPUT,
+	OPT_SNAPSHOT_EVERY,
+	OPT_SNAPSHOT_FILE,
+	OPT_CHECKPOINT_EVERY,
+	OPT_CHECKPOINT_FILE,
+	OPT_RESTART,
+	OPT_ENSEMBLE,
+	OPT_SEEDS,
+	OPT_INTERLEAVE,
+	OPT_SWEEP
+};
+
+
+/** Engine names, for '--diffusion NAME' and '--agents NAME'. */
+static const char *const diffusion_names[ DIFFUSION_ENGINES ] = {
+	"v1", "v2", "fused", "boxsum"
+};
+
+static const char *const agents_names[ AGENTS_ENGINES ] = {
+	"serial", "atomic", "checkerboard"
+};
+
+/** Bugs orders, for '--order NAME'. */
+static const char *const order_names[ ORDERS ] = {
+	"random", "morton"
+};
+
+
+/** Random number generators, selected with '--rng NAME' (see hb_rng.h). */
+static const char *const rng_names[ HB_RNG_KINDS ] = {
+	"glib", "philox"
+};
+
+/** Results file formats, selected with '--format NAME' (see hb_output.h). */
+static const char *const format_names[ HB_FORMATS ] = {
+	"csv", "binary"
+};
+
+/** Statistics, HB_STAT_* by bit, selected with '--columns LIST'. */
+static const char *const stat_names[ HB_STATS ] = {
+	"unhappiness", "min", "max", "variance", "heat", "histogram"
+};
+
+/** Aggregates, HB_AGG_* by bit, selected with '--aggregate LIST'. */
+static const char *const agg_names[ HB_AGGS ] = {
+	"mean", "min", "max"
+};
+
+
+/** Checkerboard engine, smallest tile. */
+#define MIN_TILE_SIZE	3	/* A bug reaches 1 cell away, 2 bugs 2 cells. */
 
-/** Used in swarm_map operations. */
-#define HAS_BUG( swarm_map_locus ) ((swarm_map_locus) != A_EMPTY_CELL)
-#define HAS_NO_BUG( swarm_map_locus ) ((swarm_map_locus) == A_EMPTY_CELL)
+/** Heatbugs related. */
+#define OKI_DOKI	 0
+#define NOT_DOKI	-1
 
-#define NEW_BUG_IN( swarm_map_locus ) swarm_map_locus = A_BUG
+#define RESET 0
 
 
 /** Used in swarm. */
@@ -96,81 +223,89 @@
 #define SET_BUG_OUTPUT_HEAT( swarm_outHeat, outHeat ) swarm_outHeat = outHeat
 
 
-/** This is the selector for world_heat in hb_buffers structure (see it below). */
-#define MAP	0
-#define BUFFER	1
+/** Vector operations used by the fused diffusion kernel. */
+#if defined( __AVX__ )
+	#define HB_VEC_FLOATS		8
+	typedef __m256 hb_vec_t;
+	#define VEC_LOAD( ptr )		_mm256_loadu_ps( ptr )
+	#define VEC_STORE( ptr, v )	_mm256_storeu_ps( (ptr), (v) )
+	#define VEC_SET1( f )		_mm256_set1_ps( f )
+	#define VEC_ADD( a, b )		_mm256_add_ps( (a), (b) )
+	#define VEC_MUL( a, b )		_mm256_mul_ps( (a), (b) )
+#elif defined( __SSE2__ )
+	#define HB_VEC_FLOATS		4
+	typedef __m128 hb_vec_t;
+	#define VEC_LOAD( ptr )		_mm_loadu_ps( ptr )
+	#define VEC_STORE( ptr, v )	_mm_storeu_ps( (ptr), (v) )
+	#define VEC_SET1( f )		_mm_set1_ps( f )
+	#define VEC_ADD( a, b )		_mm_add_ps( (a), (b) )
+	#define VEC_MUL( a, b )		_mm_mul_ps( (a), (b) )
+#endif
 
+/* Columns of 16 bit heat cells widened to float at a time (on the stack). */
+#define HEAT_SPAN		256
 
 
 
-/** Input data used for simulation. */
-typedef struct parameters {
-	/* Num Iterations to stop. (0 = non stop). */
-	size_t numIterations;
-	/* Number of bugs in the world. */
-	size_t bugs_number;
-	/* World width size. */
-	size_t world_width;
-	/* World height size. */
-	size_t world_height;
-	/* World's vector size = (world_height * world_width). */
-	size_t world_size;
-	/* [0..1], % temperature to adjacent cells. */
-	float world_diffusion_rate;
-	/* [0..1], % temperature's loss to 'ether'.  */
-	float world_evaporation_rate;
-	/* [0..100], Chance a bug will move. */
-	float bugs_random_move_chance;
-	/* [0 .. 200], bug's minimum prefered temperature. */
-	unsigned int bugs_temperature_min_ideal;
-	/* [0 .. 200], bug's maximum prefered temperature. */
-	unsigned int bugs_temperature_max_ideal;
-	/* [0 .. 100], min heat a bug leave in the world in each step. */
-	unsigned int bugs_heat_min_output;
-	/* [0 .. 100], max heat a bug leave in the world in each step. */
-	unsigned int bugs_heat_max_output;
-	/* Seed to be used as random generator initialization value. */
-	unsigned int seed;	/* Type required by Glib's g_random_set_seed(...) */
-	/* File to send results. */
-	char output_filename[256];
-} Parameters_t;
 
+const char version[] = "Heatbugs simulation for CPU (serial processing) v3.2 with Glib-2.0 randoms.";
 
 
 
-/** The bug data type. */
-typedef struct bug {
-	size_t locus;
-	unsigned int ideal_temperature;	/* The temperature bug want to be at. */
-	unsigned int output_heat;	/* How much heat bug emit per time step. */
-} bug_t;
 
+/* To address bug's position neighbourhood. */
+enum {SW = 0, S, SE, W, E, NW, N, NE};
 
-/** Simulation buffers. */
-typedef struct hb_buffers {
-	bug_t *swarm;			/* SIZE: BUGS_NUM			- Bug's position in the swarm_map. */
-	unsigned int *swarm_map;	/* SIZE: WORLD_HEIGHT * WORLD_WIDTH	- Bug's presence. Each cell is zero (has no bug), or int (has bug). */
-	float *world_heat[2];		/* SIZE: WORLD_HEIGHT * WORLD_WIDTH	- Temperature maps: heat_map (primary and buffer). */
-	float *unhappiness;		/* SIZE: NUM_BUGS			- The Unhappiness vector. */
-} HBBuffers_t;
 
 
 
+/**
+ * Bits of the comma separated names in 'list', each the bit of its index
+ * in 'names', as '--columns unhappiness,max,histogram' (see stat_names)
+ * or '--aggregate mean,max' (see agg_names). Columns are always output in
+ * bits order, whatever the order in 'list'.
+ *
+ * @param[in]	list		- Names.
+ * @param[in]	names		- Known names, 'count' of them.
+ * @param[in]	what		- What they name, for errors.
+ * @param[out]	err		- GLib object for error reporting.
+ * @return	The bits, 0 on error.
+ * */
+static unsigned int columns_parse( const char *const list,
+			const char *const *const names, const int count,
+			const char *const what, GError **err )
+{
+	unsigned int columns = 0;
+	const char *name = list;
 
-const char version[] = "Heatbugs simulation for CPU (serial processing) v3.2 with Glib-2.0 randoms.";
 
+	for (;;)
+	{
+		const size_t len = strcspn( name, "," );
+		int bit = 0;
 
+		while ((bit < count) && ((strlen( names[ bit ] ) != len)
+				|| strncmp( name, names[ bit ], len )))
+			bit++;
 
+		hb_if_err_create_goto( *err, HB_ERROR,
+			bit == count,
+			HB_COLUMNS_UNKNOWN, error_handler,
+			"Unknown %s '%.*s'.", what, (int) len, name );
 
-/* To address bug's position neighbourhood. */
-enum {SW = 0, S, SE, W, E, NW, N, NE};
+		columns |= 1u << bit;
+
+		if (name[ len ] == '\0') break;
+		name += len + 1;
+	}
 
+	return columns;
 
 
-#define HB_ERROR hb_error_quark()
+error_handler:
+	/* If error handler is reached leave function imediately. */
 
-static GQuark hb_error_quark( void ) {
-	return g_quark_from_static_string( "hb-error-quark" );
+	return 0;
 }
 
 
@@ -203,12 +338,45 @@ void getSimulParameters( Parameters_t *const params, int argc,
 
 	int c;		/* Parsed command line option. */
 
+	gboolean iterations_set = FALSE;	/* '-i' given (for a restart). */
+
 	/* The string 't:T:h:H:r:n:d:e:w:W:i:f:' is the parameter string to   */
 	/* be checked by 'getopt' function.                                   */
 	/* The ':' character means that a value is required after the         */
 	/* parameter selector character (that is: -t 50  or  -t50).           */
 	const char matches[] = "t:T:h:H:r:n:d:e:w:W:i:s:f:";
 
+	/* Options without a short form, only available as '--option'.        */
+	const struct option long_matches[] = {
+		{ "threads",	required_argument,	NULL,	OPT_THREADS },
+		{ "diffusion",	required_argument,	NULL,	OPT_DIFFUSION },
+		{ "sparse",	required_argument,	NULL,	OPT_SPARSE },
+		{ "agents",	required_argument,	NULL,	OPT_AGENTS },
+		{ "tile-size",	required_argument,	NULL,	OPT_TILE_SIZE },
+		{ "order",	required_argument,	NULL,	OPT_ORDER },
+		{ "order-block", required_argument,	NULL,	OPT_ORDER_BLOCK },
+		{ "order-sort-every", required_argument, NULL,	OPT_ORDER_SORT_EVERY },
+		{ "rng",	required_argument,	NULL,	OPT_RNG },
+		{ "profile",	no_argument,		NULL,	OPT_PROFILE },
+		{ "format",	required_argument,	NULL,	OPT_FORMAT },
+		{ "columns",	required_argument,	NULL,	OPT_COLUMNS },
+		{ "output-every", required_argument,	NULL,	OPT_OUTPUT_EVERY },
+		{ "aggregate",	required_argument,	NULL,	OPT_AGGREGATE },
+		{ "converge",	required_argument,	NULL,	OPT_CONVERGE },
+		{ "converge-tol", required_argument,	NULL,	OPT_CONVERGE_TOL },
+		{ "async-output", no_argument,		NULL,	OPT_ASYNC_OUTPUT },
+		{ "snapshot-every", required_argument,	NULL,	OPT_SNAPSHOT_EVERY },
+		{ "snapshot-file", required_argument,	NULL,	OPT_SNAPSHOT_FILE },
+		{ "checkpoint-every", required_argument, NULL,	OPT_CHECKPOINT_EVERY },
+		{ "checkpoint-file", required_argument,	NULL,	OPT_CHECKPOINT_FILE },
+		{ "restart",	required_argument,	NULL,	OPT_RESTART },
+		{ "ensemble",	required_argument,	NULL,	OPT_ENSEMBLE },
+		{ "seeds",	required_argument,	NULL,	OPT_SEEDS },
+		{ "interleave",	no_argument,		NULL,	OPT_INTERLEAVE },
+		{ "sweep",	required_argument,	NULL,	OPT_SWEEP },
+		{ NULL,		0,			NULL,	0 }
+	};
+
 
 	/* Default / hardcoded parameters. */
 	params->numIterations = NUM_ITERATIONS;				/* i */
@@ -226,6 +394,33 @@ void getSimulParameters( Parameters_t *const params, int argc,
 
 	strcpy( params->output_filename, OUTPUT_FILENAME );		/* f */
 
+	params->threads = NUM_THREADS;				/* --threads */
+	params->diffusion = DIFFUSION_ENGINE;			/* --diffusion */
+	params->sparse_epsilon = SPARSE_EPSILON;		/* --sparse */
+	params->agents = AGENTS_ENGINE;				/* --agents */
+	params->tile_size = TILE_SIZE;				/* --tile-size */
+	params->order = ORDER_KIND;				/* --order */
+	params->order_block = ORDER_BLOCK;			/* --order-block */
+	params->order_sort_every = ORDER_SORT_EVERY;		/* --order-sort-every */
+	params->rng = RNG_KIND;					/* --rng */
+	params->profile = FALSE;				/* --profile */
+	params->format = OUTPUT_FORMAT;				/* --format */
+	params->columns = OUTPUT_COLUMNS;			/* --columns */
+	params->output_every = OUTPUT_EVERY;			/* --output-every */
+	params->aggregate = OUTPUT_AGGREGATE;			/* --aggregate */
+	params->converge_window = CONVERGE_WINDOW;		/* --converge */
+	params->converge_tolerance = CONVERGE_TOLERANCE;	/* --converge-tol */
+	params->async_output = OUTPUT_ASYNC;			/* --async-output */
+	params->snapshot_every = SNAPSHOT_EVERY;		/* --snapshot-every */
+	strcpy( params->snapshot_filename, SNAPSHOT_FILENAME );	/* --snapshot-file */
+	params->checkpoint_every = CHECKPOINT_EVERY;		/* --checkpoint-every */
+	strcpy( params->checkpoint_filename, CHECKPOINT_FILENAME );	/* --checkpoint-file */
+	params->restart_filename[ 0 ] = '\0';			/* --restart */
+	params->ensemble = 0;					/* --ensemble */
+	params->seeds = NULL;					/* --seeds */
+	params->interleave = FALSE;				/* --interleave */
+	params->sweep_filename[ 0 ] = '\0';			/* --sweep */
+
 
 	/* Read initial seed from linux /dev/urandom */
 	uranddev = fopen( "/dev/urandom", "r" );
@@ -236,11 +431,12 @@ void getSimulParameters( Parameters_t *const params, int argc,
 
 	rd = fread( &params->seed, sizeof( params->seed ), COUNT, uranddev );
 	fclose( uranddev );
+	params->seed_drawn = TRUE;
 
 
 	/* Parse command line arguments using GNU's getopt function. */
 
-	while ( (c = getopt( argc, argv, matches )) != -1 )
+	while ( (c = getopt_long( argc, argv, matches, long_matches, NULL )) != -1 )
 	{
 		switch (c)
 		{
@@ -287,23 +483,180 @@ void getSimulParameters( Parameters_t *const params, int argc,
 			case 'i':
 				params->numIterations =
 					atoi( optarg );
+				iterations_set = TRUE;
 				break;
 			case 's':
 				params->seed =
 					atoi( optarg );
+				params->seed_drawn = FALSE;
 				break;
 			case 'f':
 				strcpy( params->output_filename, optarg );
 				break;
+			case OPT_THREADS:
+				params->threads =
+					atoi( optarg );
+				break;
+			case OPT_DIFFUSION:
+				params->diffusion = 0;
+				while (params->diffusion < DIFFUSION_ENGINES
+					&& strcmp( optarg, diffusion_names[ params->diffusion ] ))
+					params->diffusion++;
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+					params->diffusion == DIFFUSION_ENGINES,
+					HB_DIFFUSION_UNKNOWN, error_handler,
+					"Unknown diffusion engine '%s'.", optarg );
+				break;
+			case OPT_SPARSE:
+				params->sparse_epsilon =
+					atof( optarg );
+				break;
+			case OPT_AGENTS:
+				params->agents = 0;
+				while (params->agents < AGENTS_ENGINES
+					&& strcmp( optarg, agents_names[ params->agents ] ))
+					params->agents++;
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+					params->agents == AGENTS_ENGINES,
+					HB_AGENTS_UNKNOWN, error_handler,
+					"Unknown agents engine '%s'.", optarg );
+				break;
+			case OPT_TILE_SIZE:
+				params->tile_size =
+					atoi( optarg );
+				break;
+			case OPT_ORDER:
+				params->order = 0;
+				while (params->order < ORDERS
+					&& strcmp( optarg, order_names[ params->order ] ))
+					params->order++;
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+					params->order == ORDERS,
+					HB_ORDER_INVALID, error_handler,
+					"Unknown bugs order '%s'.", optarg );
+				break;
+			case OPT_ORDER_BLOCK:
+				params->order_block =
+					atoi( optarg );
+				break;
+			case OPT_ORDER_SORT_EVERY:
+				params->order_sort_every =
+					atoi( optarg );
+				break;
+			case OPT_RNG:
+				params->rng = 0;
+				while (params->rng < HB_RNG_KINDS
+					&& strcmp( optarg, rng_names[ params->rng ] ))
+					params->rng++;
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+					params->rng == HB_RNG_KINDS,
+					HB_RNG_UNKNOWN, error_handler,
+					"Unknown random number generator '%s'.", optarg );
+				break;
+			case OPT_PROFILE:
+				params->profile = TRUE;
+				break;
+			case OPT_FORMAT:
+				params->format = 0;
+				while (params->format < HB_FORMATS
+					&& strcmp( optarg, format_names[ params->format ] ))
+					params->format++;
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+					params->format == HB_FORMATS,
+					HB_FORMAT_UNKNOWN, error_handler,
+					"Unknown results format '%s'.", optarg );
+				break;
+			case OPT_COLUMNS:
+				params->columns = columns_parse( optarg,
+					stat_names, HB_STATS, "output column", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_OUTPUT_EVERY:
+				params->output_every =
+					atoi( optarg );
+				break;
+			case OPT_AGGREGATE:
+				params->aggregate = columns_parse( optarg,
+					agg_names, HB_AGGS, "aggregate", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_CONVERGE:
+				params->converge_window =
+					atoi( optarg );
+				break;
+			case OPT_CONVERGE_TOL:
+				params->converge_tolerance =
+					atof( optarg );
+				break;
+			case OPT_ASYNC_OUTPUT:
+				params->async_output = TRUE;
+				break;
+			case OPT_SNAPSHOT_EVERY:
+				params->snapshot_every =
+					atoi( optarg );
+				break;
+			case OPT_SNAPSHOT_FILE:
+				hb_if_err_create_goto( *err, HB_ERROR,
+					strlen( optarg ) >= sizeof( params->snapshot_filename ),
+					HB_FILENAME_TOO_LONG, error_handler,
+					"Snapshot file name is too long." );
+				g_strlcpy( params->snapshot_filename, optarg,
+					sizeof( params->snapshot_filename ) );
+				break;
+			case OPT_CHECKPOINT_EVERY:
+				params->checkpoint_every =
+					atoi( optarg );
+				break;
+			case OPT_CHECKPOINT_FILE:
+				hb_if_err_create_goto( *err, HB_ERROR,
+					strlen( optarg ) >= sizeof( params->checkpoint_filename ),
+					HB_FILENAME_TOO_LONG, error_handler,
+					"Checkpoint file name is too long." );
+				g_strlcpy( params->checkpoint_filename, optarg,
+					sizeof( params->checkpoint_filename ) );
+				break;
+			case OPT_RESTART:
+				hb_if_err_create_goto( *err, HB_ERROR,
+					strlen( optarg ) >= sizeof( params->restart_filename ),
+					HB_FILENAME_TOO_LONG, error_handler,
+					"Restart file name is too long." );
+				g_strlcpy( params->restart_filename, optarg,
+					sizeof( params->restart_filename ) );
+				break;
+			case OPT_ENSEMBLE:
+				params->ensemble =
+					atoi( optarg );
+				break;
+			case OPT_SEEDS:
+				params->seeds = optarg;
+				break;
+			case OPT_INTERLEAVE:
+				params->interleave = TRUE;
+				break;
+			case OPT_SWEEP:
+				hb_if_err_create_goto( *err, HB_ERROR,
+					strlen( optarg ) >= sizeof( params->sweep_filename ),
+					HB_FILENAME_TOO_LONG, error_handler,
+					"Sweep file name is too long." );
+				g_strlcpy( params->sweep_filename, optarg,
+					sizeof( params->sweep_filename ) );
+				break;
 			case '?':
+				/* Long options report their value in 'optopt'. */
 				hb_if_err_create_goto( *err, HB_ERROR,
-					(optopt != ':'
+					(optopt >= OPT_THREADS)
+					|| (optopt != 0 && optopt != ':'
 					&& strchr( matches, optopt ) != NULL),
 					HB_PARAM_ARG_MISSING, error_handler,
 					"Option required argument missing." );
 
 				hb_if_err_create_goto( *err, HB_ERROR,
-					(isprint( optopt )),
+					(optopt == 0) || (isprint( optopt )),
 					HB_PARAM_OPTION_UNKNOWN, error_handler,
 					"Unknown option." );
 
@@ -324,7 +677,101 @@ void getSimulParameters( Parameters_t *const params, int argc,
 	   https://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
 	 */
 
-	params->world_size = params->world_height * params->world_width;
+	/* A restart simulates what its checkpoint did, checked again below. */
+	if (params->restart_filename[ 0 ] != '\0')
+	{
+		hb_checkpoint_params( params, iterations_set, err );
+		hb_if_err_goto( *err, error_handler );
+	}
+
+	checkSimulParameters( params, err );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Set the world's vector size, whether its sides are powers of 2, and the
+ * heat map's layout with its ghost border (see HEAT_CELL in heatbugs.h),
+ * from its width and height.
+ *
+ * @param[in,out]	params		- Parameters with the world sides.
+ * */
+void world_geometry( Parameters_t *const params )
+{
+	const size_t width = params->world_width;
+	const size_t height = params->world_height;
+
+
+	params->world_size = height * width;
+
+	params->world_pow2 = (width > 0) && (height > 0)
+		&& ((width & (width - 1)) == 0) && ((height & (height - 1)) == 0);
+
+	params->world_shift = 0;
+	if (params->world_pow2)
+		while (((size_t) 1 << params->world_shift) < width)
+			params->world_shift++;
+
+	params->heat_stride = width + 2;
+	params->heat_size = (height + 2) * (width + 2);
+
+	{
+		const ptrdiff_t row = (ptrdiff_t) params->heat_stride;
+
+		params->heat_offset[ SW ] = -row - 1;
+		params->heat_offset[ S  ] = -row;
+		params->heat_offset[ SE ] = -row + 1;
+		params->heat_offset[ W  ] = -1;
+		params->heat_offset[ E  ] = +1;
+		params->heat_offset[ NW ] = +row - 1;
+		params->heat_offset[ N  ] = +row;
+		params->heat_offset[ NE ] = +row + 1;
+	}
+
+	return;
+}
+
+
+
+/**
+ * Number of tiles along a world side of 'cells' cells: the largest even
+ * number of tiles at least 'tile_size' wide, or a single tile when the
+ * side is too short for two (which checkSimulParameters(...) rejects). An
+ * even number keeps colours alternating across the toroidal wrap.
+ * */
+static size_t checkerboard_tiles( const size_t cells, const size_t tile_size )
+{
+	const size_t tiles = (cells / tile_size) & ~((size_t) 1);
+
+	return (tiles < 2) ? 1 : tiles;
+}
+
+
+
+/**
+ * Complete and check the parameters, as set from the command line (or by
+ * a sweep, see hb_sweep.h): world size, ranges, engines and generator.
+ *
+ * @param[in,out]	params		- Parameters to check.
+ * @param[out]		err		- GLib object for error reporting.
+ * */
+void checkSimulParameters( Parameters_t *const params, GError **err )
+{
+#ifdef HB_HEAT_16
+	double heat_bound;	/* Most heat a cell can hold. */
+#endif
+#ifdef HB_HEAT_DIGITS
+	int exponent;
+#endif
+
+
+	world_geometry( params );
 
 	/* Check for bug's number related errors. */
 	hb_if_err_create_goto( *err, HB_ERROR,
@@ -337,6 +784,11 @@ void getSimulParameters( Parameters_t *const params, int argc,
 		HB_BUGS_OVERFLOW, error_handler,
 		"Number of bugs exceed available world slots." );
 
+	hb_if_err_create_goto( *err, HB_ERROR,
+		params->world_size - 1 > HB_LOCUS_MAX,
+		HB_WORLD_TOO_BIG, error_handler,
+		"World too big for bug positions (build with -DHB_LOCUS_64)." );
+
 	/* Check range related erros in bug's ideal temperature. */
 	/* Checking order matters!                               */
 	hb_if_err_create_goto( *err, HB_ERROR,
@@ -365,72 +817,173 @@ void getSimulParameters( Parameters_t *const params, int argc,
 	/* Seed related problem. */
 
 
-	/* If numeber of bugs is 80% of the world space issue a warning. */
-	if (params->bugs_number >= 0.8 * params->world_size)
-		fprintf( stderr,
-			"Warning: Bugs number near available world slots.\n" );
+	/* Check the number of threads. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->threads == 0) || (params->threads > MAX_THREADS),
+		HB_THREADS_OUT_RANGE, error_handler,
+		"Number of threads is out of range." );
 
+#ifdef HB_HEAT_16
+	/* Check the diffusion engine sums in float, not in the heat map. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->diffusion == DIFFUSION_V1)
+		|| (params->diffusion == DIFFUSION_V2),
+		HB_HEAT_STORAGE, error_handler,
+		"The v1 and v2 diffusion engines need float heat cells." );
+
+	/* Check 16 bit cells hold the heat, see hb_heat_t in heatbugs.h. */
+	if (params->bugs_heat_max_output == 0)
+		heat_bound = 0.0;
+	else if (params->world_evaporation_rate > 0)
+		heat_bound = params->bugs_heat_max_output
+			* (1.0 - params->world_evaporation_rate)
+			/ params->world_evaporation_rate;
+	else
+		heat_bound = HUGE_VAL;
+
+#ifdef HB_HEAT_MAX
+	hb_if_err_create_goto( *err, HB_ERROR,
+		heat_bound > HB_HEAT_MAX,
+		HB_HEAT_STORAGE, error_handler,
+		"Heat may reach %g, over the %g this build's cells hold: raise "
+		"the evaporation rate or lower the bugs' output heat.",
+		heat_bound, HB_HEAT_MAX );
+#endif
+
+#ifdef HB_HEAT_DIGITS
+	frexp( heat_bound, &exponent );
+
+	if (isinf( heat_bound ) || (ldexp( 1.0, exponent - HB_HEAT_DIGITS )
+					> params->bugs_heat_max_output))
+		fprintf( stderr,
+			"Warning: Heat may reach %g, where this build's cells "
+			"round bugs' output heat away.\n", heat_bound );
+#endif
+#endif
 
-error_handler:
-	/* If error handler is reached leave function imediately. */
+	/* Check sparse diffusion, its tiles skip the fused kernel only. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->sparse_epsilon >= 0)
+		&& (params->diffusion != DIFFUSION_FUSED),
+		HB_SPARSE_INVALID, error_handler,
+		"Sparse diffusion only works with the fused diffusion engine." );
 
-	return;
-}
+	/* Check records. A checkpoint resumes output after a record. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->output_every == 0)
+		|| (params->checkpoint_every % params->output_every != 0),
+		HB_OUTPUT_EVERY_INVALID, error_handler,
+		"Iterations between records must be 1 or more, and divide "
+		"those between checkpoints." );
 
+	hb_if_err_create_goto( *err, HB_ERROR,
+		hb_output_columns( params ) > HB_MAX_COLUMNS,
+		HB_COLUMNS_UNKNOWN, error_handler,
+		"More than %d values per record.", HB_MAX_COLUMNS );
 
+	/* Check the convergence stop. A window over half the iterations */
+	/* never fills both halves, the run goes on to the end.          */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->converge_tolerance < 0)
+		|| ((params->numIterations > 0)
+			&& (params->converge_window > params->numIterations / 2)),
+		HB_CONVERGE_INVALID, error_handler,
+		"Convergence window must be up to half the iterations, with a "
+		"tolerance of 0 or more." );
+
+	/* Check checkerboard tiles: at least two along each side, and an */
+	/* even number of them, or same colour tiles would touch.         */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->tile_size < MIN_TILE_SIZE)
+		|| ((params->agents == AGENTS_CHECKERBOARD)
+			&& (params->tile_size > MIN( params->world_width,
+						params->world_height ) / 2)),
+		HB_TILE_SIZE_OUT_RANGE, error_handler,
+		"Tile size is out of range." );
 
-/**
- * Create all the buffers for both, host and device.
- *
- * @param[out]	buff		- The structure with all host buffers to be
- *				  filled.
- * @param[in]	params		- The structure with all simulation parameters.
- *				  Used to compute 'buff' sizes.
- * @param[out]	err		- GLib object for error reporting.
- * */
-void setupBuffers( HBBuffers_t *const buff, const Parameters_t *const params,
-				GError **err )
-{
-	/* GError *err_setbuf = NULL; */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->agents == AGENTS_CHECKERBOARD)
+		&& ((checkerboard_tiles( params->world_width, params->tile_size ) % 2)
+			|| (checkerboard_tiles( params->world_height, params->tile_size ) % 2)),
+		HB_TILE_SIZE_OUT_RANGE, error_handler,
+		"Number of tiles along each side of the world must be even." );
 
+	/* Check bugs order. The checkerboard engine has its own. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->order_block == 0) || (params->order_block > MAX_ORDER_BLOCK)
+		|| (params->order_block & (params->order_block - 1))
+		|| (params->order_sort_every == 0),
+		HB_ORDER_INVALID, error_handler,
+		"Order block must be a power of 2 up to %d, sorted every 1 or "
+		"more iterations.", MAX_ORDER_BLOCK );
 
-	/** SWARM. */
-	buff->swarm = (bug_t *) malloc( params->bugs_number * sizeof( bug_t ) );
 	hb_if_err_create_goto( *err, HB_ERROR,
-		buff->swarm == NULL,
-		HB_MALLOC_FAILURE, error_handler,
-		"Unable to allocate memory for swarm vector." );
+		(params->order != ORDER_RANDOM)
+		&& (params->agents == AGENTS_CHECKERBOARD),
+		HB_ORDER_INVALID, error_handler,
+		"The checkerboard agents engine sets the bugs order itself." );
+
+	/* GLib's generator is one sequential stream, it can't be shared, */
+	/* nor its state saved in a checkpoint.                           */
+	if (params->rng == RNG_AUTO)
+		params->rng = (params->agents == AGENTS_SERIAL)
+				&& (params->checkpoint_every == 0)
+					? HB_RNG_GLIB : HB_RNG_PHILOX;
 
+	hb_if_err_create_goto( *err, HB_ERROR,
+		(params->rng == HB_RNG_GLIB) && (params->agents != AGENTS_SERIAL),
+		HB_RNG_SERIAL_ONLY, error_handler,
+		"GLib's generator only works with the serial agents engine." );
 
-	/** SWARM MAP. */
-	buff->swarm_map = (unsigned int *) malloc( params->world_size * sizeof( unsigned int ) );
 	hb_if_err_create_goto( *err, HB_ERROR,
-		buff->swarm_map == NULL,
-		HB_MALLOC_FAILURE, error_handler,
-		"Unable to allocate memory for swarm map array." );
+		(params->rng == HB_RNG_GLIB) && (params->checkpoint_every > 0),
+		HB_CHECKPOINT_RNG, error_handler,
+		"Checkpoints need the philox generator, GLib's can't be saved." );
 
+	/* Ensembles: a seed list sets the number of simulations. */
+	if (params->seeds)
+	{
+		params->ensemble = hb_ensemble_seeds( params->seeds, NULL );
 
-	/** HEAT MAP & Buffer. */
-	buff->world_heat[ MAP ] = (float *) malloc( params->world_size * sizeof( float ) );
-	hb_if_err_create_goto( *err, HB_ERROR,
-		buff->world_heat[ MAP ] == NULL,
-		HB_MALLOC_FAILURE, error_handler,
-		"Unable to allocate memory for heat map array." );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			params->ensemble == 0,
+			HB_ENSEMBLE_INVALID, error_handler,
+			"Invalid seed list '%s'.", params->seeds );
+	}
 
-	/* Buffer... */
-	buff->world_heat[ BUFFER ] = (float *) malloc( params->world_size * sizeof( float ) );
 	hb_if_err_create_goto( *err, HB_ERROR,
-		buff->world_heat[ BUFFER ] == NULL,
-		HB_MALLOC_FAILURE, error_handler,
-		"Unable to allocate memory for heat map buffer array." );
+		(params->ensemble > 0) && ((params->checkpoint_every > 0)
+			|| (params->restart_filename[ 0 ] != '\0')
+			|| params->profile),
+		HB_ENSEMBLE_INVALID, error_handler,
+		"Ensembles can't be profiled, checkpointed or restarted." );
 
+	hb_if_err_create_goto( *err, HB_ERROR,
+		params->interleave && ((params->ensemble == 0)
+			|| (params->format != HB_FORMAT_BINARY)),
+		HB_ENSEMBLE_INVALID, error_handler,
+		"Only ensembles with binary results can be interleaved." );
 
-	/** UNHAPPINESS */
-	buff->unhappiness = (float *) malloc( params->bugs_number * sizeof( float ) );
+	/* A sweep sets each job's seed and files itself. */
 	hb_if_err_create_goto( *err, HB_ERROR,
-		buff->unhappiness == NULL,
-		HB_MALLOC_FAILURE, error_handler,
-		"Unable to allocate memory for unhappiness vector." );
+		(params->sweep_filename[ 0 ] != '\0') && ((params->ensemble > 0)
+			|| (params->checkpoint_every > 0)
+			|| (params->restart_filename[ 0 ] != '\0')
+			|| params->profile),
+		HB_SWEEP_INVALID, error_handler,
+		"Sweeps can't be ensembles, profiled, checkpointed or restarted." );
+
+	/* Binary results don't go to the default '.csv' file. */
+	if ((params->format == HB_FORMAT_BINARY)
+		&& (strcmp( params->output_filename, OUTPUT_FILENAME ) == 0))
+		strcpy( params->output_filename, OUTPUT_FILENAME_BIN );
+
+
+	/* If numeber of bugs is 80% of the world space issue a warning. */
+	if (params->bugs_number >= 0.8 * params->world_size)
+		fprintf( stderr,
+			"Warning: Bugs number near available world slots.\n" );
+
 
 
 error_handler:
@@ -442,834 +995,2791 @@ error_handler:
 
 
 /**
- * Initiate the world and create agents.
- *
- * @param[out]	buff	 	- The structure with all buffers to be filled,
- *			   	  and agents to be created.
- * @param[in]	params	 	- Provide the parameters for buffer's
- *				  initialization.
-  * */
-void initiate( HBBuffers_t *const buff, const Parameters_t *const params )
+ * Free the checkerboard tiles.
+ * */
+void freeCheckerBoard( CheckerBoard_t *board )
 {
-	size_t bug_locus;
+	if (!board) return;
 
+	if (board->colour_tiles) free( board->colour_tiles );
+	if (board->tile_bugs) free( board->tile_bugs );
+	if (board->tile_fill) free( board->tile_fill );
+	if (board->tile_start) free( board->tile_start );
+	if (board->row_tile) free( board->row_tile );
+	if (board->col_tile) free( board->col_tile );
 
-	/* Set seed for GLibs's global random number generator. */
-	g_random_set_seed( params->seed );
+	free( board );
 
+	return;
+}
 
-	/* Set vectors to zero. */
-	memset( buff->swarm_map, RESET, params->world_size * sizeof( unsigned int ) );
 
-	/* WARNING: memset may not be portable when zero down non IEEE 754 floats. */
-	memset( buff->world_heat[ MAP ], RESET, params->world_size * sizeof( float ) );
-	memset( buff->world_heat[ BUFFER ], RESET, params->world_size * sizeof( float ) );
-	memset( buff->unhappiness, RESET, params->bugs_number * sizeof( float ) );
 
+/**
+ * Create the checkerboard tiles used by bug_step_checkerboard(...). The
+ * tiling depends only on world size and 'tile_size', never on the number
+ * of threads.
+ *
+ * @param[in]	params		- Simulation parameters.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+CheckerBoard_t *setupCheckerBoard( const Parameters_t *const params,
+							GError **err )
+{
+	CheckerBoard_t *board = NULL;
+	size_t tx, ty, colour, fill;
 
-	/* Initiate swarm (that is, bug population) and swarm map. */
 
-	/* Choose 'bugs_number' number of random world positions. */
-	for (size_t bug_id = 0; bug_id < params->bugs_number; bug_id++)
-	{
-		/* Find a new free position. */
-		do {
-			bug_locus = (size_t) g_random_int_range( 0, params->world_size );	/* Interval [0..world_size[ as it should! */
-		} while (HAS_BUG( buff->swarm_map[ bug_locus ] ));
+	board = (CheckerBoard_t *) calloc( 1, sizeof( CheckerBoard_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		board == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for checkerboard." );
 
-		/* Free position found, create new bug in the swarm_map. */
-		NEW_BUG_IN( buff->swarm_map[ bug_locus ] );
+	board->tiles_x = checkerboard_tiles( params->world_width, params->tile_size );
+	board->tiles_y = checkerboard_tiles( params->world_height, params->tile_size );
+	board->tiles = board->tiles_x * board->tiles_y;
 
+	board->col_tile = (guint32 *) malloc( params->world_width * sizeof( guint32 ) );
+	board->row_tile = (guint32 *) malloc( params->world_height * sizeof( guint32 ) );
+	board->tile_start = (size_t *) malloc( (board->tiles + 1) * sizeof( size_t ) );
+	board->tile_fill = (size_t *) malloc( board->tiles * sizeof( size_t ) );
+	board->tile_bugs = (size_t *) malloc( params->bugs_number * sizeof( size_t ) );
+	board->colour_tiles = (size_t *) malloc( board->tiles * sizeof( size_t ) );
 
-		/* Create the bug's data in the swarm. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!board->col_tile || !board->row_tile || !board->tile_start
+		|| !board->tile_fill || !board->tile_bugs || !board->colour_tiles,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for checkerboard tiles." );
 
-		SET_BUG_LOCAL( buff->swarm[ bug_id ].locus, bug_locus );
 
-		SET_BUG_IDEAL_TEMPERATURE( buff->swarm[ bug_id ].ideal_temperature,
-			g_random_int_range( params->bugs_temperature_min_ideal,
-					params->bugs_temperature_max_ideal ) );
+	/* Tile 't' covers cells [t * cells / tiles .. (t + 1) * cells / tiles[. */
+	for (tx = 0; tx < board->tiles_x; tx++)
+		for (size_t col = tx * params->world_width / board->tiles_x;
+			col < (tx + 1) * params->world_width / board->tiles_x; col++)
+			board->col_tile[ col ] = tx;
 
-		SET_BUG_OUTPUT_HEAT( buff->swarm[ bug_id ].output_heat,
-			g_random_int_range( params->bugs_heat_min_output ,
-					params->bugs_heat_max_output ) );
+	for (ty = 0; ty < board->tiles_y; ty++)
+		for (size_t row = ty * params->world_height / board->tiles_y;
+			row < (ty + 1) * params->world_height / board->tiles_y; row++)
+			board->row_tile[ row ] = ty;
 
-		/* Update initial bug unhappiness as abs(ideal_temperature -
-		 * temperature).
-		 * Since world temperature is initial zero, it turns out that
-		 * initial unhappiness = ideal_temperature.
-		 * */
 
-		buff->unhappiness[ bug_id ] = (float) buff->swarm[ bug_id ].ideal_temperature;
+	/* Group tiles by colour: (x parity) + 2 * (y parity). */
+	fill = 0;
+
+	for (colour = 0; colour < TILE_COLOURS; colour++)
+	{
+		board->colour_start[ colour ] = fill;
+
+		for (ty = 0; ty < board->tiles_y; ty++)
+			for (tx = 0; tx < board->tiles_x; tx++)
+				if (((tx & 1) | ((ty & 1) << 1)) == colour)
+					board->colour_tiles[ fill++ ] =
+						ty * board->tiles_x + tx;
 	}
 
-	return;
+	board->colour_start[ TILE_COLOURS ] = fill;
+
+	return board;
+
+
+error_handler:
+	/* If error handler is reached, release whatever was created. */
+
+	freeCheckerBoard( board );
+
+	return NULL;
 }
 
 
 
 /**
- * Initiate the world and create agents.
- *
- * @param[in]	heat_map	- The buffer with temperature data.
- * @param[out]	heat_buffer	- Buffer to be used as heat computation holder
- *				  (i.e. a double buffer).
+ * Free the spatial order.
+ * */
+void freeSpatialOrder( SpatialOrder_t *order )
+{
+	if (!order) return;
+
+	if (order->block_start) free( order->block_start );
+	if (order->sorted) free( order->sorted );
+
+	free( order );
+
+	return;
+}
+
+
+
+/**
+ * Create the spatial order used by shuffle_bugs_spatial(...), bugs in id
+ * order until first sorted.
+ *
+ * @param[in]	params		- Simulation parameters.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+SpatialOrder_t *setupSpatialOrder( const Parameters_t *const params,
+							GError **err )
+{
+	SpatialOrder_t *order = NULL;
+
+
+	order = (SpatialOrder_t *) calloc( 1, sizeof( SpatialOrder_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		order == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for bugs order." );
+
+	while (((size_t) 1 << order->block_shift) < params->order_block)
+		order->block_shift++;
+
+	order->sorted = (OrderKey_t *) malloc( params->bugs_number * sizeof( OrderKey_t ) );
+	order->block_start = (size_t *) malloc( (params->bugs_number + 1) * sizeof( size_t ) );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!order->sorted || !order->block_start,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for bugs order blocks." );
+
+	for (size_t idx = 0; idx < params->bugs_number; idx++)
+	{
+		order->sorted[ idx ].key = 0;
+		order->sorted[ idx ].id = idx;
+	}
+
+	return order;
+
+
+error_handler:
+	/* If error handler is reached, release whatever was created. */
+
+	freeSpatialOrder( order );
+
+	return NULL;
+}
+
+
+
+/**
+ * Free the sparse diffusion tiles.
+ * */
+void freeActivity( Activity_t *activity )
+{
+	if (!activity) return;
+
+	for (int buf = MAP; buf <= BUFFER; buf++)
+	{
+		if (activity->cold[ buf ]) free( activity->cold[ buf ] );
+		if (activity->hot[ buf ]) free( activity->hot[ buf ] );
+	}
+
+	if (activity->heat) free( activity->heat );
+
+	free( activity );
+
+	return;
+}
+
+
+
+/**
+ * Create the tiles used by comp_world_heat_sparse(...), SPARSE_TILE cells
+ * a side (less at the world's north and east edges). All start hot, so
+ * the first iteration computes the whole world, whatever is in it (e.g.
+ * a restart's heat map).
+ *
+ * @param[in]	params		- Simulation parameters.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+Activity_t *setupActivity( const Parameters_t *const params, GError **err )
+{
+	Activity_t *activity = NULL;
+	size_t tiles;
+
+
+	activity = (Activity_t *) calloc( 1, sizeof( Activity_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		activity == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for sparse diffusion." );
+
+	activity->tiles_x = (params->world_width + SPARSE_TILE - 1) / SPARSE_TILE;
+	activity->tiles_y = (params->world_height + SPARSE_TILE - 1) / SPARSE_TILE;
+	tiles = activity->tiles_x * activity->tiles_y;
+
+	for (int buf = MAP; buf <= BUFFER; buf++)
+	{
+		activity->hot[ buf ] = (guint8 *) malloc( tiles );
+		activity->cold[ buf ] = (guint8 *) calloc( tiles, 1 );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+			!activity->hot[ buf ] || !activity->cold[ buf ],
+			HB_MALLOC_FAILURE, error_handler,
+			"Unable to allocate memory for sparse diffusion tiles." );
+
+		memset( activity->hot[ buf ], 1, tiles );
+	}
+
+	activity->heat = (HBSum_t *) malloc( activity->tiles_y * sizeof( HBSum_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		activity->heat == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for sparse diffusion tiles." );
+
+	return activity;
+
+
+error_handler:
+	/* If error handler is reached, release whatever was created. */
+
+	freeActivity( activity );
+
+	return NULL;
+}
+
+
+
+/**
+ * Free the convergence stop's averages.
+ * */
+void freeConvergence( Convergence_t *conv )
+{
+	if (!conv) return;
+
+	if (conv->averages) free( conv->averages );
+
+	free( conv );
+
+	return;
+}
+
+
+
+/**
+ * Create the two windows of averages compared by converged(...), empty.
+ *
+ * @param[in]	params		- Simulation parameters.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+Convergence_t *setupConvergence( const Parameters_t *const params, GError **err )
+{
+	Convergence_t *conv = NULL;
+
+
+	conv = (Convergence_t *) calloc( 1, sizeof( Convergence_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		conv == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the convergence stop." );
+
+	conv->window = params->converge_window;
+	conv->averages = (double *) malloc( 2 * conv->window * sizeof( double ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		conv->averages == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for the convergence stop." );
+
+	return conv;
+
+
+error_handler:
+	/* If error handler is reached, release whatever was created. */
+
+	freeConvergence( conv );
+
+	return NULL;
+}
+
+
+
+/**
+ * Allocate 'size' bytes aligned to HB_ALIGN. Released with free(...).
+ *
+ * @return		- The memory, or NULL if none.
+ * */
+void *hb_aligned_alloc( const size_t size )
+{
+	void *ptr;
+
+	if (posix_memalign( &ptr, HB_ALIGN, size ? size : HB_ALIGN ) != 0)
+		return NULL;
+
+	return ptr;
+}
+
+
+
+/**
+ * Free the swarm arrays. Safe on partly set up swarms.
+ * */
+void freeSwarm( Swarm_t *const swarm )
+{
+	if (swarm->output_heat) free( swarm->output_heat );
+	if (swarm->ideal_temperature) free( swarm->ideal_temperature );
+	if (swarm->locus) free( swarm->locus );
+
+	memset( swarm, 0, sizeof( Swarm_t ) );
+
+	return;
+}
+
+
+
+/**
+ * Create the swarm arrays, aligned, for 'bugs' bugs.
+ *
+ * @param[out]	swarm		- The swarm to set up.
+ * @param[in]	bugs		- Number of bugs.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+void setupSwarm( Swarm_t *const swarm, const size_t bugs, GError **err )
+{
+	swarm->locus = (hb_locus_t *) hb_aligned_alloc( bugs * sizeof( hb_locus_t ) );
+	swarm->ideal_temperature = (guint8 *) hb_aligned_alloc( bugs * sizeof( guint8 ) );
+	swarm->output_heat = (guint8 *) hb_aligned_alloc( bugs * sizeof( guint8 ) );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+		!swarm->locus || !swarm->ideal_temperature || !swarm->output_heat,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for swarm vectors." );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Create all the buffers for both, host and device.
+ *
+ * @param[out]	buff		- The structure with all host buffers to be
+ *				  filled.
+ * @param[in]	params		- The structure with all simulation parameters.
+ *				  Used to compute 'buff' sizes.
+ * @param[out]	err		- GLib object for error reporting.
+ * */
+void setupBuffers( HBBuffers_t *const buff, const Parameters_t *const params,
+				GError **err )
+{
+	/* GError *err_setbuf = NULL; */
+
+
+	/** SWARM. */
+	setupSwarm( &buff->swarm, params->bugs_number, err );
+	hb_if_err_goto( *err, error_handler );
+
+
+	/** SWARM MAP. */
+	buff->swarm_map = (hb_map_t *) malloc( HB_MAP_BYTES( params->world_size ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		buff->swarm_map == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for swarm map array." );
+
+
+	/** HEAT MAP & Buffer. */
+	buff->world_heat[ MAP ] = (hb_heat_t *) malloc( params->heat_size * sizeof( hb_heat_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		buff->world_heat[ MAP ] == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for heat map array." );
+
+	/* Buffer... */
+	buff->world_heat[ BUFFER ] = (hb_heat_t *) malloc( params->heat_size * sizeof( hb_heat_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		buff->world_heat[ BUFFER ] == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for heat map buffer array." );
+
+
+	/** UNHAPPINESS */
+	buff->unhappiness = (float *) malloc( params->bugs_number * sizeof( float ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		buff->unhappiness == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for unhappiness vector." );
+
+
+	/** BOX-SUM ROWS, three per thread. */
+	if (params->diffusion == DIFFUSION_BOXSUM)
+	{
+		buff->row_sums = (float *) malloc( 3 * params->world_width
+					* params->threads * sizeof( float ) );
+		hb_if_err_create_goto( *err, HB_ERROR,
+			buff->row_sums == NULL,
+			HB_MALLOC_FAILURE, error_handler,
+			"Unable to allocate memory for box-sum row buffers." );
+	}
+
+
+	/** BUGS ID, the order bugs move in. */
+	buff->ids = (size_t *) malloc( params->bugs_number * sizeof( size_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		buff->ids == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for bugs id vector." );
+
+
+	/** AGENT STATES, one per thread. The first is the main thread's. */
+	buff->agent_states = (AgentState_t *) calloc( params->threads,
+					sizeof( AgentState_t ) );
+	hb_if_err_create_goto( *err, HB_ERROR,
+		buff->agent_states == NULL,
+		HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate memory for agent states." );
+
+
+	/** CHECKERBOARD TILES. */
+	if (params->agents == AGENTS_CHECKERBOARD)
+	{
+		buff->board = setupCheckerBoard( params, err );
+		hb_if_err_goto( *err, error_handler );
+	}
+
+
+	/** SPARSE DIFFUSION TILES. */
+	if (params->sparse_epsilon >= 0)
+	{
+		buff->activity = setupActivity( params, err );
+		hb_if_err_goto( *err, error_handler );
+	}
+
+
+	/** CONVERGENCE STOP. */
+	if (params->converge_window > 0)
+	{
+		buff->converge = setupConvergence( params, err );
+		hb_if_err_goto( *err, error_handler );
+	}
+
+
+	/** SPATIAL ORDER. */
+	if (params->order == ORDER_MORTON)
+	{
+		buff->order = setupSpatialOrder( params, err );
+		hb_if_err_goto( *err, error_handler );
+	}
+
+
+	/** GLIB GENERATOR, not shared with other simulations (ensembles). */
+	buff->grand = g_rand_new_with_seed( params->seed );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Initiate the world and create agents.
+ *
+ * @param[out]	buff	 	- The structure with all buffers to be filled,
+ *			   	  and agents to be created.
+ * @param[in]	params	 	- Provide the parameters for buffer's
+ *				  initialization.
+  * */
+void initiate( HBBuffers_t *const buff, const Parameters_t *const params )
+{
+	HBRng_t *const rng = &buff->agent_states[ 0 ].rng;
+	size_t bug_locus;
+
+
+	/* Set seed for the simulation's GLib generator. Same numbers as */
+	/* GLibs's global one, g_random_set_seed(...), would give.          */
+	g_rand_set_seed( buff->grand, params->seed );
+
+	/* Every thread's generator, and its neighbours order (as the enum). */
+	for (unsigned int t = 0; t < params->threads; t++)
+	{
+		hb_rng_init( &buff->agent_states[ t ].rng, params->rng,
+						params->seed, buff->grand );
+
+		for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+			buff->agent_states[ t ].neighbour_idx[ n ] = n;
+	}
+
+
+	/* Set vectors to zero. */
+	memset( buff->swarm_map, RESET, HB_MAP_BYTES( params->world_size ) );
+
+	/* WARNING: memset may not be portable when zero down non IEEE 754 floats. */
+	memset( buff->world_heat[ MAP ], RESET, params->heat_size * sizeof( hb_heat_t ) );
+	memset( buff->world_heat[ BUFFER ], RESET, params->heat_size * sizeof( hb_heat_t ) );
+	memset( buff->unhappiness, RESET, params->bugs_number * sizeof( float ) );
+
+	/* Bugs move in id order, until first shuffled. */
+	for (size_t idx = 0; idx < params->bugs_number; idx++)
+		buff->ids[ idx ] = idx;
+
+
+	/* Initiate swarm (that is, bug population) and swarm map. */
+
+	/* Choose 'bugs_number' number of random world positions. */
+	for (size_t bug_id = 0; bug_id < params->bugs_number; bug_id++)
+	{
+		hb_rng_stream( rng, HB_STREAM_INIT, 0, bug_id );
+
+		/* Find a new free position. */
+		do {
+			bug_locus = (size_t) hb_rng_uint64_range( rng, 0, params->world_size );	/* Interval [0..world_size[ as it should! */
+		} while (MAP_HAS_BUG( buff->swarm_map, bug_locus ));
+
+		/* Free position found, create new bug in the swarm_map. */
+		MAP_SET_BUG( buff->swarm_map, bug_locus );
+
+
+		/* Create the bug's data in the swarm. */
+
+		SET_BUG_LOCAL( buff->swarm.locus[ bug_id ], bug_locus );
+
+		SET_BUG_IDEAL_TEMPERATURE( buff->swarm.ideal_temperature[ bug_id ],
+			hb_rng_int_range( rng, params->bugs_temperature_min_ideal,
+					params->bugs_temperature_max_ideal ) );
+
+		SET_BUG_OUTPUT_HEAT( buff->swarm.output_heat[ bug_id ],
+			hb_rng_int_range( rng, params->bugs_heat_min_output ,
+					params->bugs_heat_max_output ) );
+
+		/* Update initial bug unhappiness as abs(ideal_temperature -
+		 * temperature).
+		 * Since world temperature is initial zero, it turns out that
+		 * initial unhappiness = ideal_temperature.
+		 * */
+
+		buff->unhappiness[ bug_id ] = (float) buff->swarm.ideal_temperature[ bug_id ];
+	}
+
+	return;
+}
+
+
+
+/**
+ * Initiate the world and create agents.
+ * Neighbours are at fixed offsets in the heat map, its ghost border
+ * standing for the cells across the torus edges (see HEAT_CELL).
+ *
+ * @param[in]	heat_map	- The buffer with temperature data.
+ * @param[out]	heat_buffer	- Buffer to be used as heat computation holder
+ *				  (i.e. a double buffer).
+ * @param[in]	params	 	- Provide buffer's and simulation parameters.
+ * */
+void comp_world_heat_v1( const float *const heat_map,
+				float *const heat_buffer,
+				const Parameters_t *const params )
+{
+/* Debug */
+/*
+for (size_t wpos = 0; wpos < params->world_size; wpos++)
+	heat_map[wpos] = wpos + 1;
+*/
+
+	const ptrdiff_t *const offset = params->heat_offset;
+
+
+	/*
+	 * The vectors 'heat_map' and 'heat_buffer' grow from left to right
+	 * (west to east) and then from bottom to top (south to north).
+	 * Follow the world's cells in heat_buffer and find the heat
+	 * contribution from all their neighbours present in 'heat_map'.
+	 * */
+	for (size_t row = 0; row < params->world_height; row++)
+	{
+		size_t wpos = HEAT_CELL( params, row, 0 );
+
+		for (size_t col = 0; col < params->world_width; col++, wpos++)
+		{
+			/** Compute diffusion. */
+
+			heat_buffer[ wpos ]  = heat_map[ wpos + offset[ NW ] ];	/* STORE the heat. */
+			heat_buffer[ wpos ] += heat_map[ wpos + offset[ N  ] ];	/* Accumulate the heat. */
+			heat_buffer[ wpos ] += heat_map[ wpos + offset[ NE ] ];
+			heat_buffer[ wpos ] += heat_map[ wpos + offset[ W  ] ];
+			heat_buffer[ wpos ] += heat_map[ wpos + offset[ E  ] ];
+			heat_buffer[ wpos ] += heat_map[ wpos + offset[ SW ] ];
+			heat_buffer[ wpos ] += heat_map[ wpos + offset[ S  ] ];
+			heat_buffer[ wpos ] += heat_map[ wpos + offset[ SE ] ];
+
+			/* Get the 8th of the diffusion percentage of all neighbour cells. */
+			heat_buffer[ wpos ] = heat_buffer[ wpos ] * params->world_diffusion_rate / 8;
+
+			/* Add cell's remaining heat. */
+			heat_buffer[ wpos ] += heat_map[ wpos ] * (1 - params->world_diffusion_rate);
+
+
+			/** Compute evaporation. */
+
+			heat_buffer[ wpos ] = heat_buffer[ wpos ] * (1 - params->world_evaporation_rate);
+		}
+	}
+
+/* Debug */
+/*
+	size_t pos;
+	size_t lin = params->world_height - 1;
+	do {
+		for (size_t col = 0; col < params->world_width; col++)
+		{
+			pos = HEAT_CELL( params, lin, col );
+
+			printf( "%05.2f ", heat_buffer[pos] );
+		}
+		printf( "\n" );
+	} while (lin-- > 0);
+
+	exit(0);
+*/
+
+	return;
+}
+
+
+
+/**
+ * One pass of comp_world_heat_v2(...): store (when 'first') or accumulate
+ * in every world cell of 'heat_buffer' the heat of its neighbour at
+ * 'offset' in 'heat_map'.
+ * */
+static void heat_v2_pass( const float *const heat_map,
+	float *const heat_buffer, const Parameters_t *const params,
+	const ptrdiff_t offset, const gboolean first )
+{
+	for (size_t row = 0; row < params->world_height; row++)
+	{
+		float *const out = heat_buffer + HEAT_CELL( params, row, 0 );
+		const float *const in = heat_map + HEAT_CELL( params, row, 0 ) + offset;
+
+		if (first)
+			for (size_t col = 0; col < params->world_width; col++)
+				out[ col ] = in[ col ];
+		else
+			for (size_t col = 0; col < params->world_width; col++)
+				out[ col ] += in[ col ];
+	}
+
+	return;
+}
+
+
+
+void comp_world_heat_v2( float **world_heat, const Parameters_t *const params )
+{
+	const ptrdiff_t *const offset = params->heat_offset;
+	size_t i;
+
+
+	/** + NORTH*/
+		/* Compute north cells contribution. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ N ], TRUE );
+
+
+	/** + SOUTH */
+		/* Compute south cells contributions. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ S ], FALSE );
+
+
+	/** + EAST */
+		/* Compute east cells contributions. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ E ], FALSE );
+
+
+	/** + WEST */
+		/* Compute west cells contribution. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ W ], FALSE );
+
+
+	/** + NORTHEAST */
+		/* Compute northeast cells contributions. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ NE ], FALSE );
+
+
+	/** + NORTHWEST */
+		/* Compute northwest cells contributions. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ NW ], FALSE );
+
+
+	/** + SOUTHEAST */
+		/* Compute southeast cells contributions. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ SE ], FALSE );
+
+
+	/** + SOUTHWEST */
+		/* Compute southwest cells contribution. */
+
+	heat_v2_pass( world_heat[ MAP ], world_heat[ BUFFER ], params, offset[ SW ], FALSE );
+
+
+	/** Compute remaining heat and evaporation. */
+
+	for (size_t row = 0; row < params->world_height; row++)
+	{
+		i = HEAT_CELL( params, row, 0 );
+
+		for (size_t col = 0; col < params->world_width; col++, i++)
+		{
+			/* Get the 8th of the diffusion percentage of all neighbour cells. */
+			world_heat[ BUFFER ][ i ] = world_heat[ BUFFER ][ i ] * params->world_diffusion_rate / 8;
+
+			/* Add cell's remaining heat. */
+			world_heat[ BUFFER ][ i ] += world_heat[ MAP ][ i ] * (1 - params->world_diffusion_rate);
+
+
+			/** Compute evaporation. */
+
+			world_heat[ BUFFER ][ i ] = world_heat[ BUFFER ][ i ] * (1 - params->world_evaporation_rate);
+		}
+	}
+
+
+	/** Swap, so BUFFER becomes the new MAP. */
+
+	/* Warning, this macro is using C99 extension. */
+	SWAP( world_heat[ BUFFER ], world_heat[ MAP ] );
+
+	return;
+}
+
+
+
+/**
+ * Heat of one cell after diffusion and evaporation, given the three rows
+ * around it. The neighbours are accumulated in the very same order used by
+ * comp_world_heat_v2(...) (N, S, E, W, NE, NW, SE, SW), so the float
+ * rounding, and hence the result, is bit-identical to it.
+ *
+ * @param[in]	rn, rc, rs	- Rows at North, Center and South, at the
+ *				  cell's column (read from -1 to +1).
+ * */
+static inline float diffuse_cell( const hb_heat_t *const rn,
+	const hb_heat_t *const rc, const hb_heat_t *const rs,
+	const Parameters_t *const params )
+{
+	float heat;
+
+	heat  = heat_get( rn[ 0 ] );	/* N  */
+	heat += heat_get( rs[ 0 ] );	/* S  */
+	heat += heat_get( rc[ 1 ] );	/* E  */
+	heat += heat_get( rc[ -1 ] );	/* W  */
+	heat += heat_get( rn[ 1 ] );	/* NE */
+	heat += heat_get( rn[ -1 ] );	/* NW */
+	heat += heat_get( rs[ 1 ] );	/* SE */
+	heat += heat_get( rs[ -1 ] );	/* SW */
+
+	/* Get the 8th of the diffusion percentage of all neighbour cells. */
+	heat = heat * params->world_diffusion_rate / 8;
+
+	/* Add cell's remaining heat. */
+	heat += heat_get( rc[ 0 ] ) * (1 - params->world_diffusion_rate);
+
+	/** Compute evaporation. */
+	return heat * (1 - params->world_evaporation_rate);
+}
+
+
+
+#ifdef HB_VEC_FLOATS
+/**
+ * Heat of 'count' cells (a multiple of HB_VEC_FLOATS) after diffusion and
+ * evaporation, HB_VEC_FLOATS at a time. Lanes do the same operations, in
+ * the same order, as diffuse_cell(...). Rows are read from index -1 to
+ * 'count'.
+ *
+ * @param[in]	rn, rc, rs	- Rows at North, Center and South.
+ * @param[out]	out		- Where the new temperatures are written.
+ * @param[in]	count		- Cells to compute.
+ * */
+static inline void diffuse_vectors( const float *const rn,
+	const float *const rc, const float *const rs, float *const out,
+	const size_t count, const Parameters_t *const params )
+{
+	const hb_vec_t rate = VEC_SET1( params->world_diffusion_rate );
+	const hb_vec_t eighth = VEC_SET1( 0.125f );	/* Exact, as '/ 8'. */
+	const hb_vec_t remain = VEC_SET1( 1 - params->world_diffusion_rate );
+	const hb_vec_t keep = VEC_SET1( 1 - params->world_evaporation_rate );
+
+	for (size_t cc = 0; cc < count; cc += HB_VEC_FLOATS)
+	{
+		hb_vec_t heat;
+
+		heat = VEC_LOAD( rn + cc );				/* N  */
+		heat = VEC_ADD( heat, VEC_LOAD( rs + cc ) );		/* S  */
+		heat = VEC_ADD( heat, VEC_LOAD( rc + cc + 1 ) );	/* E  */
+		heat = VEC_ADD( heat, VEC_LOAD( rc + cc - 1 ) );	/* W  */
+		heat = VEC_ADD( heat, VEC_LOAD( rn + cc + 1 ) );	/* NE */
+		heat = VEC_ADD( heat, VEC_LOAD( rn + cc - 1 ) );	/* NW */
+		heat = VEC_ADD( heat, VEC_LOAD( rs + cc + 1 ) );	/* SE */
+		heat = VEC_ADD( heat, VEC_LOAD( rs + cc - 1 ) );	/* SW */
+
+		heat = VEC_MUL( VEC_MUL( heat, rate ), eighth );
+		heat = VEC_ADD( heat, VEC_MUL( VEC_LOAD( rc + cc ), remain ) );
+
+		VEC_STORE( out + cc, VEC_MUL( heat, keep ) );
+	}
+
+	return;
+}
+#endif
+
+
+
+/**
+ * Heat of the 'count' cells from 'cells', summed in double: a row's worth
+ * of floats loses nothing there but for very wide worlds, so rows are
+ * then added to a compensated sum (HBSum_t).
+ * */
+static inline double heat_total( const hb_heat_t *const cells,
+						const size_t count )
+{
+	double total = 0.0;
+
+	for (size_t cc = 0; cc < count; cc++)
+		total += heat_get( cells[ cc ] );
+
+	return total;
+}
+
+
+
+/**
+ * Heat of 'count' cells of a row after diffusion and evaporation. Cells
+ * are computed HB_VEC_FLOATS at a time with SSE/AVX vectors, when the
+ * compiler provides them, 16 bit cells being widened to float, HEAT_SPAN
+ * columns at a time, first. Vector lanes do the same operations, in the
+ * same order, as diffuse_cell(...), so results do not depend on it.
+ *
+ * @param[in]	rn, rc, rs	- Rows at North, Center and South, at the
+ *				  first cell (read from -1 to 'count').
+ * @param[out]	out		- Where the new temperatures are written.
+ * @param[in]	count		- Cells to compute.
+ * */
+static inline void diffuse_row( const hb_heat_t *const rn,
+	const hb_heat_t *const rc, const hb_heat_t *const rs,
+	hb_heat_t *const out, const size_t count,
+	const Parameters_t *const params )
+{
+	size_t cc = 0;
+
+#if defined( HB_VEC_FLOATS ) && !defined( HB_HEAT_16 )
+	const size_t span = count / HB_VEC_FLOATS * HB_VEC_FLOATS;
+
+	diffuse_vectors( rn, rc, rs, out, span, params );
+	cc += span;
+#elif defined( HB_VEC_FLOATS )
+	/* Spans of 16 bit cells, widened to float on the stack. */
+	while (cc + HB_VEC_FLOATS <= count)
+	{
+		float fn[ HEAT_SPAN + 2 ], fc[ HEAT_SPAN + 2 ];
+		float fs[ HEAT_SPAN + 2 ], fo[ HEAT_SPAN ];
+
+		size_t span = (count - cc) / HB_VEC_FLOATS * HB_VEC_FLOATS;
+		if (span > HEAT_SPAN) span = HEAT_SPAN;
+
+		/* From the column at West of 'cc'. */
+		const hb_heat_t *const wn = rn + cc - 1;
+		const hb_heat_t *const wc = rc + cc - 1;
+		const hb_heat_t *const ws = rs + cc - 1;
+
+		for (size_t k = 0; k < span + 2; k++)
+		{
+			fn[ k ] = heat_get( wn[ k ] );
+			fc[ k ] = heat_get( wc[ k ] );
+			fs[ k ] = heat_get( ws[ k ] );
+		}
+
+		diffuse_vectors( fn + 1, fc + 1, fs + 1, fo, span, params );
+
+		for (size_t k = 0; k < span; k++)
+			out[ cc + k ] = heat_put( fo[ k ] );
+
+		cc += span;
+	}
+#endif
+
+	for (; cc < count; cc++)
+		out[ cc ] = heat_put( diffuse_cell( rn + cc, rc + cc,
+						rs + cc, params ) );
+
+	return;
+}
+
+
+
+/**
+ * Compute diffusion and evaporation for rows [row_first .. row_last[ in a
+ * single pass. The heat map's ghost border stands for the toroidal wrap
+ * (see HEAT_CELL), so every column, edges included, is computed alike,
+ * a whole row at a time (see diffuse_row(...)).
+ * Each cell of the heat map is read from memory three times (once per row
+ * it neighbours, mostly from cache) and written once, against ten full
+ * passes over both buffers in comp_world_heat_v2(...). With 'heat', the
+ * new rows are also summed, while still in cache.
+ *
+ * @param[in]	heat_map	- The buffer with temperature data.
+ * @param[out]	heat_buffer	- Where the new temperatures are written.
+ * @param[in]	params	 	- Provide buffer's and simulation parameters.
+ * @param[in]	row_first	- First row to compute.
+ * @param[in]	row_last	- One past the last row to compute.
+ * @param[in,out]	heat	- Heat of the rows computed is added here,
+ *				  NULL to skip it.
+ * */
+void comp_world_heat_rows( const hb_heat_t *const heat_map,
+				hb_heat_t *const heat_buffer,
+				const Parameters_t *const params,
+				const size_t row_first, const size_t row_last,
+				HBSum_t *const heat )
+{
+	const size_t width = params->world_width;
+	const size_t stride = params->heat_stride;
+
+
+	for (size_t row = row_first; row < row_last; row++)
+	{
+		/* Rows at North, Center and South (grow from south to north). */
+		const hb_heat_t *const rc = heat_map + HEAT_CELL( params, row, 0 );
+		hb_heat_t *const out = heat_buffer + HEAT_CELL( params, row, 0 );
+
+		diffuse_row( rc + stride, rc, rc - stride, out, width, params );
+
+		if (heat) sum_add( heat, heat_total( out, width ) );
+	}
+
+	return;
+}
+
+
+
+/**
+ * Single-pass version of comp_world_heat_v2(...), bit-identical to it.
+ * See comp_world_heat_rows(...).
+ *
+ * @param[in,out]	world_heat	- Heat map and buffer, swapped at end.
+ * @param[in]		params		- Simulation parameters.
+ * @param[in,out]	heat		- World heat is added here, or NULL.
+ * */
+void comp_world_heat_v3( hb_heat_t **world_heat, const Parameters_t *const params,
+							HBSum_t *const heat )
+{
+	comp_world_heat_rows( world_heat[ MAP ], world_heat[ BUFFER ], params,
+					0, params->world_height, heat );
+
+
+	/** Swap, so BUFFER becomes the new MAP. */
+
+	/* Warning, this macro is using C99 extension. */
+	SWAP( world_heat[ BUFFER ], world_heat[ MAP ] );
+
+	return;
+}
+
+
+
+/**
+ * Horizontal 3-sum of one row: sum[ c ] = row[ c - 1 ] + row[ c ] +
+ * row[ c + 1 ], the ghost border giving the toroidal wrap at both ends.
+ * */
+static inline void row_sum3( const hb_heat_t *const row, float *const sum,
+						const size_t width )
+{
+	const hb_heat_t *const west = row - 1;
+
+	for (size_t cc = 0; cc < width; cc++)
+		sum[ cc ] = heat_get( west[ cc ] ) + heat_get( row[ cc ] )
+					+ heat_get( row[ cc + 1 ] );
+
+	return;
+}
+
+
+
+/**
+ * Separable box-sum version of the diffusion, for rows [row_first ..
+ * row_last[. The 3x3 neighbourhood sum is split in a horizontal 3-sum per
+ * row, computed once and kept in three rolling row buffers, plus a
+ * vertical sum of those three rows. Each row sum is reused by the rows at
+ * its North and South, so a cell costs 2 adds for its row sum, 2 adds for
+ * the vertical sum and 1 subtraction to take the center out (instead of 7
+ * adds and 8 scattered loads). Same toroidal world and same
+ * 'world_diffusion_rate'/'world_evaporation_rate' formula as the other
+ * engines, but the different summation order means results are not
+ * bit-identical to comp_world_heat_v2(...).
+ *
+ * @param[in]	heat_map	- The buffer with temperature data.
+ * @param[out]	heat_buffer	- Where the new temperatures are written.
+ * @param[out]	row_sums	- Scratch space for 3 rows of WORLD_WIDTH.
  * @param[in]	params	 	- Provide buffer's and simulation parameters.
+ * @param[in]	row_first	- First row to compute.
+ * @param[in]	row_last	- One past the last row to compute.
+ * */
+void comp_world_heat_boxsum_rows( const hb_heat_t *const heat_map,
+				hb_heat_t *const heat_buffer,
+				float *const row_sums,
+				const Parameters_t *const params,
+				const size_t row_first, const size_t row_last )
+{
+	const size_t width = params->world_width;
+	const size_t stride = params->heat_stride;
+
+	const float rate = params->world_diffusion_rate;
+	const float remain = 1 - params->world_diffusion_rate;
+	const float keep = 1 - params->world_evaporation_rate;
+
+	/* Rolling row sums at South, Center and North of current row. */
+	float *hs = row_sums;
+	float *hc = row_sums + width;
+	float *hn = row_sums + 2 * width;
+
+
+	if (row_first >= row_last) return;
+
+	row_sum3( heat_map + HEAT_CELL( params, row_first, 0 ) - stride, hs, width );
+	row_sum3( heat_map + HEAT_CELL( params, row_first, 0 ), hc, width );
+
+	for (size_t row = row_first; row < row_last; row++)
+	{
+		const hb_heat_t *const rc = heat_map + HEAT_CELL( params, row, 0 );
+		hb_heat_t *const out = heat_buffer + HEAT_CELL( params, row, 0 );
+
+		row_sum3( rc + stride, hn, width );
+
+		for (size_t cc = 0; cc < width; cc++)
+		{
+			const float centre = heat_get( rc[ cc ] );
+
+			/* 3x3 box, minus the center: the 8 neighbours. */
+			float heat = (hs[ cc ] + hc[ cc ] + hn[ cc ]) - centre;
+
+			/* Diffusion, cell's remaining heat, then evaporation. */
+			out[ cc ] = heat_put( (heat * rate / 8 + centre * remain) * keep );
+		}
+
+		/* Roll: Center becomes South, North becomes Center. */
+		float *const free_row = hs;
+		hs = hc;
+		hc = hn;
+		hn = free_row;
+	}
+
+	return;
+}
+
+
+
+/**
+ * Box-sum diffusion for the whole world, see
+ * comp_world_heat_boxsum_rows(...).
+ *
+ * @param[in,out]	world_heat	- Heat map and buffer, swapped at end.
+ * @param[out]		row_sums	- Scratch space for 3 rows.
+ * @param[in]		params		- Simulation parameters.
+ * */
+void comp_world_heat_boxsum( hb_heat_t **world_heat, float *const row_sums,
+					const Parameters_t *const params )
+{
+	comp_world_heat_boxsum_rows( world_heat[ MAP ], world_heat[ BUFFER ],
+				row_sums, params, 0, params->world_height );
+
+
+	/** Swap, so BUFFER becomes the new MAP. */
+
+	/* Warning, this macro is using C99 extension. */
+	SWAP( world_heat[ BUFFER ], world_heat[ MAP ] );
+
+	return;
+}
+
+
+
+/** Work shared by the row band tasks of comp_world_heat_mt(...). */
+typedef struct {
+	const hb_heat_t *heat_map;
+	hb_heat_t *heat_buffer;
+	float *row_sums;	/* Box-sum scratch, NULL for the fused engine. */
+	HBSum_t *heat;		/* Per band, fused engine's world heat, or NULL. */
+	const Parameters_t *params;
+	size_t bands;
+} HeatBands_t;
+
+
+static void comp_world_heat_band( void *ctx, size_t band,
+					unsigned int thread G_GNUC_UNUSED )
+{
+	const HeatBands_t *const job = (const HeatBands_t *) ctx;
+	const size_t height = job->params->world_height;
+	const size_t row_first = band * height / job->bands;
+	const size_t row_last = (band + 1) * height / job->bands;
+
+	if (job->row_sums)
+		comp_world_heat_boxsum_rows( job->heat_map, job->heat_buffer,
+			job->row_sums + band * 3 * job->params->world_width,
+			job->params, row_first, row_last );
+	else
+		comp_world_heat_rows( job->heat_map, job->heat_buffer,
+			job->params, row_first, row_last,
+			job->heat ? job->heat + band : NULL );
+
+	return;
+}
+
+
+
+/**
+ * Multithreaded version of comp_world_heat_v2(...). The heat map is split
+ * in horizontal row bands, one per pool thread. Each band reads its rows
+ * plus the one row above and below it (wrapping at the world's top and
+ * bottom) from MAP, and writes only its own rows to BUFFER, so bands need
+ * no synchronization. Results are bit-identical to the serial kernel.
+ * When 'row_sums' is given, bands run the box-sum kernel instead, each one
+ * with its own three rolling rows. The fused kernel's bands sum their heat
+ * apart, added to 'heat' in band order, whatever thread ran them.
+ *
+ * @param[in,out]	world_heat	- Heat map and buffer, swapped at end.
+ * @param[out]		row_sums	- Box-sum scratch (3 rows per thread),
+ *					  or NULL for the fused kernel.
+ * @param[in]		params		- Simulation parameters.
+ * @param[in]		pool		- Threads to run the bands.
+ * @param[in,out]	heat		- World heat is added here (fused
+ *					  kernel only), or NULL.
  * */
-void comp_world_heat_v1( const float *const heat_map,
-				float *const heat_buffer,
-				const Parameters_t *const params )
+void comp_world_heat_mt( hb_heat_t **world_heat, float *const row_sums,
+			const Parameters_t *const params, HBPool_t *const pool,
+			HBSum_t *const heat )
 {
-	size_t ln, ls, ce, cw;	/* Line at North/South. Column at East/West. */
-	size_t lc, cc;		/* Line at Center. Column at Center.	     */
-	size_t pos;
+	HeatBands_t job;
+	HBSum_t band_heat[ MAX_THREADS ];
+
+
+	job.heat_map = world_heat[ MAP ];
+	job.heat_buffer = world_heat[ BUFFER ];
+	job.row_sums = row_sums;
+	job.heat = (heat && !row_sums) ? band_heat : NULL;
+	job.params = params;
+	job.bands = MIN( (size_t) hb_pool_threads( pool ), params->world_height );
+
+	if (job.heat)
+		memset( band_heat, 0, job.bands * sizeof( HBSum_t ) );
+
+	hb_pool_run( pool, comp_world_heat_band, &job, job.bands );
+
+	if (job.heat)
+		for (size_t band = 0; band < job.bands; band++)
+			sum_merge( heat, &band_heat[ band ] );
+
+
+	/** Swap, so BUFFER becomes the new MAP. */
+
+	/* Warning, this macro is using C99 extension. */
+	SWAP( world_heat[ BUFFER ], world_heat[ MAP ] );
+
+	return;
+}
+
+
+
+/** Work shared by the tile row tasks of comp_world_heat_sparse(...). */
+typedef struct {
+	const hb_heat_t *heat_map;
+	hb_heat_t *heat_buffer;
+	Activity_t *activity;
+	gboolean heat;		/* Sum tile rows heat in activity->heat. */
+	const Parameters_t *params;
+} HeatTiles_t;
+
+
+/**
+ * Whether tile ('tx', 'ty'), or one of the 8 tiles around it (wrapped
+ * around the torus), is hot.
+ * */
+static inline gboolean tile_awake( const Activity_t *const activity,
+					const size_t tx, const size_t ty )
+{
+	const size_t tiles_x = activity->tiles_x;
+	const size_t tiles_y = activity->tiles_y;
+	const size_t txs[ 3 ] = { (tx + tiles_x - 1) % tiles_x, tx, (tx + 1) % tiles_x };
+	const size_t tys[ 3 ] = { (ty + tiles_y - 1) % tiles_y, ty, (ty + 1) % tiles_y };
+
+	for (int y = 0; y < 3; y++)
+		for (int x = 0; x < 3; x++)
+			if (activity->hot[ MAP ][ tys[ y ] * tiles_x + txs[ x ] ])
+				return TRUE;
+
+	return FALSE;
+}
+
+
+/* Flags of a tile row's tiles in hot[ BUFFER ] while it is computed. */
+#define TILE_HOT	1	/* Some new cell over epsilon.	*/
+#define TILE_AWAKE	2	/* To be computed.		*/
+
+
+static void comp_world_heat_tile_row( void *ctx, size_t ty,
+					unsigned int thread G_GNUC_UNUSED )
+{
+	const HeatTiles_t *const job = (const HeatTiles_t *) ctx;
+	const Parameters_t *const params = job->params;
+	Activity_t *const activity = job->activity;
+
+	const size_t width = params->world_width;
+	const size_t stride = params->heat_stride;
+	const size_t tiles_x = activity->tiles_x;
+	const size_t row_first = ty * SPARSE_TILE;
+	const size_t row_last = MIN( row_first + SPARSE_TILE, params->world_height );
+
+	guint8 *const flags = activity->hot[ BUFFER ] + ty * tiles_x;
+	guint8 *const cold = activity->cold[ BUFFER ] + ty * tiles_x;
+	HBSum_t *const heat = job->heat ? &activity->heat[ ty ] : NULL;
+
+
+	for (size_t tx = 0; tx < tiles_x; tx++)
+		flags[ tx ] = tile_awake( activity, tx, ty ) ? TILE_AWAKE : 0;
+
+	if (heat) *heat = (HBSum_t) { 0.0, 0.0 };
+
+
+	/** Compute the runs of awake tiles, a row at a time. */
+	for (size_t row = row_first; row < row_last; row++)
+	{
+		const hb_heat_t *const rc = job->heat_map + HEAT_CELL( params, row, 0 );
+		hb_heat_t *const out = job->heat_buffer + HEAT_CELL( params, row, 0 );
+
+		for (size_t tx = 0; tx < tiles_x; )
+		{
+			size_t tx_end = tx;
+
+			while ((tx_end < tiles_x) && (flags[ tx_end ] & TILE_AWAKE))
+				tx_end++;
+
+			if (tx_end == tx)
+			{
+				tx++;
+				continue;
+			}
+
+			const size_t col_first = tx * SPARSE_TILE;
+			const size_t col_last = MIN( tx_end * SPARSE_TILE, width );
+
+			diffuse_row( rc + stride + col_first, rc + col_first,
+				rc - stride + col_first, out + col_first,
+				col_last - col_first, params );
+
+			if (heat)
+				sum_add( heat, heat_total( out + col_first,
+						col_last - col_first ) );
+
+			for (; tx < tx_end; tx++)
+			{
+				const size_t cc_last = MIN( (tx + 1) * SPARSE_TILE, width );
+				int over = 0;
+
+				if (flags[ tx ] & TILE_HOT) continue;
+
+				/* No early exit, so it vectorizes. */
+				for (size_t cc = tx * SPARSE_TILE; cc < cc_last; cc++)
+					over |= heat_get( out[ cc ] ) > params->sparse_epsilon;
+
+				if (over) flags[ tx ] |= TILE_HOT;
+			}
+		}
+	}
+
+
+	/** Zero the tiles no heat gets to (once, while they stay cold). */
+	for (size_t tx = 0; tx < tiles_x; tx++)
+	{
+		if (flags[ tx ] & TILE_AWAKE)
+		{
+			flags[ tx ] &= TILE_HOT;
+			cold[ tx ] = FALSE;
+			continue;
+		}
+
+		if (!cold[ tx ])
+		{
+			const size_t col_first = tx * SPARSE_TILE;
+			const size_t cols = MIN( (size_t) SPARSE_TILE, width - col_first );
+
+			for (size_t row = row_first; row < row_last; row++)
+				memset( job->heat_buffer + HEAT_CELL( params, row, col_first ),
+						0, cols * sizeof( hb_heat_t ) );
+		}
+
+		cold[ tx ] = TRUE;
+	}
+
+	return;
+}
+
+
+
+/**
+ * Sparse version of comp_world_heat_v3(...), for mostly cold worlds. The
+ * world is split in SPARSE_TILE tiles, flagged hot when some cell in them
+ * is over 'sparse_epsilon'. A tile is computed, as in the fused kernel,
+ * only when it or a tile around it is hot, runs of them side by side at
+ * once; otherwise it gets no heat, and is zeroed (once, while it stays
+ * cold). Heat is never negative, so with
+ * 'sparse_epsilon' 0 only exactly zero tiles are skipped, and results are
+ * bit-identical to the fused kernel. Over 0, heat up to 'sparse_epsilon'
+ * far from any warmer cell is dropped.
+ *
+ * Bugs leave heat where they stand after moving, in any agents engine, so
+ * their tiles are woken first, from the bugs' positions. Tile rows are
+ * run as pool tasks, when there is a pool: a task writes only its own
+ * tiles of BUFFER and their flags (and heat, added in tile row order).
+ *
+ * @param[in,out]	world_heat	- Heat map and buffer, swapped at end.
+ * @param[in,out]	activity	- Tiles, their flags swapped at end.
+ * @param[in]		swarm		- Bugs, for their positions.
+ * @param[in]		params		- Simulation parameters.
+ * @param[in]		pool		- Threads to run the tile rows, or NULL.
+ * @param[in,out]	heat		- World heat is added here, or NULL.
+ * */
+void comp_world_heat_sparse( hb_heat_t **world_heat, Activity_t *const activity,
+			const Swarm_t *const swarm, const Parameters_t *const params,
+			HBPool_t *const pool, HBSum_t *const heat )
+{
+	HeatTiles_t job;
+
+
+	/** Wake the tiles bugs left heat in. */
+	for (size_t bug = 0; bug < params->bugs_number; bug++)
+	{
+		const Around_t at = locate( swarm->locus[ bug ], params );
+		const size_t tile = (at.rc / SPARSE_TILE) * activity->tiles_x
+							+ at.cc / SPARSE_TILE;
+
+		activity->hot[ MAP ][ tile ] = TRUE;
+		activity->cold[ MAP ][ tile ] = FALSE;
+	}
+
+
+	/** Compute the tiles, a tile row per task. */
+	job.heat_map = world_heat[ MAP ];
+	job.heat_buffer = world_heat[ BUFFER ];
+	job.activity = activity;
+	job.heat = (heat != NULL);
+	job.params = params;
+
+	if (pool)
+		hb_pool_run( pool, comp_world_heat_tile_row, &job, activity->tiles_y );
+	else
+		for (size_t ty = 0; ty < activity->tiles_y; ty++)
+			comp_world_heat_tile_row( &job, ty, 0 );
+
+	if (heat)
+		for (size_t ty = 0; ty < activity->tiles_y; ty++)
+			sum_merge( heat, &activity->heat[ ty ] );
+
+
+	/** Swap, so BUFFER becomes the new MAP. */
+
+	/* Warning, this macro is using C99 extension. */
+	SWAP( world_heat[ BUFFER ], world_heat[ MAP ] );
+	SWAP( activity->hot[ BUFFER ], activity->hot[ MAP ] );
+	SWAP( activity->cold[ BUFFER ], activity->cold[ MAP ] );
+
+	return;
+}
+
+
+
+/** Heat of a cell other threads may be adding to, see atomic_add_heat(...). */
+static inline float atomic_load_heat( const hb_heat_t *const addr )
+{
+	hb_heat_t value;
+
+	__atomic_load( addr, &value, __ATOMIC_RELAXED );
+
+	return heat_get( value );
+}
+
+
+
+/**
+ * Reads of neighbour_choose(...): relaxed atomic loads when 'atomic' (the
+ * atomic agents engine, other threads writing the maps meanwhile), plain
+ * loads otherwise.
+ * */
+#define NB_HEAT( ptr ) \
+	(atomic ? atomic_load_heat( ptr ) : heat_get( *(ptr) ))
+#define NB_HAS_NO_BUG( map, cell ) \
+	(atomic ? !MAP_HAS_BUG_RELAXED( map, cell ) : MAP_HAS_NO_BUG( map, cell ))
+
+
+
+#ifdef HB_SWARM_BITMAP
+/**
+ * Occupation of the cells 'cw', 'cc', 'ce' of the row starting at 'row',
+ * as bits 0, 1 and 2. One word read when they are side by side in a word,
+ * which only fails at the world's and the words' edges.
+ * */
+static inline guint32 map_row3( const hb_map_t *const swarm_map,
+		const size_t row, const size_t cw, const size_t cc, const size_t ce,
+						const gboolean atomic )
+{
+	const size_t first = row + cw;
 
+	if ((cw + 1 == cc) && (cc + 1 == ce) && ((first & 31) <= 29))
+		return ((atomic ? __atomic_load_n( &swarm_map[ first >> 5 ],
+						__ATOMIC_RELAXED )
+				: swarm_map[ first >> 5 ]) >> (first & 31)) & 7u;
+
+	return (guint32) !NB_HAS_NO_BUG( swarm_map, row + cw )
+		| ((guint32) !NB_HAS_NO_BUG( swarm_map, row + cc ) << 1)
+		| ((guint32) !NB_HAS_NO_BUG( swarm_map, row + ce ) << 2);
+}
+#endif
+
+
+
+/**
+ * Find where a bug should go, as asked by 'todo'. Neighbour temperatures
+ * are read at fixed offsets in the heat map (see HEAT_CELL), occupation
+ * at the wrapped positions in 'at'.
+ *
+ * @param[in]		todo		- FIND_ANY_FREE, FIND_MAX_TEMPERATURE
+ *					  or FIND_MIN_TEMPERATURE.
+ * @param[in]		heat_map	- The world temperatures.
+ * @param[in]		swarm_map	- The world occupation.
+ * @param[in]		params		- Simulation parameters.
+ * @param[in]		at		- Current bug position, see locate(...).
+ * @param[in,out]	state		- Calling thread's agent state: random
+ *					  generator and neighbour order.
+ * @param[in]		atomic		- Maps are written by other threads
+ *					  meanwhile (see NB_HEAT).
+ * @return	The position to go to, 'at' itself to stay.
+ * */
+static inline size_t neighbour_choose( const int todo,
+	const hb_heat_t *const heat_map, const hb_map_t *const swarm_map,
+	const Parameters_t *const params, const Around_t *const at,
+			AgentState_t *const state, const gboolean atomic )
+{
+	const size_t width = params->world_width;
+
+	/* Agent position into the world and into the heat map. */
+	const size_t bug_locus = at->rc * width + at->cc;
+	const hb_heat_t *const cell = heat_map + HEAT_CELL( params, at->rc, at->cc );
+	const ptrdiff_t up = (ptrdiff_t) params->heat_stride;	/* A row. */
+
+	/* Central Row */
+	const size_t rc = at->rc;
+	/* Contral Column */
+	const size_t cc = at->cc;
+	/* Row at North. */
+	const size_t rn = at->rn;
+	/* Row at South. */
+	const size_t rs = at->rs;
+	/* Column at East. */
+	const size_t ce = at->ce;
+	/* Columns at West. */
+	const size_t cw = at->cw;
+
+	struct {
+		size_t pos;
+		float heat;
+	} best, neighbour[ NUM_NEIGHBOURS ];
+
+	unsigned int *const NEIGHBOUR_IDX = state->neighbour_idx;
+
+
+	/*
+	 * Fisher-Yates shuffle algorithm to shuffle the neighbour index vector
+	 * so we can pick a random (or a best) neighbour by checking each index
+	 * until find a first free (or a best).
+	 * */
+	for (size_t i = 0; i < NUM_NEIGHBOURS; i++)
+	{
+		size_t rnd_i = (size_t) hb_rng_int_range( &state->rng, i, NUM_NEIGHBOURS );
+
+		if (rnd_i == i) continue;	/* Next shuffle. */
+
+		/* Warning, this macro is using C99 extension. */
+		SWAP( NEIGHBOUR_IDX[ i ], NEIGHBOUR_IDX[ rnd_i ] );
+	}
+
+
+	/* Compute back the vector positions. Used on both, best */
+	/* location and random location.                         */
+
+	/* SW neighbour position. */
+	neighbour[ SW ].pos = rs * width + cw;
+	/* S neighbour position.  */
+	neighbour[ S  ].pos = rs * width + cc;
+	/* SE neighbour position. */
+	neighbour[ SE ].pos = rs * width + ce;
+	/* W neighbour position.  */
+	neighbour[ W  ].pos = rc * width + cw;
+	/* E neighbour position.  */
+	neighbour[ E  ].pos = rc * width + ce;
+	/* NW neighbour position. */
+	neighbour[ NW ].pos = rn * width + cw;
+	/* N neighbour position.  */
+	neighbour[ N  ].pos = rn * width + cc;
+	/* NE neighbour position. */
+	neighbour[ NE ].pos = rn * width + ce;
+
+	if (todo != FIND_ANY_FREE)
+	{
+		/* Fetch temperature of all neighbours. */
+
+		/* SW neighbour temperature. */
+		neighbour[ SW ].heat = NB_HEAT( &cell[ -up - 1 ] );
+		/* S neighbour temperature. */
+		neighbour[ S  ].heat = NB_HEAT( &cell[ -up ] );
+		/* SE neighbour temperature. */
+		neighbour[ SE ].heat = NB_HEAT( &cell[ -up + 1 ] );
+		/* W neighbour temperature. */
+		neighbour[ W  ].heat = NB_HEAT( &cell[ -1 ] );
+		/* E neighbour temperature. */
+		neighbour[ E  ].heat = NB_HEAT( &cell[ +1 ] );
+		/* NW neighbour temperature. */
+		neighbour[ NW ].heat = NB_HEAT( &cell[ up - 1 ] );
+		/* N neighbour temperature. */
+		neighbour[ N  ].heat = NB_HEAT( &cell[ up ] );
+		/* NE neighbour temperature. */
+		neighbour[ NE ].heat = NB_HEAT( &cell[ up + 1 ] );
+
+		/* Actual bug location is the best location, until otherwise. */
+		best.pos = bug_locus;			/* Bug position. */
+		best.heat = NB_HEAT( cell );		/* Temperature at bug position. */
+
+		/*
+		   Find the hottest or coolest location in the neighbourhood;
+		   also take current position into consideration.
+		*/
+
+		/* Loop unroll. */
+		if (todo == FIND_MAX_TEMPERATURE)
+		{
+			if (neighbour[ NEIGHBOUR_IDX[0] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[0] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[1] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[1] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[2] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[2] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[3] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[3] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[4] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[4] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[5] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[5] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[6] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[6] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[7] ].heat > best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[7] ];
+		}
+		else	/* todo == FIND_MIN_TEMPERATURE */
+		{
+			if (neighbour[ NEIGHBOUR_IDX[0] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[0] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[1] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[1] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[2] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[2] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[3] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[3] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[4] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[4] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[5] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[5] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[6] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[6] ];
+
+			if (neighbour[ NEIGHBOUR_IDX[7] ].heat < best.heat)
+				best = neighbour[ NEIGHBOUR_IDX[7] ];
+		}
+
+		/*
+		   Return if the bug is already in the best local or if the
+		   best local is bug free.
+		 * */
+		if ((best.pos == bug_locus) || NB_HAS_NO_BUG( swarm_map, best.pos ))
+			return best.pos;
 
-/* Debug */
-/*
-for (size_t wpos = 0; wpos < params->world_size; wpos++)
-	heat_map[wpos] = wpos + 1;
-*/
+	} /* end_if (todo != GOTO_ANY_FREE) */
 
 
+	/*
+	 * Here, there is a random moving chance, or best neighbour is not
+	 * free. Try to find any available free place.
+	 * */
 
 	/*
-	 * The vectors 'heat_map' and 'heat_buffer' grow from left to right
-	 * (west to east) and then from bottom to top (south to north).
-	 * Follow heat_buffer vector, compute Center Line and Center Column.
-	 * Then compute the lines North/South of 'lc' and Columns East/West of
-	 * 'cc'.
-	 * Find heat contribution from all (lc, cc) neighbours present in
-	 * 'heat_map'.
+	 * Fisher-Yates shuffle algorithm to shuffle an index vector so we can
+	 * pick a random free neighbour by checking each index until find a
+	 * first free.
 	 * */
-	for (size_t wpos = 0; wpos < params->world_size; wpos++)
-	{
-		lc = (size_t) wpos / params->world_width;
-		cc = (size_t) wpos - lc * params->world_width;
 
-		ln = (lc + 1) % params->world_height;
-		ls = (lc + params->world_height - 1) % params->world_height;
-		ce = (cc + 1) % params->world_width;
-		cw = (cc + params->world_width - 1) % params->world_width;
+//	 for (size_t i = 0; i < NUM_NEIGHBOURS; i++)
+//	{
+//		size_t rnd_i = (size_t) g_random_int_range( i, NUM_NEIGHBOURS );
+
+//		if (rnd_i == i) continue;	/* Next shuffle. */
+
+//		/* Warning, this macro is using C99 extension. */
+//		SWAP( NEIGHBOUR_IDX[ i ], NEIGHBOUR_IDX[ rnd_i ] );
+//	}
 
 
-		/** Compute diffusion. */
+#ifdef HB_SWARM_BITMAP
 
-		/* NW */
-		pos = ln * params->world_width + cw;
-		heat_buffer[ wpos ]  = heat_map[ pos ];	/* STORE the heat. */
+	/* Occupation of the 8 neighbours, bit n for neighbour n, read by */
+	/* words: a row's 3 cells, most of the times, take one load.      */
+	{
+		const guint32 south = map_row3( swarm_map, rs * width, cw, cc, ce, atomic );
+		const guint32 centre = map_row3( swarm_map, rc * width, cw, cc, ce, atomic );
+		const guint32 north = map_row3( swarm_map, rn * width, cw, cc, ce, atomic );
 
-		/* N */
-		pos = ln * params->world_width + cc;
-		heat_buffer[ wpos ] += heat_map[ pos ];	/* Accumulate the heat. */
+		const guint32 occupied = (south << SW) | ((centre & 1u) << W)
+				| ((centre >> 2) << E) | (north << NW);
 
-		/* NE */
-		pos = ln * params->world_width + ce;
-		heat_buffer[ wpos ] += heat_map[ pos ];	/* Accumulate the heat. */
+		/* Crowded: no need to look at each one. */
+		if (occupied == (1u << NUM_NEIGHBOURS) - 1)
+			return bug_locus;
 
-		/* W */
-		pos = lc * params->world_width + cw;
-		heat_buffer[ wpos ] += heat_map[ pos ];	/* Accumulate the heat. */
+		for (size_t i = 0; i < NUM_NEIGHBOURS; i++)
+			if (!(occupied & (1u << NEIGHBOUR_IDX[ i ])))
+				return neighbour[ NEIGHBOUR_IDX[ i ] ].pos;
 
-		/* E */
-		pos = lc * params->world_width + ce;
-		heat_buffer[ wpos ] += heat_map[ pos ];	/* Accumulate the heat. */
+		return bug_locus;	/* Not reached. */
+	}
 
-		/* SW */
-		pos = ls * params->world_width + cw;
-		heat_buffer[ wpos ] += heat_map[ pos ];	/* Accumulate the heat. */
+#else
 
-		/* S */
-		pos = ls * params->world_width + cc;
-		heat_buffer[ wpos ] += heat_map[ pos ];	/* Accumulate the heat. */
+	/* Loop unroll. */
 
-		/* SE */
-		pos = ls * params->world_width + ce;
-		heat_buffer[ wpos ] += heat_map[ pos ];	/* Accumulate the heat. */
+	/* Find a first free neighbour. Index over the 8 neighbours. */
+	best.pos = neighbour[ NEIGHBOUR_IDX[0] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
-		/* Get the 8th of the diffusion percentage of all neighbour cells. */
-		heat_buffer[ wpos ] = heat_buffer[ wpos ] * params->world_diffusion_rate / 8;
+	best.pos = neighbour[ NEIGHBOUR_IDX[1] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
-		/* Add cell's remaining heat. */
-		heat_buffer[ wpos ] += heat_map[ wpos ] * (1 - params->world_diffusion_rate);
+	best.pos = neighbour[ NEIGHBOUR_IDX[2] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
+	best.pos = neighbour[ NEIGHBOUR_IDX[3] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
-		/** Compute evaporation. */
+	best.pos = neighbour[ NEIGHBOUR_IDX[4] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
-		heat_buffer[ wpos ] = heat_buffer[ wpos ] * (1 - params->world_evaporation_rate);
-	}
+	best.pos = neighbour[ NEIGHBOUR_IDX[5] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
-/* Debug */
-/*
-	size_t lin = params->world_height - 1;
-	do {
-		for (size_t col = 0; col < params->world_width; col++)
-		{
-			pos = lin * params->world_width + col;
+	best.pos = neighbour[ NEIGHBOUR_IDX[6] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
-			printf( "%05.2f ", heat_buffer[pos] );
-		}
-		printf( "\n" );
-	} while (lin-- > 0);
+	best.pos = neighbour[ NEIGHBOUR_IDX[7] ].pos;
+	if (NB_HAS_NO_BUG( swarm_map, best.pos )) return best.pos;
 
-	exit(0);
-*/
+	return bug_locus;	/* There is no free neighbour. */
 
-	return;
+#endif
 }
 
+#undef NB_HEAT
+#undef NB_HAS_NO_BUG
 
 
-void comp_world_heat_v2( float **world_heat, const Parameters_t *const params )
+
+/**
+ * Find where a bug should go, see neighbour_choose(...). For the engines
+ * where no other thread changes the maps meanwhile.
+ * */
+size_t best_free_neighbour( const int todo, const hb_heat_t *const heat_map,
+	const hb_map_t *const swarm_map, const Parameters_t *const params,
+	const Around_t *const at, AgentState_t *const state )
 {
-	size_t i, j, c;
+	return neighbour_choose( todo, heat_map, swarm_map, params, at, state,
+									FALSE );
+}
 
 
-	/** + NORTH*/
-		/* Compute north cells contribution. */
 
-	i = 0;
-	j = params->world_width;
+/**
+ * Find where a bug of the atomic agents engine should go, reading the maps
+ * other threads change meanwhile with relaxed atomic loads.
+ * */
+static size_t best_free_neighbour_atomic( const int todo,
+	const hb_heat_t *const heat_map, const hb_map_t *const swarm_map,
+	const Parameters_t *const params, const Around_t *const at,
+						AgentState_t *const state )
+{
+	return neighbour_choose( todo, heat_map, swarm_map, params, at, state,
+									TRUE );
+}
+
 
-	while (j < params->world_size)
-		world_heat[ BUFFER ][ i++ ] = world_heat[ MAP ][ j++ ];
 
-	j = 0;
+/**
+ * Shuffle the order bugs will move in.
+ *
+ * @param[in,out]	ids		- Bugs id vector, shuffled in place.
+ * @param[in]		params		- Simulation parameters.
+ * @param[in,out]	rng		- Main thread's generator.
+ * @param[in]		iteration	- Current iteration, names the stream.
+ * */
+void shuffle_bugs( size_t *const ids, const Parameters_t *const params,
+			HBRng_t *const rng, const size_t iteration )
+{
+	/*
+	 * Fisher-Yates shuffle algorithm.
+	 * Use the vector to add randomness to the order bugs are selected
+	 * for moving, preventing the same bug to always get the chance	to
+	 * pick best location first.
+	 * It should be more efficient to shuffle an integer bug indexer vector
+	 * than shuffle the bugs vector, since every bug is a 3 integer
+	 * structure.
+	 * */
 
-	while (j < params->world_width)
-		world_heat[ BUFFER ][ i++ ] = world_heat[ MAP ][ j++ ];
+	hb_rng_stream( rng, HB_STREAM_SHUFFLE, iteration, 0 );
 
+	/* Shuffle bugs indexer vector. */
+	for (size_t idx = 0; idx < params->bugs_number; idx++)
+	{
+		/* The chance of j == i CANNOT be excluded because keeping the	*/
+		/* value in the same position generates also a valid sequence.	*/
+		size_t rnd_idx = (size_t) hb_rng_uint64_range( rng, idx, params->bugs_number );
 
-	/** + SOUTH */
-		/* Compute south cells contributions. */
+		if (rnd_idx == idx) continue;	/* Next shuffle.	*/
 
-	i = params->world_width;
-	j = 0;
+		/* Warning, this macro is using C99 extension. */
+		SWAP( ids[ idx ], ids[ rnd_idx ] );
+	}
 
-	while (i < params->world_size)
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
+	return;
+}
 
-	i = 0;
 
-	while (i < params->world_width)
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
 
+/** Bits of 'v' (32 bits) spread to the even bits of the result. */
+static inline guint64 morton_spread( guint64 v )
+{
+	v &= 0xffffffffULL;
+	v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+	v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+	v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	v = (v | (v << 2)) & 0x3333333333333333ULL;
+	v = (v | (v << 1)) & 0x5555555555555555ULL;
+
+	return v;
+}
 
-	/** + EAST */
-		/* Compute east cells contributions. */
 
-	i = 0;
-	j = 0;
+/** Sorts OrderKey_t by block, then id: the same order every time. */
+static int order_key_compare( const void *a, const void *b )
+{
+	const OrderKey_t *const ka = (const OrderKey_t *) a;
+	const OrderKey_t *const kb = (const OrderKey_t *) b;
 
-	while (i < params->world_size)
-	{
-		j++;
-		c = params->world_width;
+	if (ka->key != kb->key) return (ka->key < kb->key) ? -1 : 1;
 
-		while (c > 1)
-		{
-			world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
-			c--;
-		}
+	return (ka->id > kb->id) - (ka->id < kb->id);
+}
 
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j - params->world_width ];
-	}
 
 
-	/** + WEST */
-		/* Compute west cells contribution. */
+/**
+ * Find where each block starts in the sorted bugs (after sorting, or
+ * loading a checkpoint).
+ * */
+void spatial_order_blocks( SpatialOrder_t *const order,
+					const Parameters_t *const params )
+{
+	order->blocks = 0;
 
-	i = 0;
-	j = 0;
+	for (size_t idx = 0; idx < params->bugs_number; idx++)
+		if ((idx == 0) || (order->sorted[ idx ].key != order->sorted[ idx - 1 ].key))
+			order->block_start[ order->blocks++ ] = idx;
 
-	while (i < params->world_size)
-	{
-		i++;
-		c = params->world_width;
+	order->block_start[ order->blocks ] = params->bugs_number;
 
-		while (c > 1)
-		{
-			world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
-			c--;
-		}
+	return;
+}
 
-		world_heat[ BUFFER ][ i - params->world_width ] += world_heat[ MAP ][ j++ ];
-	}
 
 
-	/** + NORTHEAST */
-		/* Compute northeast cells contributions. */
+/**
+ * Shuffle the order bugs move in, keeping the bugs of a block of cells
+ * together ('--order morton'): a cache friendly alternative to
+ * shuffle_bugs(...) for big worlds.
+ *
+ * Every 'order_sort_every' iterations the bugs are sorted by the Morton
+ * (Z-order) index of the 'order_block' x 'order_block' block they are
+ * in, so close blocks are close in that order. As bugs move one cell at
+ * most per iteration, the blocks are mostly right in between. Each
+ * iteration the blocks are walked from a random one, forward or backward,
+ * and bugs are shuffled within each block. Which bug moves first is thus
+ * random only within its block's neighbourhood: the wider the blocks, the
+ * fairer, one block over the whole world being as fair as shuffle_bugs(...).
+ *
+ * @param[out]		ids		- Bugs id vector, in the new order.
+ * @param[in,out]	order		- Bugs by block, sorted again here.
+ * @param[in]		swarm		- The bugs.
+ * @param[in]		params		- Simulation parameters.
+ * @param[in,out]	rng		- Main thread's generator.
+ * @param[in]		iteration	- Current iteration, names the stream.
+ * */
+void shuffle_bugs_spatial( size_t *const ids, SpatialOrder_t *const order,
+			const Swarm_t *const swarm, const Parameters_t *const params,
+			HBRng_t *const rng, const size_t iteration )
+{
+	size_t first, fill = 0;
+	gboolean backward;
 
-	i = 0;
-	j = params->world_width;
 
-	while (j < params->world_size)
+	if ((iteration % params->order_sort_every == 0) || (order->blocks == 0))
 	{
-		j++;
-		c = params->world_width;
-
-		while (c > 1)
+		for (size_t idx = 0; idx < params->bugs_number; idx++)
 		{
-			world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
-			c--;
+			const size_t locus = swarm->locus[ order->sorted[ idx ].id ];
+
+			order->sorted[ idx ].key =
+				morton_spread( (locus % params->world_width) >> order->block_shift )
+				| (morton_spread( (locus / params->world_width) >> order->block_shift ) << 1);
 		}
 
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j - params->world_width ];
+		qsort( order->sorted, params->bugs_number, sizeof( OrderKey_t ),
+							order_key_compare );
+
+		spatial_order_blocks( order, params );
 	}
 
-	j = 1;
 
-	while (j < params->world_width)
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
+	hb_rng_stream( rng, HB_STREAM_SHUFFLE, iteration, 0 );
 
-	world_heat[ BUFFER ][ i ] += world_heat[ MAP ][ 0 ];
+	first = (size_t) hb_rng_int_range( rng, 0, order->blocks );
+	backward = hb_rng_int_range( rng, 0, 2 );
 
+	for (size_t b = 0; b < order->blocks; b++)
+	{
+		const size_t block = backward
+			? (first + order->blocks - b) % order->blocks
+			: (first + b) % order->blocks;
+		const size_t start = fill;
 
-	/** + NORTHWEST */
-		/* Compute northwest cells contributions. */
+		for (size_t idx = order->block_start[ block ];
+			idx < order->block_start[ block + 1 ]; idx++)
+			ids[ fill++ ] = order->sorted[ idx ].id;
 
-	i = 0;
-	j = params->world_width;
+		/* Fisher-Yates shuffle, within the block. */
+		for (size_t idx = start; idx < fill; idx++)
+		{
+			size_t rnd_idx = (size_t) hb_rng_uint64_range( rng, idx, fill );
 
-	while (j < params->world_size)
-	{
-		i++;
-		c = params->world_width;
+			if (rnd_idx == idx) continue;	/* Next shuffle.	*/
 
-		while (c > 1)
-		{
-			world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
-			c--;
+			/* Warning, this macro is using C99 extension. */
+			SWAP( ids[ idx ], ids[ rnd_idx ] );
 		}
-
-		world_heat[ BUFFER ][ i - params->world_width ] += world_heat[ MAP ][ j++ ];
 	}
 
-	j = 0;
-	i++;
+	return;
+}
 
-	while (i < params->world_size)
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
 
-	world_heat[ BUFFER ][ i - params->world_width ] += world_heat[ MAP ][ j ];
 
+/**
+ * Move every bug once, in the order given by 'ids' (shuffled before, see
+ * shuffle_bugs(...)), one bug at a time. This is the reference engine,
+ * following NetLogo's semantics exactly.
+ * */
+void bug_step( const Swarm_t *const swarm, hb_map_t *const swarm_map,
+			hb_heat_t *const heat_map, float *const unhappiness,
+			size_t *const ids, AgentState_t *const state,
+			const Parameters_t *const params, const size_t iteration )
+{
+	/* For each bug, indexed by bug_ids[ idx ]. */
+	for (size_t idx = 0; idx < params->bugs_number; idx++)
+	{
+		bug_stream( state, iteration, ids[ idx ] );
 
-	/** + SOUTHEAST */
-		/* Compute southeast cells contributions. */
+		bug_move( ids[ idx ], swarm, swarm_map, heat_map, unhappiness,
+							params, state );
+	}
 
-	i = params->world_width;
-	j = 0;
+} /* end bug_step(...) */
 
-	while (i < params->world_size)
-	{
-		j++;
-		c = params->world_width;
 
-		while (c > 1)
-		{
-			world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
-			c--;
-		}
 
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j - params->world_width ];
-	}
+/** Atomic heat addition, as a compare and swap loop. GCC builtins. */
+static inline void atomic_add_heat( hb_heat_t *const addr, const float value )
+{
+	hb_heat_t expected, desired;
 
-	i = 0;
-	j++;
+	__atomic_load( addr, &expected, __ATOMIC_RELAXED );
 
-	while (j < params->world_size)
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
+	do {
+		desired = heat_put( heat_get( expected ) + value );
+	} while (!__atomic_compare_exchange( addr, &expected, &desired,
+			TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED ));
 
-	world_heat[ BUFFER ][ i ] += world_heat[ MAP ][ j - params->world_width ];
+	return;
+}
 
 
-	/** + SOUTHWEST */
-		/* Compute southwest cells contribution. */
+/** atomic_add_heat(...) to a heat cell, at 'row', 'col', and its ghosts. */
+static inline void atomic_add_heat_cell( hb_heat_t *const heat_map,
+	const Parameters_t *const params, const size_t cell,
+	const size_t row, const size_t col, const float value )
+{
+	size_t ghost[ NUM_NEIGHBOURS ];
+	const unsigned int n = heat_ghosts( params, cell, row, col, ghost );
 
-	i = params->world_width;
-	j = 0;
 
-	while (i < params->world_size)
-	{
-		i++;
-		c = params->world_width;
+	atomic_add_heat( &heat_map[ cell ], value );
 
-		while (c > 1)
-		{
-			world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
-			c--;
-		}
+	for (unsigned int g = 0; g < n; g++)
+		atomic_add_heat( &heat_map[ ghost[ g ] ], value );
 
-		world_heat[ BUFFER ][ i - params->world_width ] += world_heat[ MAP ][ j++ ];
-	}
+	return;
+}
 
-	i = 1;
 
-	while (i < params->world_width)
-		world_heat[ BUFFER ][ i++ ] += world_heat[ MAP ][ j++ ];
 
-	world_heat[ BUFFER ][ 0 ] += world_heat[ MAP ][ j ];
+/** Work shared by the slice tasks of bug_step_atomic(...). */
+typedef struct {
+	const Swarm_t *swarm;
+	hb_map_t *swarm_map;
+	hb_heat_t *heat_map;
+	float *unhappiness;
+	const size_t *ids;
+	AgentState_t *states;
+	const Parameters_t *params;
+	size_t slices;
+	size_t iteration;
+} AgentSlices_t;
 
 
-	/** Compute remaining heat and evaporation. */
+static void bug_step_slice( void *ctx, size_t slice,
+					unsigned int thread G_GNUC_UNUSED )
+{
+	const AgentSlices_t *const job = (const AgentSlices_t *) ctx;
 
-	for (i = 0; i < params->world_size; i++)
-	{
-		/* Get the 8th of the diffusion percentage of all neighbour cells. */
-		world_heat[ BUFFER ][ i ] = world_heat[ BUFFER ][ i ] * params->world_diffusion_rate / 8;
+	const Swarm_t *const swarm = job->swarm;
+	hb_map_t *const swarm_map = job->swarm_map;
+	hb_heat_t *const heat_map = job->heat_map;
+	const Parameters_t *const params = job->params;
+	AgentState_t *const state = &job->states[ slice ];
 
-		/* Add cell's remaining heat. */
-		world_heat[ BUFFER ][ i ] += world_heat[ MAP ][ i ] * (1 - params->world_diffusion_rate);
+	const size_t first = slice * params->bugs_number / job->slices;
+	const size_t last = (slice + 1) * params->bugs_number / job->slices;
 
+	size_t bug, bug_locus, bug_new_locus;
+	size_t cell;
+	float heat;
+	int todo;
 
-		/** Compute evaporation. */
 
-		world_heat[ BUFFER ][ i ] = world_heat[ BUFFER ][ i ] * (1 - params->world_evaporation_rate);
-	}
+	for (size_t idx = first; idx < last; idx++)
+	{
+		bug = job->ids[ idx ];
+		bug_locus = swarm->locus[ bug ];
 
+		const Around_t at = locate( bug_locus, params );
+		cell = HEAT_CELL( params, at.rc, at.cc );
 
-	/** Swap, so BUFFER becomes the new MAP. */
+		bug_stream( state, job->iteration, bug );
+		heat = atomic_load_heat( &heat_map[ cell ] );
 
-	/* Warning, this macro is using C99 extension. */
-	SWAP( world_heat[ BUFFER ], world_heat[ MAP ] );
+		/* Compute bug unhappiness, before trying to move. */
+		job->unhappiness[ bug ] =
+			fabs( (float) swarm->ideal_temperature[ bug ] - heat );
 
-	return;
-}
+		stats_bug( &state->stats, job->unhappiness[ bug ],
+						swarm->output_heat[ bug ] );
 
+		if (job->unhappiness[ bug ] == 0.0f)
+		{
+			atomic_add_heat_cell( heat_map, params, cell, at.rc, at.cc,
+						swarm->output_heat[ bug ] );
+			continue;	/* Next bug. */
+		}
 
+		/* Same choice as in bug_step(...). */
+		todo = (heat < swarm->ideal_temperature[ bug ])
+				? FIND_MAX_TEMPERATURE : FIND_MIN_TEMPERATURE;
 
-unsigned int best_free_neighbour( const int todo, const float *const heat_map,
-	const unsigned int *const swarm_map, const Parameters_t *const params,
-	const size_t bug_locus)
-{
-	/* Agent position into the world / 2D position. */
+		todo = (hb_rng_double_range( &state->rng, 0, 100 ) < params->bugs_random_move_chance)
+				? FIND_ANY_FREE : todo;
 
-	/* Central Row */
-	const size_t rc = bug_locus / params->world_width;
-	/* Contral Column */
-	const size_t cc = bug_locus % params->world_width;
+		/* Reads of heat_map and swarm_map may be stale here. */
+		bug_new_locus = best_free_neighbour_atomic( todo, heat_map,
+					swarm_map, params, &at, state );
 
-	/* Neighbouring rows and columns. */
+		/*
+		   Unlike in bug_step(...), the chosen cell may have been
+		   taken meanwhile by a bug of another thread. The cell is only
+		   ours if we are the ones turning it from empty to bug; when
+		   not, the bug stays where it is.
+		 */
+		if ((bug_new_locus != bug_locus)
+			&& !MAP_CLAIM( swarm_map, bug_new_locus ))
+		{
+			bug_new_locus = bug_locus;
+		}
 
-	/* Row at North. */
-	const size_t rn = (rc + 1) % params->world_height;
-	/* Row at South. */
-	const size_t rs = (rc + params->world_height - 1) % params->world_height;
-	/* Column at East. */
-	const size_t ce = (cc + 1) % params->world_width;
-	/* Columns at West. */
-	const size_t cw = (cc + params->world_width - 1) % params->world_width;
+		const Around_t to = locate( bug_new_locus, params );
+		cell = HEAT_CELL( params, to.rc, to.cc );
 
-	struct {
-		size_t pos;
-		float heat;
-	} best, neighbour[ NUM_NEIGHBOURS ];
+		atomic_add_heat_cell( heat_map, params, cell, to.rc, to.cc,
+						swarm->output_heat[ bug ] );
 
-	static unsigned int NEIGHBOUR_IDX[ NUM_NEIGHBOURS ] = {SW, S, SE, W, E, NW, N, NE};
+		if (bug_new_locus == bug_locus)
+			continue;	/* Next bug. */
 
+		/* Moved: the bug is only touched by this thread. */
+		swarm->locus[ bug ] = (hb_locus_t) bug_new_locus;
 
-	/*
-	 * Fisher-Yates shuffle algorithm to shuffle the neighbour index vector
-	 * so we can pick a random (or a best) neighbour by checking each index
-	 * until find a first free (or a best).
-	 * */
-	for (size_t i = 0; i < NUM_NEIGHBOURS; i++)
-	{
-		size_t rnd_i = (size_t) g_random_int_range( i, NUM_NEIGHBOURS );
+		/* Release the old cell, only after the new one is claimed. */
+		MAP_RELEASE( swarm_map, bug_locus );
+	}
 
-		if (rnd_i == i) continue;	/* Next shuffle. */
+	return;
+}
 
-		/* Warning, this macro is using C99 extension. */
-		SWAP( NEIGHBOUR_IDX[ i ], NEIGHBOUR_IDX[ rnd_i ] );
-	}
 
 
-	/* Compute back the vector positions. Used on both, best */
-	/* location and random location.                         */
+/**
+ * Parallel agents engine, with RELAXED semantics ('--agents atomic').
+ *
+ * Bugs are shuffled as for bug_step(...), then the shuffled 'ids' are split
+ * in one contiguous slice per thread, and the slices move concurrently:
+ *  - a move to a free cell is claimed with an atomic compare and swap on
+ *    'swarm_map', so two bugs never end up in the same cell; a bug losing
+ *    the race for its best cell stays where it is (it does not look for
+ *    a second best);
+ *  - heat deposits to 'heat_map' are atomic additions;
+ *  - bugs read heat and occupation while other threads are changing them,
+ *    so they may decide on slightly stale values.
+ * The outcome is a valid heatbugs step, but not the one bug_step(...)
+ * would compute for the same order, and it changes from run to run (and
+ * with the number of threads) even with the same seed. Use the serial
+ * engine when reproducibility is required.
+ * */
+void bug_step_atomic( const Swarm_t *const swarm, hb_map_t *const swarm_map,
+			hb_heat_t *const heat_map, float *const unhappiness,
+			size_t *const ids, AgentState_t *const states,
+			const Parameters_t *const params, HBPool_t *const pool,
+			const size_t iteration )
+{
+	AgentSlices_t job;
 
-	/* SW neighbour position. */
-	neighbour[ SW ].pos = rs * params->world_width + cw;
-	/* S neighbour position.  */
-	neighbour[ S  ].pos = rs * params->world_width + cc;
-	/* SE neighbour position. */
-	neighbour[ SE ].pos = rs * params->world_width + ce;
-	/* W neighbour position.  */
-	neighbour[ W  ].pos = rc * params->world_width + cw;
-	/* E neighbour position.  */
-	neighbour[ E  ].pos = rc * params->world_width + ce;
-	/* NW neighbour position. */
-	neighbour[ NW ].pos = rn * params->world_width + cw;
-	/* N neighbour position.  */
-	neighbour[ N  ].pos = rn * params->world_width + cc;
-	/* NE neighbour position. */
-	neighbour[ NE ].pos = rn * params->world_width + ce;
 
-	if (todo != FIND_ANY_FREE)
-	{
-		/* Fetch temperature of all neighbours. */
+	job.swarm = swarm;
+	job.swarm_map = swarm_map;
+	job.heat_map = heat_map;
+	job.unhappiness = unhappiness;
+	job.ids = ids;
+	job.states = states;
+	job.params = params;
+	job.slices = params->threads;
+	job.iteration = iteration;
 
-		/* SW neighbour temperature. */
-		neighbour[ SW ].heat = heat_map[ neighbour[ SW ].pos ];
-		/* S neighbour temperature. */
-		neighbour[ S  ].heat = heat_map[ neighbour[ S  ].pos ];
-		/* SE neighbour temperature. */
-		neighbour[ SE ].heat = heat_map[ neighbour[ SE ].pos ];
-		/* W neighbour temperature. */
-		neighbour[ W  ].heat = heat_map[ neighbour[ W  ].pos ];
-		/* E neighbour temperature. */
-		neighbour[ E  ].heat = heat_map[ neighbour[ E  ].pos ];
-		/* NW neighbour temperature. */
-		neighbour[ NW ].heat = heat_map[ neighbour[ NW ].pos ];
-		/* N neighbour temperature. */
-		neighbour[ N  ].heat = heat_map[ neighbour[ N  ].pos ];
-		/* NE neighbour temperature. */
-		neighbour[ NE ].heat = heat_map[ neighbour[ NE ].pos ];
+	if (pool)
+		hb_pool_run( pool, bug_step_slice, &job, job.slices );
+	else
+		bug_step_slice( &job, 0, 0 );
 
-		/* Actual bug location is the best location, until otherwise. */
-		best.pos = bug_locus;			/* Bug position. */
-		best.heat = heat_map[ best.pos ];	/* Temperature at bug position. */
+	/* Ghosts took the same heat as their cells, maybe rounded in another */
+	/* order: make them exact copies again.                                */
+	heat_halo_refresh( heat_map, params );
 
-		/*
-		   Find the hottest or coolest location in the neighbourhood;
-		   also take current position into consideration.
-		*/
+	return;
+}
 
-		/* Loop unroll. */
-		if (todo == FIND_MAX_TEMPERATURE)
-		{
-			if (neighbour[ NEIGHBOUR_IDX[0] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[0] ];
 
-			if (neighbour[ NEIGHBOUR_IDX[1] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[1] ];
 
-			if (neighbour[ NEIGHBOUR_IDX[2] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[2] ];
+/** Work shared by the tile tasks of bug_step_checkerboard(...). */
+typedef struct {
+	const Swarm_t *swarm;
+	hb_map_t *swarm_map;
+	hb_heat_t *heat_map;
+	float *unhappiness;
+	const CheckerBoard_t *board;
+	AgentState_t *states;
+	const Parameters_t *params;
+	size_t iteration;
+	size_t colour;		/* Colour of the tiles in the current phase. */
+} AgentTiles_t;
+
+
+static void bug_step_tile( void *ctx, size_t task, unsigned int thread )
+{
+	const AgentTiles_t *const job = (const AgentTiles_t *) ctx;
+	const CheckerBoard_t *const board = job->board;
+	AgentState_t *const state = &job->states[ thread ];
+
+	const size_t tile = board->colour_tiles[
+				board->colour_start[ job->colour ] + task ];
+	size_t *const bugs = board->tile_bugs + board->tile_start[ tile ];
+	const size_t nbugs = board->tile_start[ tile + 1 ] - board->tile_start[ tile ];
 
-			if (neighbour[ NEIGHBOUR_IDX[3] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[3] ];
+	/* The tile's own stream: same numbers whatever thread runs it. */
+	hb_rng_stream( &state->rng, HB_STREAM_TILE, job->iteration, tile );
 
-			if (neighbour[ NEIGHBOUR_IDX[4] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[4] ];
+	for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+		state->neighbour_idx[ n ] = n;
 
-			if (neighbour[ NEIGHBOUR_IDX[5] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[5] ];
+	/* Fisher-Yates shuffle of the tile's bugs. */
+	for (size_t idx = 0; idx + 1 < nbugs; idx++)
+	{
+		size_t rnd_idx = idx + (size_t) hb_rng_int_range( &state->rng,
+							0, nbugs - idx );
 
-			if (neighbour[ NEIGHBOUR_IDX[6] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[6] ];
+		SWAP( bugs[ idx ], bugs[ rnd_idx ] );
+	}
 
-			if (neighbour[ NEIGHBOUR_IDX[7] ].heat > best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[7] ];
-		}
-		else	/* todo == FIND_MIN_TEMPERATURE */
-		{
-			if (neighbour[ NEIGHBOUR_IDX[0] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[0] ];
+	/* And each bug its own stream. */
+	for (size_t idx = 0; idx < nbugs; idx++)
+	{
+		bug_stream( state, job->iteration, bugs[ idx ] );
 
-			if (neighbour[ NEIGHBOUR_IDX[1] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[1] ];
+		bug_move( bugs[ idx ], job->swarm, job->swarm_map, job->heat_map,
+				job->unhappiness, job->params, state );
+	}
 
-			if (neighbour[ NEIGHBOUR_IDX[2] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[2] ];
+	return;
+}
 
-			if (neighbour[ NEIGHBOUR_IDX[3] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[3] ];
 
-			if (neighbour[ NEIGHBOUR_IDX[4] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[4] ];
 
-			if (neighbour[ NEIGHBOUR_IDX[5] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[5] ];
+/**
+ * Parallel and DETERMINISTIC agents engine ('--agents checkerboard').
+ *
+ * The world is split in tiles at least 'tile_size' (>= 3) cells wide,
+ * coloured 2x2 by the parity of their tile coordinates. A bug reads and
+ * writes only cells at distance 1 from where it stands, so two bugs from
+ * different tiles of the same colour, being at least one whole tile apart,
+ * never touch the same 'swarm_map' or 'heat_map' cell. Each iteration:
+ *  1) bugs are grouped by the tile they stand in, in bug id order;
+ *  2) the four colours are run one after the other, in a seeded order;
+ *     in each colour phase the tiles run concurrently, each one moving
+ *     its bugs, one at a time, in a seeded shuffled order, with bug_move(...).
+ * All random numbers come from Philox streams named by (iteration, tile)
+ * or (iteration, bug), never from a thread's history, so the result is the
+ * same for any number of threads. It is not the result bug_step(...) would give, since
+ * bugs are visited tile by tile rather than in one global shuffled order.
+ * */
+void bug_step_checkerboard( const Swarm_t *const swarm, hb_map_t *const swarm_map,
+			hb_heat_t *const heat_map, float *const unhappiness,
+			CheckerBoard_t *const board, AgentState_t *const states,
+			const Parameters_t *const params, HBPool_t *const pool,
+			const size_t iteration )
+{
+	AgentTiles_t job;
+	size_t colours[ TILE_COLOURS ] = { 0, 1, 2, 3 };
+	size_t row, col;
 
-			if (neighbour[ NEIGHBOUR_IDX[6] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[6] ];
 
-			if (neighbour[ NEIGHBOUR_IDX[7] ].heat < best.heat)
-				best = neighbour[ NEIGHBOUR_IDX[7] ];
-		}
+	/** Group bugs by tile (counting sort, stable in bug id). */
 
-		/*
-		   Return if the bug is already in the best local or if the
-		   best local is bug free.
-		 * */
-		if ((best.pos == bug_locus) || HAS_NO_BUG( swarm_map[ best.pos ] ))
-			return best.pos;
+	memset( board->tile_start, 0, (board->tiles + 1) * sizeof( size_t ) );
 
-	} /* end_if (todo != GOTO_ANY_FREE) */
+	for (size_t bug = 0; bug < params->bugs_number; bug++)
+	{
+		row = swarm->locus[ bug ] / params->world_width;
+		col = swarm->locus[ bug ] - row * params->world_width;
 
+		board->tile_start[ 1 + board->row_tile[ row ] * board->tiles_x
+					+ board->col_tile[ col ] ]++;
+	}
 
-	/*
-	 * Here, there is a random moving chance, or best neighbour is not
-	 * free. Try to find any available free place.
-	 * */
+	for (size_t tile = 0; tile < board->tiles; tile++)
+		board->tile_start[ tile + 1 ] += board->tile_start[ tile ];
 
-	/*
-	 * Fisher-Yates shuffle algorithm to shuffle an index vector so we can
-	 * pick a random free neighbour by checking each index until find a
-	 * first free.
-	 * */
+	memcpy( board->tile_fill, board->tile_start, board->tiles * sizeof( size_t ) );
 
-//	 for (size_t i = 0; i < NUM_NEIGHBOURS; i++)
-//	{
-//		size_t rnd_i = (size_t) g_random_int_range( i, NUM_NEIGHBOURS );
+	for (size_t bug = 0; bug < params->bugs_number; bug++)
+	{
+		row = swarm->locus[ bug ] / params->world_width;
+		col = swarm->locus[ bug ] - row * params->world_width;
 
-//		if (rnd_i == i) continue;	/* Next shuffle. */
+		board->tile_bugs[ board->tile_fill[ board->row_tile[ row ]
+			* board->tiles_x + board->col_tile[ col ] ]++ ] = bug;
+	}
 
-//		/* Warning, this macro is using C99 extension. */
-//		SWAP( NEIGHBOUR_IDX[ i ], NEIGHBOUR_IDX[ rnd_i ] );
-//	}
 
+	/** Seeded colour order, so no colour always moves first. */
 
-	/* Loop unroll. */
+	hb_rng_stream( &states[ 0 ].rng, HB_STREAM_COLOURS, iteration, 0 );
 
-	/* Find a first free neighbour. Index over the 8 neighbours. */
-	best.pos = neighbour[ NEIGHBOUR_IDX[0] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
+	for (size_t c = 0; c + 1 < TILE_COLOURS; c++)
+	{
+		size_t rnd_c = c + (size_t) hb_rng_int_range( &states[ 0 ].rng,
+						0, TILE_COLOURS - c );
 
-	best.pos = neighbour[ NEIGHBOUR_IDX[1] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
+		SWAP( colours[ c ], colours[ rnd_c ] );
+	}
 
-	best.pos = neighbour[ NEIGHBOUR_IDX[2] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
 
-	best.pos = neighbour[ NEIGHBOUR_IDX[3] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
+	/** Colour phases, tiles of one colour run concurrently. */
 
-	best.pos = neighbour[ NEIGHBOUR_IDX[4] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
+	job.swarm = swarm;
+	job.swarm_map = swarm_map;
+	job.heat_map = heat_map;
+	job.unhappiness = unhappiness;
+	job.board = board;
+	job.states = states;
+	job.params = params;
+	job.iteration = iteration;
 
-	best.pos = neighbour[ NEIGHBOUR_IDX[5] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
+	for (size_t c = 0; c < TILE_COLOURS; c++)
+	{
+		const size_t ntiles = board->colour_start[ colours[ c ] + 1 ]
+					- board->colour_start[ colours[ c ] ];
 
-	best.pos = neighbour[ NEIGHBOUR_IDX[6] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
+		job.colour = colours[ c ];
 
-	best.pos = neighbour[ NEIGHBOUR_IDX[7] ].pos;
-	if (HAS_NO_BUG( swarm_map[ best.pos ] )) return best.pos;
+		if (pool)
+			hb_pool_run( pool, bug_step_tile, &job, ntiles );
+		else
+			for (size_t task = 0; task < ntiles; task++)
+				bug_step_tile( &job, task, 0 );
+	}
 
-	return bug_locus;	/* There is no free neighbour. */
+	return;
 }
 
 
 
-void bug_step( bug_t *const swarm, unsigned int *const swarm_map,
-			float *const heat_map, float *const unhappiness,
-			const Parameters_t *const params )
+/**
+ * Add the heat of the world's cells of 'heat_map' to 'heat', a row at a
+ * time (see heat_total(...)).
+ * */
+void world_heat_total( const hb_heat_t *const heat_map,
+			const Parameters_t *const params, HBSum_t *const heat )
 {
-	static size_t *ids = NULL;		/* Bugs id. */
+	for (size_t row = 0; row < params->world_height; row++)
+		sum_add( heat, heat_total( heat_map + HEAT_CELL( params, row, 0 ),
+						params->world_width ) );
+
+	return;
+}
 
-	size_t bug_locus, bug_new_locus;
-	int todo;
 
 
-	/* One time vector initialization. Used to shuffle bugs. */
-	if (!ids)
+/**
+ * Copy the heat map's ghost border from the world's cells across the torus
+ * edges (see HEAT_CELL): the west and east ghost columns of every row, then
+ * the south and north ghost rows, corners included.
+ *
+ * @param[in,out]	heat_map	- Heat map, with its ghost border.
+ * @param[in]		params		- Simulation parameters.
+ * */
+void heat_halo_refresh( hb_heat_t *const heat_map, const Parameters_t *const params )
+{
+	const size_t width = params->world_width;
+	const size_t height = params->world_height;
+	const size_t stride = params->heat_stride;
+
+
+	for (size_t row = 0; row < height; row++)
 	{
-		ids = (size_t *) malloc( params->bugs_number * sizeof( size_t ) );
+		hb_heat_t *const line = heat_map + HEAT_CELL( params, row, 0 );
 
-		for (size_t idx = 0; idx < params->bugs_number; idx++)
-			ids[ idx ] = idx;
+		line[ -1 ] = line[ width - 1 ];
+		line[ width ] = line[ 0 ];
 	}
 
-	/*
-	 * Fisher-Yates shuffle algorithm.
-	 * Use the vector to add randomness to the order bugs are selected
-	 * for moving, preventing the same bug to always get the chance	to
-	 * pick best location first.
-	 * It should be more efficient to shuffle an integer bug indexer vector
-	 * than shuffle the bugs vector, since every bug is a 3 integer
-	 * structure.
-	 * */
+	/* Whole rows, from their west ghost. */
+	memcpy( heat_map, heat_map + height * stride, stride * sizeof( hb_heat_t ) );
+	memcpy( heat_map + (height + 1) * stride, heat_map + stride,
+						stride * sizeof( hb_heat_t ) );
 
-	/* Shuffle bugs indexer vector. */
-	for (size_t idx = 0; idx < params->bugs_number; idx++)
-	{
-		/* The chance of j == i CANNOT be excluded because keeping the	*/
-		/* value in the same position generates also a valid sequence.	*/
-		size_t rnd_idx = (size_t) g_random_int_range( idx, params->bugs_number );
+	return;
+}
 
-		if (rnd_idx == idx) continue;	/* Next shuffle.	*/
 
-		/* Warning, this macro is using C99 extension. */
-		SWAP( ids[ idx ], ids[ rnd_idx ] );
+
+/**
+ * Compute world heat, diffusion followed by evaporation, with the engine
+ * selected in the parameters, the fused one sparse when 'sparse_epsilon' is
+ * set. Only the fused and box-sum engines make use of the thread pool; v1
+ * and v2 are kept serial, as references. Engines write the world's cells
+ * only, its ghost border is refreshed after.
+ *
+ * When the world heat is output (HB_STAT_HEAT), it's added to the
+ * iteration's statistics: summed by the fused kernel as it goes, after
+ * the other engines.
+ * */
+void comp_world_heat( HBBuffers_t *const buff, const Parameters_t *const params,
+							HBPool_t *const pool )
+{
+	HBSum_t *const heat = (params->columns & HB_STAT_HEAT)
+					? &buff->stats.heat : NULL;
+
+
+	switch (params->diffusion)
+	{
+#ifndef HB_HEAT_16
+		case DIFFUSION_V1:
+			comp_world_heat_v1( buff->world_heat[ MAP ],
+					buff->world_heat[ BUFFER ], params );
+			SWAP( buff->world_heat[ BUFFER ], buff->world_heat[ MAP ] );
+			break;
+		case DIFFUSION_V2:
+			comp_world_heat_v2( buff->world_heat, params );
+			break;
+#endif
+		case DIFFUSION_BOXSUM:
+			if (pool)
+				comp_world_heat_mt( buff->world_heat,
+						buff->row_sums, params, pool, NULL );
+			else
+				comp_world_heat_boxsum( buff->world_heat,
+						buff->row_sums, params );
+			break;
+		default:	/* DIFFUSION_FUSED */
+			if (buff->activity)
+				comp_world_heat_sparse( buff->world_heat,
+						buff->activity, &buff->swarm,
+						params, pool, heat );
+			else if (pool)
+				comp_world_heat_mt( buff->world_heat, NULL,
+							params, pool, heat );
+			else
+				comp_world_heat_v3( buff->world_heat, params, heat );
 	}
 
+	if (heat && (params->diffusion != DIFFUSION_FUSED))
+		world_heat_total( buff->world_heat[ MAP ], params, heat );
 
-	/* For each bug, indexed by bug_ids[ idx ]. */
+	heat_halo_refresh( buff->world_heat[ MAP ], params );
 
-	#define BUG ids[idx]
+	return;
+}
 
-	for (size_t idx = 0; idx < params->bugs_number; idx++)
-	{
-		bug_locus = swarm[ BUG ].locus;
 
-		/* Compute bug unhappiness, before trying to move. */
-		unhappiness[ BUG ] =
-			fabs( (float) swarm[ BUG ].ideal_temperature - heat_map[ bug_locus ] );
 
-		/*
-		 * Usually compare equality of floats is absurd. Netlogo
-		 * wrapps the code with: if (unhappiness > 0) { do stuff... }
-		 * I decided to unwrap, terminating as soon as possible using
-		 * if (bug_unhappiness = 0.0f) {...}  and continue the
-		 * remaining code as a fall out case for (bug_unhappiness >
-		 * 0.0f). After all, this is semantically equivalent to
-		 * netlogo version.
-		 * */
-		if (unhappiness[ BUG ] == 0.0f)
-		{
-			 /* Bug hasn't move, we don't need to update swarm. */
-			 heat_map[ bug_locus ] += swarm[ BUG ].output_heat;
-			 continue;	/* Next bug. */
-		}
+/**
+ * Clear the statistics 's' for a new iteration.
+ * */
+void stats_reset( HBStats_t *const s, const Parameters_t *const params )
+{
+	memset( s, 0, sizeof( HBStats_t ) );
 
-		/* Arriving here, means (unhappiness > 0.0f) */
+	s->min = INFINITY;
+	s->max = 0.0f;		/* Unhappiness is never negative. */
+	s->hist_scale = HB_HIST_BINS
+			/ (float) (params->bugs_temperature_max_ideal + 1);
 
-		/*
-			Find the best place for the bug to go.
-			In order to implement netlogo approach, that is
-			(in netlogo order), to compute:
-			1) random-move-chance,
-			2) best-patch for (temp <  ideal_temp) (when bug is COLD),
-			3) best-patch for (temp >= ideal_temp) (when bug is HOT),
-			we use the C conditional function twice.
-
-			A variable is used to hold what to do, (1), (2) or (3).
-			However the order must be reversed since (1), when
-			happen, takes precedence over (2) or (3), whatever
-			(2) XOR (3) are true or not.
-		*/
+	return;
+}
 
-		todo = (heat_map[ bug_locus ] < swarm[ BUG ].ideal_temperature)
-				? FIND_MAX_TEMPERATURE : FIND_MIN_TEMPERATURE;
 
-		todo = (g_random_double_range(0, 100) < params->bugs_random_move_chance)
-				? FIND_ANY_FREE : todo;
 
+/**
+ * Add the statistics 'part' (e.g. of a thread's bugs) to 's'.
+ * */
+void stats_merge( HBStats_t *const s, const HBStats_t *const part )
+{
+	s->bugs += part->bugs;
+	sum_merge( &s->unhappiness, &part->unhappiness );
+	sum_merge( &s->unhappiness_sq, &part->unhappiness_sq );
+
+	if (part->min < s->min) s->min = part->min;
+	if (part->max > s->max) s->max = part->max;
 
-		bug_new_locus = best_free_neighbour( todo, heat_map, swarm_map,
-						params, bug_locus);
+	for (int bin = 0; bin < HB_HIST_BINS; bin++)
+		s->hist[ bin ] += part->hist[ bin ];
 
-		/*
-			Since the execution line is serial, 'bug_new_locus' is
-			garantee to be: 1) the same as 'bug_locus', or 2) a new
-			free location.
-			It is not necessary to check again the free position,
-			so we can update temperature at 'bug_new_locus',
-			and only then check if the bug move or stay at the same
-			'bug_locus' position.
-		*/
-		heat_map[ bug_new_locus ] += swarm[ BUG ].output_heat;
+	sum_merge( &s->heat, &part->heat );
 
+	return;
+}
 
-		/* If bug's current location is already the best one... */
-		if (bug_new_locus == bug_locus)
-		{
-			/* Bug hasn't move, we don't need to update swarm's. */
-			continue;	/* Next bug. */
-		}
 
-		/* Otherwise, move the bug to his new 'best' location. */
 
-		/* Set new bug location in the "swarm". */
-		swarm[ BUG ].locus = bug_new_locus; /* Update swarm. */
+/**
+ * Add an iteration's unhappiness 'average' to the last ones, and tell if
+ * they are stationary: once both windows are full, the newer one's mean
+ * and standard deviation are each within 'converge_tolerance' (relative
+ * to the newer mean) of the older one's. The oldest average drops out of
+ * the older window, the newer window's oldest moves to the older one.
+ *
+ * @param[in,out]	conv	- The averages so far.
+ * @param[in]	average		- This iteration's.
+ * @param[in]	params		- Simulation parameters.
+ * */
+gboolean converged( Convergence_t *const conv, const double average,
+					const Parameters_t *const params )
+{
+	const size_t window = conv->window;
+	const size_t slot = conv->count % (2 * window);
+	double mean[ 2 ], sd[ 2 ];
 
-		/* Move the bug to the new location in the "swarm_map". */
-		swarm_map[ bug_locus ] = A_EMPTY_CELL;
-		swarm_map[ bug_new_locus ] = A_BUG;
-	} /* END_for_each_bug */
 
-	#undef BUG
+	if (conv->count >= 2 * window)
+	{
+		sum_add( &conv->sum[ 0 ], -conv->averages[ slot ] );
+		sum_add( &conv->sum_sq[ 0 ],
+			-conv->averages[ slot ] * conv->averages[ slot ] );
+	}
 
-} /* end bug_step(...) */
+	if (conv->count >= window)
+	{
+		const double moved = conv->averages[ (slot + window) % (2 * window) ];
+
+		sum_add( &conv->sum[ 1 ], -moved );
+		sum_add( &conv->sum_sq[ 1 ], -moved * moved );
+		sum_add( &conv->sum[ 0 ], moved );
+		sum_add( &conv->sum_sq[ 0 ], moved * moved );
+	}
+
+	conv->averages[ slot ] = average;
+	sum_add( &conv->sum[ 1 ], average );
+	sum_add( &conv->sum_sq[ 1 ], average * average );
+	conv->count++;
+
+	if (conv->count < 2 * window) return FALSE;
+
+	for (int w = 0; w < 2; w++)
+	{
+		mean[ w ] = sum_get( &conv->sum[ w ] ) / window;
+		sd[ w ] = sqrt( MAX( sum_get( &conv->sum_sq[ w ] ) / window
+						- mean[ w ] * mean[ w ], 0.0 ) );
+	}
+
+	return (fabs( mean[ 1 ] - mean[ 0 ] )
+			<= params->converge_tolerance * fabs( mean[ 1 ] ))
+		&& (fabs( sd[ 1 ] - sd[ 0 ] )
+			<= params->converge_tolerance * fabs( mean[ 1 ] ));
+}
 
 
 
 /**
  * Initiate the world and create agents.
+ *
+ * With a 'prof', each phase of every iteration is timed (see hb_profile.h).
+ * The checkerboard engine shuffles bugs inside its tiles, so for it that
+ * time is part of the movement phase.
+ *
+ * With 'snaps', the world is also snapshot before the first iteration and
+ * after every 'params->snapshot_every' iterations (see hb_snapshot.h).
+ *
+ * After every 'params->checkpoint_every' iterations the results are synced
+ * and the whole state saved (see hb_checkpoint.h). A restart begins at the
+ * checkpoint's iteration 'start', its first record being already output.
+ *
+ * Each record holds the statistics of the iteration (see hb_output_stats),
+ * gathered as it goes: the bugs' by each agent thread as they move, the
+ * world heat by the diffusion (plus the heat bugs left), so there's no
+ * pass of its own over the bugs or the world.
+ *
+ * With a 'params->converge_window', the simulation stops early once the
+ * unhappiness average is stationary (see converged(...)), and the output
+ * notes the iteration. The windows' averages are checkpointed, so a
+ * restart stops where the uninterrupted run does.
  * */
 void simulate( HBBuffers_t *const buff, const Parameters_t *const params,
-			FILE *hbResultFile, GError **err )
+			HBPool_t *const pool, HBProfile_t *const prof,
+			HBOutput_t *const output, HBSnapshots_t *const snaps,
+			const size_t start, GError **err )
 {
-	/* GError *err_simulate = NULL; */
+	GError *err_simulate = NULL;
 
-	float unhapp_average;
 	size_t iter_counter;
+	gboolean stationary = FALSE;
+	HBSnapshotMark_t snaps_mark;
+
 
+	/** Get the initial statistics, no bug has moved yet. */
+	if (start == 0)
+	{
+		stats_reset( &buff->stats, params );
+
+		for (size_t bug = 0; bug < params->bugs_number; bug++)
+			stats_bug( &buff->stats, buff->unhappiness[ bug ], 0.0f );
+
+		if (params->columns & HB_STAT_HEAT)
+			world_heat_total( buff->world_heat[ MAP ], params,
+							&buff->stats.heat );
+
+		/* Output result to file. */
+		hb_output_stats( output, &buff->stats, &err_simulate );
+		hb_if_err_propagate_goto( err, err_simulate, error_handler );
+	}
 
-	/** Get unhappiness. */
-	unhapp_average = average( buff->unhappiness, params->bugs_number );
+	/* Initial world. */
+	if (snaps)
+	{
+		hb_snapshots_take( snaps, buff->world_heat[ MAP ],
+					buff->swarm_map, start, &err_simulate );
+		hb_if_err_propagate_goto( err, err_simulate, error_handler );
+	}
 
-	/* Output result to file. */
-	fprintf( hbResultFile, "%.17g\n", unhapp_average );
 
+	iter_counter = start;
 
-	iter_counter = 0;
+	hb_profile_mark( prof );
 
 	/*******************************/
 	/**      SIMULATION LOOP      **/
 	/*******************************/
 
-	while ( (iter_counter < params->numIterations)
-		|| (params->numIterations == 0) )
+	while ( ((iter_counter < params->numIterations)
+			|| (params->numIterations == 0))
+		&& !stationary )
 	{
+		stats_reset( &buff->stats, params );
+
+		for (unsigned int t = 0; t < params->threads; t++)
+			stats_reset( &buff->agent_states[ t ].stats, params );
+
 		/** Compute world heat, diffusion followed by evaporation. */
-		comp_world_heat_v2( buff->world_heat, params );
+		comp_world_heat( buff, params, pool );
 
-		/** Perform bug step. */
-		/* Use 'bufsel' to point the correct buffer. */
-		bug_step( buff->swarm, buff->swarm_map, buff->world_heat[ MAP ],
-				buff->unhappiness, params );
+		hb_profile_lap( prof, HB_PHASE_DIFFUSION );
+
+		/** Shuffle the order bugs move in. */
+		if (buff->order)
+			shuffle_bugs_spatial( buff->ids, buff->order,
+				&buff->swarm, params,
+				&buff->agent_states[ 0 ].rng, iter_counter );
+		else if (params->agents != AGENTS_CHECKERBOARD)
+			shuffle_bugs( buff->ids, params,
+				&buff->agent_states[ 0 ].rng, iter_counter );
 
-		/** Get unhappiness. */
-		unhapp_average = average( buff->unhappiness, params->bugs_number );
+		hb_profile_lap( prof, HB_PHASE_SHUFFLE );
+
+		/** Perform bug step. */
+		if (params->agents == AGENTS_CHECKERBOARD)
+			bug_step_checkerboard( &buff->swarm, buff->swarm_map,
+				buff->world_heat[ MAP ], buff->unhappiness,
+				buff->board, buff->agent_states, params, pool,
+				iter_counter );
+		else if (params->agents == AGENTS_ATOMIC)
+			bug_step_atomic( &buff->swarm, buff->swarm_map,
+				buff->world_heat[ MAP ], buff->unhappiness,
+				buff->ids, buff->agent_states, params, pool,
+				iter_counter );
+		else
+			bug_step( &buff->swarm, buff->swarm_map,
+				buff->world_heat[ MAP ], buff->unhappiness,
+				buff->ids, buff->agent_states, params,
+				iter_counter );
+
+		hb_profile_lap( prof, HB_PHASE_MOVEMENT );
+
+		/** Gather the statistics of the agent threads. */
+		for (unsigned int t = 0; t < params->threads; t++)
+			stats_merge( &buff->stats, &buff->agent_states[ t ].stats );
+
+		/* Stop once the unhappiness average is stationary. */
+		if (buff->converge)
+			stationary = converged( buff->converge,
+					stats_mean( &buff->stats ), params );
+
+		hb_profile_lap( prof, HB_PHASE_STATS );
 
 		/* Output result to file. */
-		fprintf( hbResultFile, "%.17g\n", unhapp_average );
+		hb_output_stats( output, &buff->stats, &err_simulate );
+		hb_if_err_propagate_goto( err, err_simulate, error_handler );
+
+		hb_profile_lap( prof, HB_PHASE_OUTPUT );
 
 		/** Prepare next iteration. */
 
 		iter_counter++;
+
+		/* World snapshot, copied here and written by its own thread. */
+		if (snaps && (iter_counter % params->snapshot_every == 0))
+		{
+			hb_snapshots_take( snaps, buff->world_heat[ MAP ],
+				buff->swarm_map, iter_counter, &err_simulate );
+			hb_if_err_propagate_goto( err, err_simulate, error_handler );
+
+			hb_profile_lap( prof, HB_PHASE_SNAPSHOT );
+		}
+
+		/* Checkpoint, once the results and frames it covers are on disk. */
+		if (params->checkpoint_every
+			&& (iter_counter % params->checkpoint_every == 0))
+		{
+			hb_output_sync( output, &err_simulate );
+			hb_if_err_propagate_goto( err, err_simulate, error_handler );
+
+			if (snaps)
+			{
+				hb_snapshots_sync( snaps, &snaps_mark, &err_simulate );
+				hb_if_err_propagate_goto( err, err_simulate, error_handler );
+			}
+
+			hb_checkpoint_save( buff, params, iter_counter,
+				snaps ? &snaps_mark : NULL, &err_simulate );
+			hb_if_err_propagate_goto( err, err_simulate, error_handler );
+
+			hb_profile_lap( prof, HB_PHASE_CHECKPOINT );
+		}
 	}
+
+	if (stationary) hb_output_stop( output, iter_counter );
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Release the simulation buffers. Safe on partly set up buffers.
+ * */
+void freeBuffers( HBBuffers_t *const buff )
+{
+	if (buff->grand) g_rand_free( buff->grand );
+	if (buff->agent_states) free( buff->agent_states );
+	freeSpatialOrder( buff->order );
+	freeActivity( buff->activity );
+	freeConvergence( buff->converge );
+	freeCheckerBoard( buff->board );
+	if (buff->ids) free( buff->ids );
+	if (buff->row_sums) free( buff->row_sums );
+	if (buff->unhappiness) free( buff->unhappiness );
+	if (buff->world_heat[ BUFFER ]) free( buff->world_heat[ BUFFER ] );
+	if (buff->world_heat[ MAP ]) free( buff->world_heat[ MAP ] );
+	if (buff->swarm_map) free( buff->swarm_map );
+	freeSwarm( &buff->swarm );
+
+	return;
 }
 
 
 
 
+/* Other programs (e.g. hb_bench) link this file with their own main(...). */
+#ifndef HB_NO_MAIN
+
 int main( int argc, char *argv[] )
 {
-	FILE *hbResultFile = NULL;
+	HBOutput_t *output = NULL;	/* Results file. */
+	HBSnapshots_t *snaps = NULL;	/* World snapshots, if requested. */
 	GError *err_main = NULL;	/* Error reporting object, from Glib. */
 
 	Parameters_t params;		/* Simulation parameters. */
 
-	HBBuffers_t buff = { NULL, NULL, { NULL, NULL }, NULL };	/* Buffers used for simulation. */
+	HBBuffers_t buff;		/* Buffers used for simulation. */
+
+	HBPool_t *pool = NULL;		/* Worker threads, when threads > 1. */
+
+	HBProfile_t *prof = NULL;	/* Phase timings, with '--profile'. */
+
+	size_t start = 0;		/* Iterations done, when restarting. */
+	HBSnapshotMark_t snaps_mark = { 0, 0 };	/* Frames then written. */
 
 
+	/* Every buffer NULL, so clean_all frees only those set up. */
+	memset( &buff, 0, sizeof( HBBuffers_t ) );
 
 	getSimulParameters( &params, argc, argv, &err_main );
 	hb_if_err_goto( err_main, error_handler );
 
+
+	/* Start worker threads, if requested. */
+	if (params.threads > 1)
+	{
+		pool = hb_pool_new( params.threads, &err_main );
+		hb_if_err_goto( err_main, error_handler );
+	}
+
+
+	/* An ensemble runs its simulations, one per pool thread at a time. */
+	if (params.ensemble > 0)
+	{
+		hb_ensemble_run( &params, pool, &err_main );
+		hb_if_err_goto( err_main, error_handler );
+
+		goto clean_all;
+	}
+
+	/* So does a sweep, with its jobs. */
+	if (params.sweep_filename[ 0 ] != '\0')
+	{
+		hb_sweep_run( &params, pool, &err_main );
+		hb_if_err_goto( err_main, error_handler );
+
+		goto clean_all;
+	}
+
+
 	setupBuffers( &buff, &params, &err_main );
 	hb_if_err_goto( err_main, error_handler );
 
 
-	/* Open output file for results. */
-	hbResultFile = fopen(params.output_filename, "w+");	/* Open file overwrite. */
-	hb_if_err_create_goto( err_main, HB_ERROR,
-		hbResultFile == NULL, HB_UNABLE_OPEN_FILE, error_handler,
-		"Could not open output file." );
+	/* Phase timings, if requested. */
+	if (params.profile)
+	{
+		prof = hb_profile_new( &err_main );
+		hb_if_err_goto( err_main, error_handler );
+	}
+
+
+	/* Initiate, or restore the checkpoint restarted from. */
+	if (params.restart_filename[ 0 ] != '\0')
+	{
+		start = hb_checkpoint_load( &buff, &params, &snaps_mark, &err_main );
+		hb_if_err_goto( err_main, error_handler );
+	}
+	else
+	{
+		initiate( &buff, &params );
+	}
+
+
+	/* Open output file for results, continued after a restart. */
+	output = hb_output_open( &params,
+			start ? start / params.output_every + 1 : 0, &err_main );
+	hb_if_err_goto( err_main, error_handler );
 
+	/* And for world snapshots, if requested. */
+	if (params.snapshot_every > 0)
+	{
+		snaps = hb_snapshots_open( &params,
+			(params.restart_filename[ 0 ] != '\0') ? &snaps_mark : NULL,
+							&err_main );
+		hb_if_err_goto( err_main, error_handler );
+	}
 
-	/* Initiate. */
-	initiate( &buff, &params );
 
 	/* Simulate */
-	simulate( &buff, &params, hbResultFile, &err_main );
+	simulate( &buff, &params, pool, prof, output, snaps, start, &err_main );
+	hb_if_err_goto( err_main, error_handler );
 
 
 //	printf( "End...\n\n" );
 
-	/* TODO: Profiling. */
+	/* Profiling. */
+	hb_profile_report( prof, stdout );
 
 
 	goto clean_all;
@@ -1280,20 +3790,37 @@ error_handler:
 	/* Handle error. */
 	fprintf( stderr, "Error: %s\n\n", err_main->message );
 	g_error_free( err_main );
+	err_main = NULL;
 
 
 clean_all:
 
-	if (hbResultFile) fclose( hbResultFile );
+	/* Results simulated so far are kept, even after an error. */
+	hb_output_close( output, &err_main );
+	if (err_main)
+	{
+		fprintf( stderr, "Error: %s\n\n", err_main->message );
+		g_error_free( err_main );
+		err_main = NULL;
+	}
+
+	hb_snapshots_close( snaps, &err_main );
+	if (err_main)
+	{
+		fprintf( stderr, "Error: %s\n\n", err_main->message );
+		g_error_free( err_main );
+	}
+
+	hb_profile_free( prof );
 
-	if (buff.unhappiness) free( buff.unhappiness );
-	if (buff.world_heat[ BUFFER ]) free( buff.world_heat[ BUFFER ] );
-	if (buff.world_heat[ MAP ]) free( buff.world_heat[ MAP ] );
-	if (buff.swarm_map) free( buff.swarm_map );
-	if (buff.swarm) free( buff.swarm );
+	hb_pool_free( pool );
+
+	freeBuffers( &buff );
 
 	// if (err_main) g_error_free( err_main );
 
 
 	return OKI_DOKI;
 }
+
+#endif	/* HB_NO_MAIN */
@@ -20,6 +20,13 @@
 
 
 #include  <stdio.h>
+#include  <stddef.h>	/* ptrdiff_t */
+#include  <math.h>	/* fabs(...), in bug_move(...). */
+
+#include  "glib.h"
+
+#include  "hb_pool.h"
+#include  "hb_rng.h"
 
 
 /**
@@ -103,19 +110,1029 @@ enum hb_error_codes {
 	/** Unable to open file. */
 	HB_UNABLE_OPEN_FILE = -12,
 	/** Memory alocation failed. */
-	HB_MALLOC_FAILURE = -13
+	HB_MALLOC_FAILURE = -13,
+	/** Unable to start a worker thread. */
+	HB_THREAD_FAILURE = -14,
+	/** Number of threads out of range. */
+	HB_THREADS_OUT_RANGE = -15,
+	/** Unknown diffusion engine name. */
+	HB_DIFFUSION_UNKNOWN = -16,
+	/** Unknown agents engine name. */
+	HB_AGENTS_UNKNOWN = -17,
+	/** Checkerboard tile size out of range. */
+	HB_TILE_SIZE_OUT_RANGE = -18,
+	/** Unknown random number generator name. */
+	HB_RNG_UNKNOWN = -19,
+	/** Generator can't be used with the selected agents engine. */
+	HB_RNG_SERIAL_ONLY = -20,
+	/** Unknown results file format name. */
+	HB_FORMAT_UNKNOWN = -21,
+	/** Writing results failed. */
+	HB_OUTPUT_WRITE_FAILURE = -22,
+	/** Compressing a snapshot failed. */
+	HB_SNAPSHOT_FAILURE = -23,
+	/** Generator state can't be checkpointed. */
+	HB_CHECKPOINT_RNG = -24,
+	/** Checkpoint (or the results it continues) unusable. */
+	HB_CHECKPOINT_INVALID = -25,
+	/** Invalid ensemble seeds or options. */
+	HB_ENSEMBLE_INVALID = -26,
+	/** Invalid sweep specification or options. */
+	HB_SWEEP_INVALID = -27,
+	/** Options or world not fit for the MPI ranks (hb_mpi.c). */
+	HB_MPI_INVALID = -28,
+	/** World has more cells than bug positions can tell. */
+	HB_WORLD_TOO_BIG = -29,
+	/** Unknown bugs order name, or invalid order options. */
+	HB_ORDER_INVALID = -30,
+	/** Diffusion engine or heat range not fit for this build's 16 bits. */
+	HB_HEAT_STORAGE = -31,
+	/** Sparse diffusion options not valid, or engine not fit for it. */
+	HB_SPARSE_INVALID = -32,
+	/** Unknown output column name. */
+	HB_COLUMNS_UNKNOWN = -33,
+	/** Convergence window or tolerance out of range. */
+	HB_CONVERGE_INVALID = -34,
+	/** Records every so many iterations out of range. */
+	HB_OUTPUT_EVERY_INVALID = -35,
+	/** File name longer than its parameter holds. */
+	HB_FILENAME_TOO_LONG = -36
 };
 
 
 
-float average( const float *const vector, const size_t vsize )
+/** Heatbugs error domain, shared by all modules. */
+#define HB_ERROR hb_error_quark()
+
+static inline GQuark hb_error_quark( void ) {
+	return g_quark_from_static_string( "hb-error-quark" );
+}
+
+
+
+/** Diffusion engines, selected with '--diffusion NAME'. */
+enum {
+	DIFFUSION_V1 = 0,	/* "v1"     : comp_world_heat_v1(...), serial. */
+	DIFFUSION_V2,		/* "v2"     : comp_world_heat_v2(...), serial. */
+	DIFFUSION_FUSED,	/* "fused"  : comp_world_heat_v3/_mt(...).     */
+	DIFFUSION_BOXSUM,	/* "boxsum" : comp_world_heat_boxsum(...).     */
+	DIFFUSION_ENGINES
+};
+
+
+/** Agent engines, selected with '--agents NAME'. */
+enum {
+	AGENTS_SERIAL = 0,	/* "serial" : bug_step(...), exact NetLogo order. */
+	AGENTS_ATOMIC,		/* "atomic" : bug_step_atomic(...), see there.    */
+	AGENTS_CHECKERBOARD,	/* "checkerboard" : bug_step_checkerboard(...).   */
+	AGENTS_ENGINES
+};
+
+
+/** Order bugs move in, selected with '--order NAME' (serial and atomic). */
+enum {
+	ORDER_RANDOM = 0,	/* "random" : shuffle_bugs(...), all bugs.          */
+	ORDER_MORTON,		/* "morton" : shuffle_bugs_spatial(...), by blocks. */
+	ORDERS
+};
+
+
+/** Statistics output each iteration, selected with '--columns LIST'. */
+enum {
+	HB_STAT_MEAN = 0x01,		/* "unhappiness" : bugs average.      */
+	HB_STAT_MIN = 0x02,		/* "min"         : least unhappy bug. */
+	HB_STAT_MAX = 0x04,		/* "max"         : most unhappy bug.  */
+	HB_STAT_VARIANCE = 0x08,	/* "variance"    : of unhappiness.    */
+	HB_STAT_HEAT = 0x10,		/* "heat"        : world total.       */
+	HB_STAT_HISTOGRAM = 0x20,	/* "histogram"   : HB_HIST_BINS bins. */
+	HB_STATS = 6
+};
+
+/** Unhappiness histogram bins, see stats_bug(...). */
+#define HB_HIST_BINS	8
+
+/**
+ * Aggregates of each statistic over the iterations between records,
+ * selected with '--aggregate LIST'. None: the record's iteration alone.
+ * */
+enum {
+	HB_AGG_MEAN = 0x01,		/* "mean" */
+	HB_AGG_MIN = 0x02,		/* "min"  */
+	HB_AGG_MAX = 0x04,		/* "max"  */
+	HB_AGGS = 3
+};
+
+
+/** Checkerboard engine: tiles are coloured by the parity of their x, y. */
+#define TILE_COLOURS	4
+
+/** Simulation constants. */
+#define NUM_NEIGHBOURS 8
+
+/** swarm_map cells. */
+#define A_BUG		0x00ff00dd
+#define A_EMPTY_CELL	0x00000000
+
+/** Used in swarm_map operations. */
+#define HAS_BUG( swarm_map_locus ) ((swarm_map_locus) != A_EMPTY_CELL)
+#define HAS_NO_BUG( swarm_map_locus ) ((swarm_map_locus) == A_EMPTY_CELL)
+
+#define NEW_BUG_IN( swarm_map_locus ) swarm_map_locus = A_BUG
+
+
+/**
+ * The swarm_map, through MAP_* only. One unsigned int per cell, or with
+ * -DHB_SWARM_BITMAP one bit per cell, bit i % 32 of word i / 32 (the
+ * snapshot positions layout, see hb_snapshot.h): 32 times less memory.
+ * Neighbouring cells share a word, as do the cells of two threads along
+ * the tiles' edges, so bitmap writes are atomic. The atomic agents engine
+ * reads cells other threads may be claiming with MAP_HAS_BUG_RELAXED.
+ * */
+#ifdef HB_SWARM_BITMAP
+	typedef guint32 hb_map_t;
+	#define HB_MAP_FORMAT		1
+	#define HB_MAP_WORDS( cells )	(((cells) + 31) / 32)
+	#define MAP_BIT( cell )		(1u << ((cell) & 31))
+	#define MAP_HAS_BUG( map, cell ) \
+		(((map)[ (cell) >> 5 ] & MAP_BIT( cell )) != 0)
+	#define MAP_HAS_BUG_RELAXED( map, cell ) \
+		((__atomic_load_n( &(map)[ (cell) >> 5 ], __ATOMIC_RELAXED ) \
+			& MAP_BIT( cell )) != 0)
+	#define MAP_SET_BUG( map, cell ) \
+		g_atomic_int_or( &(map)[ (cell) >> 5 ], MAP_BIT( cell ) )
+	#define MAP_CLEAR( map, cell ) \
+		g_atomic_int_and( &(map)[ (cell) >> 5 ], ~MAP_BIT( cell ) )
+	/* Atomic engine: TRUE if the cell was empty and now has the bug. */
+	#define MAP_RELEASE( map, cell )	MAP_CLEAR( map, cell )
+	#define MAP_CLAIM( map, cell ) \
+		((g_atomic_int_or( &(map)[ (cell) >> 5 ], MAP_BIT( cell ) ) \
+			& MAP_BIT( cell )) == 0)
+#else
+	typedef unsigned int hb_map_t;
+	#define HB_MAP_FORMAT		0
+	#define HB_MAP_WORDS( cells )	(cells)
+	#define MAP_HAS_BUG( map, cell )	HAS_BUG( (map)[ cell ] )
+	#define MAP_HAS_BUG_RELAXED( map, cell ) \
+		HAS_BUG( __atomic_load_n( &(map)[ cell ], __ATOMIC_RELAXED ) )
+	#define MAP_SET_BUG( map, cell )	NEW_BUG_IN( (map)[ cell ] )
+	#define MAP_CLEAR( map, cell )	(map)[ cell ] = A_EMPTY_CELL
+	#define MAP_RELEASE( map, cell ) \
+		g_atomic_int_set( (gint *) &(map)[ cell ], A_EMPTY_CELL )
+	#define MAP_CLAIM( map, cell ) \
+		g_atomic_int_compare_and_exchange( (gint *) &(map)[ cell ], \
+						A_EMPTY_CELL, A_BUG )
+#endif
+
+#define MAP_HAS_NO_BUG( map, cell )	(!MAP_HAS_BUG( map, cell ))
+
+/** Bytes of a swarm_map of 'cells'. */
+#define HB_MAP_BYTES( cells )	(HB_MAP_WORDS( cells ) * sizeof( hb_map_t ))
+
+/** Used to drive what shall happen to the agent at each step. */
+#define FIND_ANY_FREE		0x00ffffff
+#define FIND_MAX_TEMPERATURE	0x00ffff00
+#define FIND_MIN_TEMPERATURE	0x00ff00ff
+
+
+/** This is the selector for world_heat in hb_buffers structure (see it below). */
+#define MAP	0
+#define BUFFER	1
+
+
+
+
+/** Input data used for simulation. */
+typedef struct parameters {
+	/* Num Iterations to stop. (0 = non stop). */
+	size_t numIterations;
+	/* Number of bugs in the world. */
+	size_t bugs_number;
+	/* World width size. */
+	size_t world_width;
+	/* World height size. */
+	size_t world_height;
+	/* World's vector size = (world_height * world_width). */
+	size_t world_size;
+	/* TRUE when world width and height are both powers of 2. Then */
+	/* world_shift = log2( world_width ). See world_geometry(...).  */
+	gboolean world_pow2;
+	unsigned int world_shift;
+	/* Heat map row length and cells, ghost border included, and the */
+	/* offsets of a cell's neighbours in it (SW .. NE). See HEAT_CELL. */
+	size_t heat_stride;
+	size_t heat_size;
+	ptrdiff_t heat_offset[ NUM_NEIGHBOURS ];
+	/* [0..1], % temperature to adjacent cells. */
+	float world_diffusion_rate;
+	/* [0..1], % temperature's loss to 'ether'.  */
+	float world_evaporation_rate;
+	/* [0..100], Chance a bug will move. */
+	float bugs_random_move_chance;
+	/* [0 .. 200], bug's minimum prefered temperature. */
+	unsigned int bugs_temperature_min_ideal;
+	/* [0 .. 200], bug's maximum prefered temperature. */
+	unsigned int bugs_temperature_max_ideal;
+	/* [0 .. 100], min heat a bug leave in the world in each step. */
+	unsigned int bugs_heat_min_output;
+	/* [0 .. 100], max heat a bug leave in the world in each step. */
+	unsigned int bugs_heat_max_output;
+	/* DIFFUSION_*, the engine used to compute world heat. */
+	int diffusion;
+	/* Sparse diffusion: skip tiles where no cell, nor around, is over */
+	/* this heat (0 = exactly zero, bit-identical). < 0 = off.         */
+	float sparse_epsilon;
+	/* AGENTS_*, the engine used to move the bugs. */
+	int agents;
+	/* [3 .. ], minimum tile side for the checkerboard agents engine. */
+	size_t tile_size;
+	/* ORDER_*, the order bugs move in. */
+	int order;
+	/* [1 .. MAX_ORDER_BLOCK], power of 2, side of the blocks of cells */
+	/* 'morton' order keeps together. Wider is fairer. */
+	size_t order_block;
+	/* [1 .. ], iterations between sorting the bugs by block. */
+	size_t order_sort_every;
+	/* HB_RNG_*, the random number generator. */
+	int rng;
+	/* TRUE to time each phase of the simulation loop. */
+	gboolean profile;
+	/* HB_FORMAT_*, the results file format. */
+	int format;
+	/* TRUE to write results from a thread of their own. */
+	gboolean async_output;
+	/* Iterations between world snapshots, 0 = no snapshots. */
+	size_t snapshot_every;
+	/* File to send world snapshots. */
+	char snapshot_filename[256];
+	/* Iterations between checkpoints, 0 = no checkpoints. */
+	size_t checkpoint_every;
+	/* File to save checkpoints. */
+	char checkpoint_filename[256];
+	/* Checkpoint to restart from, "" = start a new simulation. */
+	char restart_filename[256];
+	/* Simulations run by an ensemble, 0 = a single simulation. */
+	size_t ensemble;
+	/* Ensemble seeds, comma separated (points into argv), or NULL for */
+	/* 'ensemble' seeds from 'seed' up. */
+	const char *seeds;
+	/* TRUE to send all ensemble results to one binary stream. */
+	gboolean interleave;
+	/* Sweep specification file, "" = no sweep. */
+	char sweep_filename[256];
+	/* HB_STAT_* bits, the statistics output (as columns, in that order). */
+	unsigned int columns;
+	/* Iterations between records, the initial state's always output. */
+	size_t output_every;
+	/* HB_AGG_* bits, each statistic's aggregates over those iterations, */
+	/* 0 = the statistics of the record's iteration.                      */
+	unsigned int aggregate;
+	/* Iterations in each of the two windows compared to stop once the */
+	/* unhappiness average is stationary, 0 = run all the iterations.  */
+	size_t converge_window;
+	/* Largest change, relative to the average, between the windows'  */
+	/* means and standard deviations to be stationary.                 */
+	double converge_tolerance;
+	/* [1 .. MAX_THREADS], threads used to compute the simulation. */
+	unsigned int threads;
+	/* Seed to be used as random generator initialization value. */
+	unsigned int seed;	/* Type required by Glib's g_random_set_seed(...) */
+	/* TRUE if 'seed' was drawn from /dev/urandom, not given with -s. */
+	gboolean seed_drawn;
+	/* File to send results. */
+	char output_filename[256];
+} Parameters_t;
+
+
+
+
+/**
+ * World sides known at compile time. Build with e.g. -DHB_WORLD_WIDTH=1000
+ * -DHB_WORLD_HEIGHT=1000 and worlds of that size locate(...) bugs with
+ * constant sides (the compiler turns the divisions into multiplications).
+ * Other sizes run as usual.
+ * */
+#if defined( HB_WORLD_WIDTH ) != defined( HB_WORLD_HEIGHT )
+	#error "Build with both HB_WORLD_WIDTH and HB_WORLD_HEIGHT, or none."
+#endif
+
+
+
+/** A bug's position in the world: 32 bits, for worlds up to 2^31 cells, */
+/** unless built with -DHB_LOCUS_64. HB_LOCUS_MAX is the last position.  */
+#ifdef HB_LOCUS_64
+	typedef guint64 hb_locus_t;
+	#define HB_LOCUS_MAX	G_MAXUINT64
+#else
+	typedef guint32 hb_locus_t;
+	#define HB_LOCUS_MAX	G_MAXINT32
+#endif
+
+/**
+ * Heat map cells, hb_heat_t, read and written through heat_get(...) and
+ * heat_put(...). A float, or 16 bits when built with one of these, for
+ * half the memory traffic of the diffusion:
+ *   -DHB_HEAT_FP16  : IEEE half, _Float16 (GCC 12+, Clang). 11 significant
+ *                     bits. Add -mf16c for hardware conversions.
+ *   -DHB_HEAT_BF16  : bfloat16, the upper half of a float. 8 significant
+ *                     bits, a float's range.
+ *   -DHB_HEAT_FIXED : unsigned fixed point, steps of 1 / HB_HEAT_FIXED_SCALE,
+ *                     saturating at 65535 / HB_HEAT_FIXED_SCALE.
+ * Sums are done in float all the same. The v1 and v2 diffusion engines,
+ * which sum in the heat buffer itself, need float cells. See 'make
+ * accuracy' for what 16 bits do to the results.
+ *
+ * A cell never holds more than a bug's output heat added every iteration,
+ * evaporating, would reach: bugs_heat_max_output * (1 - e) / e. Runs where
+ * that passes HB_HEAT_MAX are refused; with HB_HEAT_DIGITS significant
+ * bits, a warning tells when the largest deposit may be under one ulp
+ * there, and round away (see checkSimulParameters(...)).
+ * */
+#if (defined( HB_HEAT_FP16 ) + defined( HB_HEAT_BF16 ) + defined( HB_HEAT_FIXED )) > 1
+	#error "Build with one of HB_HEAT_FP16, HB_HEAT_BF16 or HB_HEAT_FIXED."
+#endif
+
+#if defined( HB_HEAT_FP16 )
+
+	#define HB_HEAT_16
+	#define HB_HEAT_FORMAT		1
+	#define HB_HEAT_MAX		65504.0	/* Largest finite half. */
+	#define HB_HEAT_DIGITS		11
+	typedef _Float16 hb_heat_t;
+
+	static inline float heat_get( const hb_heat_t heat ) {
+		return (float) heat;
+	}
+
+	static inline hb_heat_t heat_put( const float heat ) {
+		return (hb_heat_t) heat;
+	}
+
+#elif defined( HB_HEAT_BF16 )
+
+	#define HB_HEAT_16
+	#define HB_HEAT_FORMAT		2
+	#define HB_HEAT_DIGITS		8
+	typedef guint16 hb_heat_t;
+
+	static inline float heat_get( const hb_heat_t heat ) {
+		union { guint32 u; float f; } cell = { (guint32) heat << 16 };
+		return cell.f;
+	}
+
+	/* Rounded to nearest, ties to even. */
+	static inline hb_heat_t heat_put( const float heat ) {
+		union { float f; guint32 u; } cell = { heat };
+		return (hb_heat_t) ((cell.u + 0x7fff + ((cell.u >> 16) & 1)) >> 16);
+	}
+
+#elif defined( HB_HEAT_FIXED )
+
+	#define HB_HEAT_16
+	#define HB_HEAT_FORMAT		3
+	#ifndef HB_HEAT_FIXED_SCALE
+		#define HB_HEAT_FIXED_SCALE	16	/* A power of 2. */
+	#endif
+	#define HB_HEAT_MAX		(65535.0 / HB_HEAT_FIXED_SCALE)
+	typedef guint16 hb_heat_t;
+
+	static inline float heat_get( const hb_heat_t heat ) {
+		return heat * (1.0f / HB_HEAT_FIXED_SCALE);
+	}
+
+	/* Rounded to nearest. Heat is never negative. */
+	static inline hb_heat_t heat_put( const float heat ) {
+		const float steps = heat * HB_HEAT_FIXED_SCALE + 0.5f;
+		return (steps < G_MAXUINT16) ? (hb_heat_t) steps : G_MAXUINT16;
+	}
+
+#else
+
+	#define HB_HEAT_FORMAT		0
+	typedef float hb_heat_t;
+
+	static inline float heat_get( const hb_heat_t heat ) {
+		return heat;
+	}
+
+	static inline hb_heat_t heat_put( const float heat ) {
+		return heat;
+	}
+
+#endif
+
+
+
+/**
+ * The heat map (world_heat[ MAP ] and [ BUFFER ]) has a ghost border one
+ * cell wide, copies of the cells at the opposite side of the torus: the
+ * world's cell at 'row', 'col' is at HEAT_CELL( params, row, col ), and
+ * its neighbours at fixed offsets, params->heat_offset[ SW .. NE ], with
+ * no wrap. Diffusion engines read the border as it is and write only the
+ * world's cells; heat_halo_refresh(...) then copies the border, once per
+ * iteration. Agents keep it up to date, as they leave heat, through
+ * heat_store(...). Bug positions, and the swarm_map, have no border.
+ * */
+#define HEAT_CELL( params, row, col ) \
+	(((row) + 1) * (params)->heat_stride + (col) + 1)
+
+
+/** A world position's row and column, and the ones around them. */
+typedef struct {
+	size_t rc, cc;		/* Row and column at Center.		*/
+	size_t rn, rs;		/* Rows at North and South.		*/
+	size_t ce, cw;		/* Columns at East and West.		*/
+} Around_t;
+
+
+
+/**
+ * Row and column of 'locus', and the rows and columns around it, wrapped
+ * around the torus. When 'pow2' there are only shifts and masks, else
+ * there is one division, which becomes a multiplication when the sides
+ * are constants (see HB_WORLD_WIDTH).
+ *
+ * @param[in]	locus		- World position.
+ * @param[in]	width, height	- World sides.
+ * @param[in]	pow2, shift	- Sides are powers of 2, log2( width ).
+ * */
+static inline Around_t around( const size_t locus, const size_t width,
+	const size_t height, const gboolean pow2, const unsigned int shift )
 {
-	float sum = 0.0;
+	Around_t a;
+
+
+	if (pow2)
+	{
+		a.rc = locus >> shift;
+		a.cc = locus & (width - 1);
+
+		a.rn = (a.rc + 1) & (height - 1);
+		a.rs = (a.rc - 1) & (height - 1);
+		a.ce = (a.cc + 1) & (width - 1);
+		a.cw = (a.cc - 1) & (width - 1);
+	}
+	else
+	{
+		a.rc = locus / width;
+		a.cc = locus - a.rc * width;
+
+		a.rn = (a.rc + 1 == height) ? 0 : a.rc + 1;
+		a.rs = (a.rc == 0) ? height - 1 : a.rc - 1;
+		a.ce = (a.cc + 1 == width) ? 0 : a.cc + 1;
+		a.cw = (a.cc == 0) ? width - 1 : a.cc - 1;
+	}
+
+	return a;
+}
+
+
+
+/**
+ * around(...) 'locus', with the world's sides as constants when they are
+ * the ones given at compile time, or with shifts when powers of 2.
+ * */
+static inline Around_t locate( const size_t locus,
+				const Parameters_t *const params )
+{
+#ifdef HB_WORLD_WIDTH
+	if ((params->world_width == HB_WORLD_WIDTH)
+			&& (params->world_height == HB_WORLD_HEIGHT))
+		return around( locus, HB_WORLD_WIDTH, HB_WORLD_HEIGHT, FALSE, 0 );
+#endif
+
+	if (params->world_pow2)
+		return around( locus, params->world_width, params->world_height,
+						TRUE, params->world_shift );
+
+	return around( locus, params->world_width, params->world_height,
+								FALSE, 0 );
+}
+
+
+/**
+ * Whether the neighbours of 'a', and theirs, are all inside the world:
+ * a bug there moves and leaves heat with no wrap and no ghost cells.
+ * */
+static inline gboolean around_inner( const Around_t *const a,
+					const Parameters_t *const params )
+{
+	return (a->rc >= 2) && (a->rc + 2 < params->world_height)
+		&& (a->cc >= 2) && (a->cc + 2 < params->world_width);
+}
+
+
+/**
+ * Heat map cell of 'to', a neighbour of the world position 'from' (or
+ * 'from' itself) at heat map cell 'cell', when around_inner(...): a step
+ * of a row in the world is one of a row and 2 ghost cells in the heat map.
+ * */
+static inline size_t heat_step( const size_t cell, const size_t from,
+							const size_t to )
+{
+	const ptrdiff_t step = (ptrdiff_t) (to - from);
+
+	return cell + step + 2 * ((step > 1) - (step < -1));
+}
+
+
+
+/**
+ * Ghost copies of the heat cell 'cell', at 'row', 'col' of the world:
+ * none inside, one along an edge, three at a corner (more in worlds one
+ * cell wide or high).
+ *
+ * @param[out]	ghost		- Their heat cells.
+ * @return	How many.
+ * */
+static inline unsigned int heat_ghosts( const Parameters_t *const params,
+	const size_t cell, const size_t row, const size_t col,
+	size_t ghost[ NUM_NEIGHBOURS ] )
+{
+	const ptrdiff_t across = (ptrdiff_t) params->world_width;
+	const ptrdiff_t up = (ptrdiff_t) (params->world_height * params->heat_stride);
+	ptrdiff_t dx[ 3 ] = { 0 }, dy[ 3 ] = { 0 };
+	unsigned int nx = 1, ny = 1, n = 0;
+
+
+	/* Inside: nothing to do (most cells). */
+	if ((row > 0) && (row + 1 < params->world_height)
+			&& (col > 0) && (col + 1 < params->world_width))
+		return 0;
+
+	if (col == 0) dx[ nx++ ] = across;
+	if (col + 1 == params->world_width) dx[ nx++ ] = -across;
+	if (row == 0) dy[ ny++ ] = up;
+	if (row + 1 == params->world_height) dy[ ny++ ] = -up;
+
+	for (unsigned int y = 0; y < ny; y++)
+		for (unsigned int x = 0; x < nx; x++)
+			if (x || y)
+				ghost[ n++ ] = (size_t) ((ptrdiff_t) cell + dx[ x ] + dy[ y ]);
+
+	return n;
+}
+
+
+
+/**
+ * Store 'heat' in the heat cell 'cell', at 'row', 'col' of the world,
+ * and its ghost copies.
+ * */
+static inline void heat_store( hb_heat_t *const heat_map,
+	const Parameters_t *const params, const size_t cell,
+	const size_t row, const size_t col, const hb_heat_t heat )
+{
+	size_t ghost[ NUM_NEIGHBOURS ];
+	const unsigned int n = heat_ghosts( params, cell, row, col, ghost );
+
+
+	heat_map[ cell ] = heat;
+
+	for (unsigned int g = 0; g < n; g++)
+		heat_map[ ghost[ g ] ] = heat;
+
+	return;
+}
+
+
+/** Swarm arrays alignment, in bytes: a cache line, and any vector. */
+#define HB_ALIGN	64
+
+
+/** The bugs, one array per field (structure of arrays). Bug 'b' is at */
+/** index 'b' of each. Temperatures fit in 8 bits: ideal temperature   */
+/** is below 200 and output heat below 100 (see checkSimulParameters). */
+typedef struct swarm {
+	hb_locus_t *locus;		/* SIZE: NUM_BUGS	- Bug's position in the swarm_map. */
+	guint8 *ideal_temperature;	/* SIZE: NUM_BUGS	- The temperature bug want to be at. */
+	guint8 *output_heat;		/* SIZE: NUM_BUGS	- How much heat bug emit per time step. */
+} Swarm_t;
+
+/** Bytes of one bug, over the swarm arrays. */
+#define HB_BUG_SIZE	(sizeof( hb_locus_t ) + 2 * sizeof( guint8 ))
+
+
+/**
+ * Compensated (Kahan-Babuska, Neumaier's variant) sum of doubles: 'comp'
+ * keeps what rounding took from 'sum', so their total is about as precise
+ * as twice double's precision, whatever the number of values, and the
+ * order values (or partial sums of threads) are added in hardly shows.
+ * */
+typedef struct hb_sum {
+	double sum;
+	double comp;	/* Low order part lost by 'sum'. */
+} HBSum_t;
+
+
+/** Statistics of an iteration, see stats_bug(...) and hb_output_stats(...). */
+typedef struct hb_stats {
+	size_t bugs;			/* Bugs counted.			*/
+	HBSum_t unhappiness;		/* Sum of bugs unhappiness...		*/
+	HBSum_t unhappiness_sq;		/* ...and of its squares.		*/
+	float min;			/* Least bug unhappiness.		*/
+	float max;			/* Most bug unhappiness.		*/
+	size_t hist[ HB_HIST_BINS ];	/* Bugs by unhappiness.			*/
+	float hist_scale;		/* Bins per unit of unhappiness.	*/
+	HBSum_t heat;			/* World heat.				*/
+} HBStats_t;
+
+
+/**
+ * The unhappiness average of the last 2 * 'window' iterations, split in
+ * an older and a newer window, with running sums of each, see
+ * converged(...).
+ * */
+typedef struct convergence {
+	size_t window;		/* Iterations per window.			*/
+	size_t count;		/* Averages seen so far.			*/
+	double *averages;	/* SIZE: 2 * WINDOW	- Last averages, a ring. */
+	HBSum_t sum[ 2 ];	/* Of the averages, [ 0 ] older, [ 1 ] newer.	*/
+	HBSum_t sum_sq[ 2 ];	/* Of their squares.				*/
+} Convergence_t;
+
+
+/** Per thread state of the agents phase. */
+typedef struct agent_state {
+	HBRng_t rng;	/* Thread's own generator (GLib's global one, or a    */
+			/* Philox generator positioned on the needed stream). */
+	unsigned int neighbour_idx[ NUM_NEIGHBOURS ];	/* Shuffled neighbours. */
+	HBStats_t stats;	/* Of the bugs this thread moved this iteration. */
+} AgentState_t;
+
+
+/** Tiles of the checkerboard agents engine, see bug_step_checkerboard(...). */
+typedef struct checkerboard {
+	size_t tiles_x;		/* Tiles along world's width, 1 or even.	*/
+	size_t tiles_y;		/* Tiles along world's height, 1 or even.	*/
+	size_t tiles;		/* tiles_x * tiles_y.				*/
+	guint32 *col_tile;	/* SIZE: WORLD_WIDTH	- Tile column of each world column.	*/
+	guint32 *row_tile;	/* SIZE: WORLD_HEIGHT	- Tile row of each world row.		*/
+	size_t *tile_start;	/* SIZE: TILES + 1	- Where each tile's bugs start in 'tile_bugs'. */
+	size_t *tile_fill;	/* SIZE: TILES		- Cursor used to fill 'tile_bugs'.	*/
+	size_t *tile_bugs;	/* SIZE: NUM_BUGS	- Bugs id, grouped by tile.		*/
+	size_t *colour_tiles;	/* SIZE: TILES		- Tiles id, grouped by colour.		*/
+	size_t colour_start[ TILE_COLOURS + 1 ];	/* Where each colour starts.	*/
+} CheckerBoard_t;
+
+
+/**
+ * Tiles of the sparse diffusion, see comp_world_heat_sparse(...). Both
+ * flag arrays follow the heat maps: [ MAP ] for world_heat[ MAP ], the
+ * one read, and [ BUFFER ] for the one written, swapped with them.
+ * */
+typedef struct activity {
+	size_t tiles_x;		/* Tiles along world's width.			*/
+	size_t tiles_y;		/* Tiles along world's height.			*/
+	guint8 *hot[ 2 ];	/* SIZE: TILES	- Some cell over sparse_epsilon, or heat left by a bug. */
+	guint8 *cold[ 2 ];	/* SIZE: TILES	- All cells exactly zero.		*/
+	HBSum_t *heat;		/* SIZE: TILES_Y	- World heat, per tile row.	*/
+} Activity_t;
+
+
+/** A bug and the Morton (Z-order) index of the block it is in. */
+typedef struct order_key {
+	guint64 key;
+	size_t id;
+} OrderKey_t;
+
+/** Spatial order of the bugs, see shuffle_bugs_spatial(...). */
+typedef struct spatial_order {
+	guint32 block_shift;	/* log2( order_block ).				*/
+	size_t blocks;		/* Non empty blocks, in 'sorted'.		*/
+	OrderKey_t *sorted;	/* SIZE: NUM_BUGS	- Bugs, by Morton index of their block, as last sorted. */
+	size_t *block_start;	/* SIZE: NUM_BUGS + 1	- Where each block starts in 'sorted'.	*/
+} SpatialOrder_t;
+
+
+/** Simulation buffers. */
+typedef struct hb_buffers {
+	Swarm_t swarm;			/* SIZE: BUGS_NUM			- The bugs. */
+	hb_map_t *swarm_map;		/* SIZE: HB_MAP_WORDS( WORLD_SIZE )	- Bug's presence, see MAP_HAS_BUG. */
+	hb_heat_t *world_heat[2];	/* SIZE: (WORLD_HEIGHT + 2) * heat_stride	- Temperature maps: heat_map (primary and buffer). */
+	float *unhappiness;		/* SIZE: NUM_BUGS			- The Unhappiness vector. */
+	float *row_sums;		/* SIZE: 3 * WORLD_WIDTH * THREADS	- Box-sum rolling rows (boxsum engine only). */
+	size_t *ids;			/* SIZE: NUM_BUGS			- Bugs id, shuffled each step to set moving order. */
+	AgentState_t *agent_states;	/* SIZE: THREADS			- One per agent thread (parallel engines only). */
+	CheckerBoard_t *board;		/* 					- Tiles (checkerboard engine only). */
+	Activity_t *activity;		/* 					- Tiles (sparse diffusion only). */
+	SpatialOrder_t *order;		/* 					- Bugs by block ('morton' order only). */
+	GRand *grand;			/*					- The simulation's own GLib generator. */
+	HBStats_t stats;		/*					- This iteration's statistics. */
+	Convergence_t *converge;	/*					- Last averages (convergence stop only). */
+} HBBuffers_t;
+
+
+
+
+extern const char version[];
+
+
+
+/** Simulation set up and tear down (heatbugs.c). */
+
+struct hb_profile;	/* See hb_profile.h.	*/
+struct hb_output;	/* See hb_output.h.	*/
+struct hb_snapshots;	/* See hb_snapshot.h.	*/
+
+void getSimulParameters( Parameters_t *const params, int argc,
+					char *argv[], GError **err );
+
+void checkSimulParameters( Parameters_t *const params, GError **err );
+
+void world_geometry( Parameters_t *const params );
+
+void setupBuffers( HBBuffers_t *const buff, const Parameters_t *const params,
+				GError **err );
+
+void *hb_aligned_alloc( const size_t size );
+
+void setupSwarm( Swarm_t *const swarm, const size_t bugs, GError **err );
+
+void freeSwarm( Swarm_t *const swarm );
+
+void initiate( HBBuffers_t *const buff, const Parameters_t *const params );
+
+void freeBuffers( HBBuffers_t *const buff );
+
+void stats_reset( HBStats_t *const s, const Parameters_t *const params );
+
+void stats_merge( HBStats_t *const s, const HBStats_t *const part );
+
+gboolean converged( Convergence_t *const conv, const double average,
+					const Parameters_t *const params );
+
+void simulate( HBBuffers_t *const buff, const Parameters_t *const params,
+			HBPool_t *const pool, struct hb_profile *const prof,
+			struct hb_output *const output,
+			struct hb_snapshots *const snaps, const size_t start,
+							GError **err );
+
+
+/** Diffusion kernels (heatbugs.c). */
+
+void comp_world_heat_v1( const float *const heat_map,
+				float *const heat_buffer,
+				const Parameters_t *const params );
+
+void comp_world_heat_v2( float **world_heat, const Parameters_t *const params );
+
+void comp_world_heat_v3( hb_heat_t **world_heat, const Parameters_t *const params,
+							HBSum_t *const heat );
+
+void comp_world_heat_rows( const hb_heat_t *const heat_map,
+				hb_heat_t *const heat_buffer,
+				const Parameters_t *const params,
+				const size_t row_first, const size_t row_last,
+				HBSum_t *const heat );
+
+void comp_world_heat_sparse( hb_heat_t **world_heat, Activity_t *const activity,
+			const Swarm_t *const swarm, const Parameters_t *const params,
+			HBPool_t *const pool, HBSum_t *const heat );
+
+void world_heat_total( const hb_heat_t *const heat_map,
+			const Parameters_t *const params, HBSum_t *const heat );
+
+void heat_halo_refresh( hb_heat_t *const heat_map, const Parameters_t *const params );
+
+void comp_world_heat( HBBuffers_t *const buff, const Parameters_t *const params,
+							HBPool_t *const pool );
+
+
+/** Agent kernels (heatbugs.c). */
+
+size_t best_free_neighbour( const int todo, const hb_heat_t *const heat_map,
+	const hb_map_t *const swarm_map, const Parameters_t *const params,
+	const Around_t *const at, AgentState_t *const state );
+
+void shuffle_bugs( size_t *const ids, const Parameters_t *const params,
+			HBRng_t *const rng, const size_t iteration );
+
+void spatial_order_blocks( SpatialOrder_t *const order,
+					const Parameters_t *const params );
+
+void shuffle_bugs_spatial( size_t *const ids, SpatialOrder_t *const order,
+			const Swarm_t *const swarm, const Parameters_t *const params,
+			HBRng_t *const rng, const size_t iteration );
+
+void bug_step( const Swarm_t *const swarm, hb_map_t *const swarm_map,
+			hb_heat_t *const heat_map, float *const unhappiness,
+			size_t *const ids, AgentState_t *const state,
+			const Parameters_t *const params, const size_t iteration );
+
+
+
+/** Add 'value' to the compensated sum 's', see HBSum_t. */
+static inline void sum_add( HBSum_t *const s, const double value )
+{
+	const double t = s->sum + value;
+
+	if (fabs( s->sum ) >= fabs( value ))
+		s->comp += (s->sum - t) + value;
+	else
+		s->comp += (value - t) + s->sum;
+
+	s->sum = t;
+
+	return;
+}
+
+
+/** Total of the compensated sum 's'. */
+static inline double sum_get( const HBSum_t *const s )
+{
+	return s->sum + s->comp;
+}
+
+
+/** Average unhappiness of the bugs counted in 's'. */
+static inline double stats_mean( const HBStats_t *const s )
+{
+	return sum_get( &s->unhappiness ) / (double) s->bugs;
+}
+
+
+/** Add the compensated sum 'part' to 's'. */
+static inline void sum_merge( HBSum_t *const s, const HBSum_t *const part )
+{
+	sum_add( s, part->sum );
+	sum_add( s, part->comp );
+
+	return;
+}
+
+
+/**
+ * Count a bug in the statistics 's', as it moves: its 'unhappiness' and
+ * the 'heat' it leaves in the world. Histogram bins are HB_HIST_BINS equal
+ * parts of [0 .. bugs_temperature_max_ideal + 1[ (see stats_reset(...)),
+ * the last one also taking all above.
+ * */
+static inline void stats_bug( HBStats_t *const s, const float unhappiness,
+							const float heat )
+{
+	const size_t bin = (size_t) (unhappiness * s->hist_scale);
+
+	s->bugs++;
+	sum_add( &s->unhappiness, unhappiness );
+	sum_add( &s->unhappiness_sq, (double) unhappiness * unhappiness );
+
+	if (unhappiness < s->min) s->min = unhappiness;
+	if (unhappiness > s->max) s->max = unhappiness;
+
+	s->hist[ (bin < HB_HIST_BINS) ? bin : HB_HIST_BINS - 1 ]++;
+
+	sum_add( &s->heat, heat );
+
+	return;
+}
+
+
+
+/**
+ * Put the agent 'state' on bug 'bug's own stream of 'iteration' (see
+ * hb_rng_stream(...)), with the neighbour order back to the identity: the
+ * bug's choices then don't depend on the bug moved before it, nor on the
+ * thread moving it. GLib's generator is one sequence, not streams, so its
+ * neighbour order goes on from bug to bug (historical results).
+ * */
+static inline void bug_stream( AgentState_t *const state,
+				const size_t iteration, const size_t bug )
+{
+	hb_rng_stream( &state->rng, HB_STREAM_BUG, iteration, bug );
+
+	if (state->rng.kind != HB_RNG_PHILOX) return;
+
+	for (unsigned int n = 0; n < NUM_NEIGHBOURS; n++)
+		state->neighbour_idx[ n ] = n;
+
+	return;
+}
+
+
+
+/**
+ * Move one bug: compute its unhappiness, pick its best (or a random) free
+ * neighbour, leave heat there and update swarm and swarm map. Every agent
+ * engine that moves bugs one at a time on a private part of the world
+ * shares this code (hb_mpi.c too), so they follow the very same rules.
+ * Heat is left through heat_store(...), so the ghost border stays in step.
+ * Both are counted in the thread's statistics (see stats_bug(...)).
+ *
+ * @param[in]		bug		- Bug id.
+ * @param[in,out]	state		- Calling thread's agent state, with
+ *					  its generator on the bug's stream
+ *					  (see bug_stream(...)).
+ * */
+static inline void bug_move( const size_t bug, const Swarm_t *const swarm,
+			hb_map_t *const swarm_map, hb_heat_t *const heat_map,
+			float *const unhappiness, const Parameters_t *const params,
+			AgentState_t *const state )
+{
+	size_t bug_locus, bug_new_locus;
+	size_t cell;
+	float heat;
+	int todo;
+
+
+	bug_locus = swarm->locus[ bug ];
+
+	const Around_t at = locate( bug_locus, params );
+	cell = HEAT_CELL( params, at.rc, at.cc );
+	heat = heat_get( heat_map[ cell ] );
+
+	/* Compute bug unhappiness, before trying to move. */
+	unhappiness[ bug ] =
+		fabs( (float) swarm->ideal_temperature[ bug ] - heat );
+
+	stats_bug( &state->stats, unhappiness[ bug ], swarm->output_heat[ bug ] );
+
+	/*
+	 * Usually compare equality of floats is absurd. Netlogo
+	 * wrapps the code with: if (unhappiness > 0) { do stuff... }
+	 * I decided to unwrap, terminating as soon as possible using
+	 * if (bug_unhappiness = 0.0f) {...}  and continue the
+	 * remaining code as a fall out case for (bug_unhappiness >
+	 * 0.0f). After all, this is semantically equivalent to
+	 * netlogo version.
+	 * */
+	if (unhappiness[ bug ] == 0.0f)
+	{
+		 /* Bug hasn't move, we don't need to update swarm. */
+		 heat_store( heat_map, params, cell, at.rc, at.cc,
+				heat_put( heat + swarm->output_heat[ bug ] ) );
+		 return;	/* Next bug. */
+	}
+
+	/* Arriving here, means (unhappiness > 0.0f) */
+
+	/*
+		Find the best place for the bug to go.
+		In order to implement netlogo approach, that is
+		(in netlogo order), to compute:
+		1) random-move-chance,
+		2) best-patch for (temp <  ideal_temp) (when bug is COLD),
+		3) best-patch for (temp >= ideal_temp) (when bug is HOT),
+		we use the C conditional function twice.
+
+		A variable is used to hold what to do, (1), (2) or (3).
+		However the order must be reversed since (1), when
+		happen, takes precedence over (2) or (3), whatever
+		(2) XOR (3) are true or not.
+	*/
+
+	todo = (heat < swarm->ideal_temperature[ bug ])
+			? FIND_MAX_TEMPERATURE : FIND_MIN_TEMPERATURE;
+
+	todo = (hb_rng_double_range( &state->rng, 0, 100 ) < params->bugs_random_move_chance)
+			? FIND_ANY_FREE : todo;
+
+
+	bug_new_locus = best_free_neighbour( todo, heat_map, swarm_map,
+						params, &at, state );
+
+	/*
+		Since the execution line is serial, 'bug_new_locus' is
+		garantee to be: 1) the same as 'bug_locus', or 2) a new
+		free location.
+		It is not necessary to check again the free position,
+		so we can update temperature at 'bug_new_locus',
+		and only then check if the bug move or stay at the same
+		'bug_locus' position.
+	*/
+	if (around_inner( &at, params ))
+	{
+		/* Away from the edges, no ghost cells to keep. */
+		cell = heat_step( cell, bug_locus, bug_new_locus );
+		heat_map[ cell ] = heat_put( heat_get( heat_map[ cell ] )
+						+ swarm->output_heat[ bug ] );
+	}
+	else
+	{
+		const Around_t to = locate( bug_new_locus, params );
+
+		cell = HEAT_CELL( params, to.rc, to.cc );
+		heat_store( heat_map, params, cell, to.rc, to.cc,
+			heat_put( heat_get( heat_map[ cell ] ) + swarm->output_heat[ bug ] ) );
+	}
+
+
+	/* If bug's current location is already the best one... */
+	if (bug_new_locus == bug_locus)
+	{
+		/* Bug hasn't move, we don't need to update swarm's. */
+		return;	/* Next bug. */
+	}
+
+	/* Otherwise, move the bug to his new 'best' location. */
+
+	/* Set new bug location in the "swarm". */
+	swarm->locus[ bug ] = (hb_locus_t) bug_new_locus; /* Update swarm. */
 
-	for (size_t idx = 0; idx < vsize; idx++)
-		sum += vector[ idx ];
+	/* Move the bug to the new location in the "swarm_map". */
+	MAP_CLEAR( swarm_map, bug_locus );
+	MAP_SET_BUG( swarm_map, bug_new_locus );
 
-	return sum / vsize;
+	return;
 }
 
 